@@ -0,0 +1,81 @@
+// Throughput and latency of the binary protocol listener over one connection.
+// Keeps a window of requests in flight: one transaction in ten is an extrato, the rest are credits and debits of 1.
+// usage: bench/binario [host] [port] [requests] [window]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../client/binario_client.h"
+
+static uint64_t now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b){
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+// queue request i, remembering when it left
+static void send_request(binario_client_t *client, uint32_t i, uint64_t *sent){
+	uint32_t id = i % 10 == 9 ?
+		binario_extrato(client, i % 5 + 1) :
+		binario_transacao(client, i % 5 + 1, 1, i % 2 ? 'c' : 'd', "bench");
+	sent[id] = now_ns();
+}
+
+int main(int argc, char **argv){
+	const char *host = argc > 1 ? argv[1] : "localhost";
+	const char *port = argc > 2 ? argv[2] : "9998";
+	uint32_t requests = argc > 3 ? atoi(argv[3]) : 100000;
+	uint32_t window = argc > 4 ? atoi(argv[4]) : 64;
+
+	binario_client_t *client = binario_connect(host, port);
+	if(client == NULL){
+		printf("Could not connect to [%s:%s]\n", host, port);
+		return 1;
+	}
+
+	// ids start at 1 and follow the send order
+	uint64_t *sent = calloc(requests + 1, sizeof(uint64_t));
+	uint64_t *latency = calloc(requests, sizeof(uint64_t));
+	uint32_t status[600] = {0};
+
+	uint64_t start = now_ns();
+	uint32_t next = 0, done = 0;
+	while(next < requests && next < window)
+		send_request(client, next++, sent);
+
+	binario_response_t response;
+	while(done < requests){
+		if(!binario_receive(client, &response)){
+			printf("Connection failed after [%u] responses\n", done);
+			return 1;
+		}
+
+		latency[done++] = now_ns() - sent[response.id];
+		if(response.status < 600)
+			status[response.status]++;
+
+		if(next < requests)
+			send_request(client, next++, sent);
+	}
+
+	double secs = (now_ns() - start) / 1e9;
+	qsort(latency, requests, sizeof(uint64_t), compare);
+
+	printf("%u requests, window %u: %.0f req/s, p50 %.1fus, p99 %.1fus, max %.1fus\n", requests, window, requests / secs,
+		latency[requests / 2] / 1e3, latency[(uint64_t)requests * 99 / 100] / 1e3, latency[requests - 1] / 1e3);
+
+	for(int s = 0; s < 600; s++){
+		if(status[s])
+			printf("  status %d: %u\n", s, status[s]);
+	}
+
+	binario_close(client);
+	free(sent);
+	free(latency);
+	return 0;
+}
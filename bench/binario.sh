@@ -0,0 +1,21 @@
+#!/bin/sh
+# Binary protocol listener throughput, one connection per window size.
+# The api runs with the memory db so only the protocol and the saldo path are measured.
+# usage: sh bench/binario.sh [requests]
+
+REQUESTS=${1:-200000}
+PORT=9998
+LOG=$(mktemp)
+
+DB_VENDOR=memory SERVER_PORT=5001 SERVER_BINARY_PORT=$PORT \
+SERVER_DB_CONNS=4 SERVER_THREADS=4 SERVER_WORKERS=1 ./webserver > $LOG 2>&1 &
+pid=$!
+sleep 1
+
+for window in 1 16 64 256; do
+	./bench/binario localhost $PORT $REQUESTS $window
+done
+
+kill -INT $pid
+wait
+rm -f $LOG
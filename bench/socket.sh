@@ -0,0 +1,43 @@
+#!/bin/sh
+# Per request latency through a local nginx: tcp loopback upstreams vs unix sockets.
+# Needs nginx and curl on the host. The apis run with the memory db so only the proxy hop is measured.
+# usage: sh bench/socket.sh [requests]
+
+REQUESTS=${1:-2000}
+DIR=$(mktemp -d)
+SOCKETS=/tmp/sockets
+
+mkdir -p $SOCKETS $DIR/logs
+
+# apis listening on both the port and the socket
+pids=""
+for api in 1 2; do
+	DB_VENDOR=memory SERVER_PORT=500$api SERVER_UNIX_SOCKET=$SOCKETS/api$api.sock \
+	SERVER_DB_CONNS=4 SERVER_THREADS=2 SERVER_WORKERS=1 ./webserver > $DIR/api$api.log 2>&1 &
+	pids="$pids $!"
+done
+sleep 1
+
+# nginx.conf uses the sockets, the tcp variant points the upstreams back to the ports
+cp nginx.conf $DIR/unix.conf
+sed -e "s#unix:$SOCKETS/api1.sock#localhost:5001#" -e "s#unix:$SOCKETS/api2.sock#localhost:5002#" nginx.conf > $DIR/tcp.conf
+
+# same connection for every request, curl reuses it
+urls=""
+for i in $(seq $REQUESTS); do
+	urls="$urls -o /dev/null http://localhost:9999/clientes/$((i % 5 + 1))/extrato"
+done
+
+for mode in tcp unix; do
+	nginx -c $DIR/$mode.conf -g "daemon on; pid $DIR/nginx.pid;" -p $DIR
+	sleep 0.5
+	curl -s -w "%{time_total}\n" $urls | sort -n | awk -v mode=$mode '
+		{ t[NR] = $1 * 1000000; sum += t[NR] }
+		END { printf "%s: %d requests, avg %.1fus, p50 %.1fus, p99 %.1fus\n", mode, NR, sum / NR, t[int(NR * 0.5)], t[int(NR * 0.99)] }'
+	kill $(cat $DIR/nginx.pid)
+	sleep 0.5
+done
+
+kill -INT $pids
+wait
+rm -rf $DIR
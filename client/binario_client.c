@@ -0,0 +1,115 @@
+#include "binario_client.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define BINARIO_CLIENT_BUFFER 65536
+
+struct binario_client_t{
+	int fd;
+	uint32_t next_id;
+	uint8_t out[BINARIO_CLIENT_BUFFER];
+	size_t out_len;
+	uint8_t in[BINARIO_CLIENT_BUFFER];
+	size_t in_len;
+};
+
+binario_client_t *binario_connect(const char *host, const char *port){
+	struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+	struct addrinfo *addrs;
+	if(getaddrinfo(host, port, &hints, &addrs) != 0)
+		return NULL;
+
+	int fd = -1;
+	for(struct addrinfo *addr = addrs; addr != NULL && fd < 0; addr = addr->ai_next){
+		fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+		if(fd >= 0 && connect(fd, addr->ai_addr, addr->ai_addrlen) != 0){
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addrs);
+
+	if(fd < 0)
+		return NULL;
+
+	// frames are small and flushed on purpose
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	binario_client_t *client = calloc(1, sizeof(binario_client_t));
+	client->fd = fd;
+	client->next_id = 1;
+	return client;
+}
+
+void binario_close(binario_client_t *client){
+	if(client == NULL)
+		return;
+
+	close(client->fd);
+	free(client);
+}
+
+bool binario_flush(binario_client_t *client){
+	size_t pos = 0;
+	while(pos < client->out_len){
+		ssize_t sent = write(client->fd, client->out + pos, client->out_len - pos);
+		if(sent <= 0)
+			return false;
+
+		pos += sent;
+	}
+
+	client->out_len = 0;
+	return true;
+}
+
+// append a request, flushing when the buffer is full
+static uint32_t binario_queue(binario_client_t *client, binario_request_t *request){
+	if(BINARIO_CLIENT_BUFFER - client->out_len < BINARIO_MAX_REQUEST)
+		binario_flush(client);
+
+	request->id = client->next_id++;
+	client->out_len += binario_encode_request(client->out + client->out_len, request);
+	return request->id;
+}
+
+uint32_t binario_transacao(binario_client_t *client, int64_t cliente, int64_t valor, char tipo, const char *descricao){
+	binario_request_t request = {.op = binario_op_transacao, .cliente = cliente, .valor = valor, .tipo = tipo};
+	snprintf(request.descricao, sizeof(request.descricao), "%s", descricao);
+	return binario_queue(client, &request);
+}
+
+uint32_t binario_extrato(binario_client_t *client, int64_t cliente){
+	binario_request_t request = {.op = binario_op_extrato, .cliente = cliente};
+	return binario_queue(client, &request);
+}
+
+bool binario_receive(binario_client_t *client, binario_response_t *response){
+	if(client->out_len > 0 && !binario_flush(client))
+		return false;
+
+	for(;;){
+		ssize_t len = binario_decode_response(client->in, client->in_len, response);
+		if(len < 0)
+			return false;
+
+		if(len > 0){
+			client->in_len -= len;
+			memmove(client->in, client->in + len, client->in_len);
+			return true;
+		}
+
+		ssize_t got = read(client->fd, client->in + client->in_len, BINARIO_CLIENT_BUFFER - client->in_len);
+		if(got <= 0)
+			return false;
+
+		client->in_len += got;
+	}
+}
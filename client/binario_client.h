@@ -0,0 +1,50 @@
+#ifndef _BINARIO_CLIENT_HEADER_
+#define _BINARIO_CLIENT_HEADER_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "../src/binario.h"
+
+// ------------------------------------------------------------ Types --------------------------------------------------------------
+
+/**
+ * @brief blocking connection to the binary protocol listener (SERVER_BINARY_PORT).
+ * Requests are buffered until binario_flush, so many can be in flight; responses come back in any order.
+ * Not thread safe, use one per thread
+*/
+typedef struct binario_client_t binario_client_t;
+
+// ------------------------------------------------------------ Functions ----------------------------------------------------------
+
+/**
+ * @brief connect to host:port, NULL on failure
+*/
+binario_client_t *binario_connect(const char *host, const char *port);
+
+/**
+ * @brief close the connection and free the client
+*/
+void binario_close(binario_client_t *client);
+
+/**
+ * @brief queue a transaction (tipo 'c' or 'd', descricao with 1 to 10 chars). Returns its request id
+*/
+uint32_t binario_transacao(binario_client_t *client, int64_t cliente, int64_t valor, char tipo, const char *descricao);
+
+/**
+ * @brief queue an extrato request. Returns its request id
+*/
+uint32_t binario_extrato(binario_client_t *client, int64_t cliente);
+
+/**
+ * @brief write the queued requests. false when the connection failed
+*/
+bool binario_flush(binario_client_t *client);
+
+/**
+ * @brief wait for the next response, flushing queued requests first. false when the connection failed or sent garbage
+*/
+bool binario_receive(binario_client_t *client, binario_response_t *response);
+
+#endif
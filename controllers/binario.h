@@ -0,0 +1,213 @@
+#ifndef _BINARIO_CONTROLLER_HEADER_
+#define _BINARIO_CONTROLLER_HEADER_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../facil.io/fio.h"
+#include "../src/httpStatusCodes.h"
+#include "../src/binario.h"
+#include "../src/proxy.h"
+#include "cliente.h"
+
+#define BINARIO_READ 16384
+#define BINARIO_MAX_DEPTH 32					// requests running per connection, the next ones wait in order and reading stops
+
+typedef struct binario_job_t binario_job_t;
+
+// internal caller connection
+typedef struct{
+	fio_protocol_s protocol;
+	intptr_t uuid;
+	uint8_t in[BINARIO_READ];				// unparsed bytes, only touched by on_data
+	size_t len;
+	pthread_mutex_t lock;					// guards everything below
+	size_t depth;
+	binario_job_t *queue;
+	binario_job_t **queue_tail;
+	bool suspended;
+	size_t refs;							// the connection plus one per request running
+}binario_conn_t;
+
+// request waiting for a thread
+struct binario_job_t{
+	binario_job_t *next;
+	binario_conn_t *conn;
+	binario_request_t request;
+	cliente_tarefa_t tarefa;				// admission and deadline of the request
+};
+
+static void binario_release(binario_conn_t *conn){
+	pthread_mutex_lock(&(conn->lock));
+	size_t refs = --conn->refs;
+	pthread_mutex_unlock(&(conn->lock));
+
+	if(refs > 0)
+		return;
+
+	pthread_mutex_destroy(&(conn->lock));
+	free(conn);
+}
+
+// extrato rows as binary transactions
+static void binario_extrato(binario_response_t *response, int64_t id){
+	db_results_t *res;
+	uint32_t col;
+
+	response->status = extrato(id, &(response->saldo), &(response->limite), &res, &col);
+	if(response->status != http_status_code_Ok)
+		return;
+
+	for(uint32_t r = 0; r < res->entries_count && response->count < BINARIO_MAX_TRANSACOES; r++){
+		// left join without transactions
+		if(db_read_field(res, r, col).type != db_type_int)
+			continue;
+
+		binario_transacao_t *t = &(response->transacoes[response->count++]);
+		t->valor = db_read_field(res, r, col).value.as_int;
+		t->tipo = db_read_field(res, r, col + 1).value.as_bool ? 'c' : 'd';
+		snprintf(t->descricao, sizeof(t->descricao), "%s", db_read_field(res, r, col + 2).value.as_string);
+		snprintf(t->realizada_em, sizeof(t->realizada_em), "%s", db_read_field(res, r, col + 3).value.as_string);
+	}
+
+	db_results_destroy(ctx.db, res);
+}
+
+// run a request on a pool thread, same controller logic as the http api
+static void binario_run(void *udata, void *unused){
+	binario_job_t *job = udata;
+	binario_conn_t *conn = job->conn;
+	binario_request_t *request = &(job->request);
+
+	binario_response_t *response = calloc(1, sizeof(binario_response_t));
+	response->id = request->id;
+	response->op = request->op;
+
+	if(request->cliente < 1 || request->cliente > 5)
+		response->status = http_status_code_NotFound;
+	else if(ctx.cluster != NULL && proxy_route(ctx.cluster, request->cliente) != ctx.cluster_self)
+		response->status = http_status_code_MisdirectedRequest;
+	else if(request->op != binario_op_extrato && request->tipo != 'c' && request->tipo != 'd')
+		response->status = http_status_code_BadRequest;
+	else if(!cliente_tarefa_comecar(&(job->tarefa)))
+		response->status = http_status_code_ServiceUnavailable;
+	else if(request->op == binario_op_extrato)
+		binario_extrato(response, request->cliente);
+	else
+		response->status = transar(request->cliente, request->valor, request->tipo, request->descricao, &(response->saldo), &(response->limite));
+	cliente_tarefa_terminar(&(job->tarefa));
+
+	// frames go out as soon as they are ready, the request id tells them apart
+	uint8_t *frame = malloc(BINARIO_MAX_RESPONSE);
+	size_t len = binario_encode_response(frame, response);
+	fio_write2(conn->uuid, .data.buffer = frame, .length = len, .after.dealloc = free);
+	free(response);
+	free(job);
+
+	// the slot goes to the oldest waiting request
+	pthread_mutex_lock(&(conn->lock));
+	binario_job_t *next = conn->queue;
+	if(next != NULL){
+		conn->queue = next->next;
+		if(conn->queue == NULL)
+			conn->queue_tail = &(conn->queue);
+	}
+	else
+		conn->depth--;
+
+	bool resume = conn->suspended && conn->queue == NULL;
+	if(resume)
+		conn->suspended = false;
+	pthread_mutex_unlock(&(conn->lock));
+
+	if(resume)
+		fio_force_event(conn->uuid, FIO_EVENT_ON_DATA);
+
+	if(next != NULL)
+		cliente_tarefa(&(next->tarefa), next->request.op != binario_op_extrato, binario_run, next);
+	else
+		binario_release(conn);
+}
+
+static void binario_on_data(intptr_t uuid, fio_protocol_s *protocol){
+	binario_conn_t *conn = (binario_conn_t*)protocol;
+
+	ssize_t read = fio_read(uuid, conn->in + conn->len, BINARIO_READ - conn->len);
+	if(read <= 0)
+		return;
+	conn->len += read;
+
+	size_t pos = 0;
+	for(;;){
+		binario_request_t request;
+		ssize_t len = binario_decode_request(conn->in + pos, conn->len - pos, &request);
+		if(len == 0)
+			break;
+
+		// frames can't be resynced
+		if(len < 0){
+			fio_close(uuid);
+			return;
+		}
+		pos += len;
+
+		binario_job_t *job = malloc(sizeof(binario_job_t));
+		job->next = NULL;
+		job->conn = conn;
+		job->request = request;
+
+		// past the depth, wait in order and stop reading until the queue drains
+		pthread_mutex_lock(&(conn->lock));
+		bool run = conn->depth < BINARIO_MAX_DEPTH;
+		if(run){
+			conn->depth++;
+			conn->refs++;
+		}
+		else{
+			*(conn->queue_tail) = job;
+			conn->queue_tail = &(job->next);
+
+			// every time: a read already scheduled lifts the suspension
+			conn->suspended = true;
+			fio_suspend(uuid);
+		}
+		pthread_mutex_unlock(&(conn->lock));
+
+		// extratos wait behind transactions at the admission gate
+		if(run)
+			cliente_tarefa(&(job->tarefa), request.op != binario_op_extrato, binario_run, job);
+	}
+
+	conn->len -= pos;
+	memmove(conn->in, conn->in + pos, conn->len);
+}
+
+// waiting requests still run, their answers are dropped with the socket
+static void binario_on_close(intptr_t uuid, fio_protocol_s *protocol){
+	binario_release((binario_conn_t*)protocol);
+}
+
+static void binario_ping(intptr_t uuid, fio_protocol_s *protocol){
+	fio_touch(uuid);
+}
+
+static void binario_on_open(intptr_t uuid, void *udata){
+	binario_conn_t *conn = calloc(1, sizeof(binario_conn_t));
+	conn->protocol.on_data = binario_on_data;
+	conn->protocol.on_close = binario_on_close;
+	conn->protocol.ping = binario_ping;
+	conn->uuid = uuid;
+	conn->queue_tail = &(conn->queue);
+	conn->refs = 1;
+	pthread_mutex_init(&(conn->lock), NULL);
+
+	fio_attach(uuid, &(conn->protocol));
+}
+
+// binary protocol listener for internal callers. Call before fio_start
+bool binario_listen(const char *port){
+	return fio_listen(.port = port, .on_open = binario_on_open) != -1;
+}
+
+#endif
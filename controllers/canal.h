@@ -0,0 +1,248 @@
+#ifndef _CANAL_HEADER_
+#define _CANAL_HEADER_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../facil.io/http.h"
+#include "../src/httpStatusCodes.h"
+#include "../src/utils.h"
+#include "cliente.h"
+#include "cluster.h"
+
+#define CANAL_MAX_DEPTH 32						// transactions running per connection, the next ones wait in order
+#define CANAL_MAX_QUEUE 1024					// waiting frames before they are refused with 429
+#define CANAL_BIN_REQUEST 10					// u32 id, u32 valor, u8 tipo, u8 descricao length, descricao
+#define CANAL_BIN_RESPONSE 22					// u32 id, u16 status, i64 saldo, i64 limite
+
+typedef struct canal_job_t canal_job_t;
+
+// websocket of one client
+typedef struct{
+	pthread_mutex_t lock;
+	ws_s *ws;								// NULL once closed
+	intptr_t uuid;
+	int64_t id;
+	size_t depth;							// transactions running
+	canal_job_t *queue;						// frames past the depth, reading stops while there are any
+	canal_job_t **queue_tail;
+	size_t queued;
+	bool suspended;
+	size_t refs;							// the connection plus one per transaction in flight
+}canal_t;
+
+// transaction frame waiting for a thread
+struct canal_job_t{
+	canal_job_t *next;
+	canal_t *canal;
+	uint32_t corr;							// correlation id chosen by the client
+	bool binary;							// answer in the frame type it came in
+	int64_t valor;
+	char tipo;
+	char desc[11];
+	cliente_tarefa_t tarefa;				// admission and deadline of the transaction
+};
+
+// drop a reference, the last one frees the channel
+static void canal_release(canal_t *canal){
+	pthread_mutex_lock(&(canal->lock));
+	size_t refs = --canal->refs;
+	pthread_mutex_unlock(&(canal->lock));
+
+	if(refs > 0)
+		return;
+
+	pthread_mutex_destroy(&(canal->lock));
+	free(canal);
+}
+
+static uint32_t canal_u32(const uint8_t *p){
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void canal_put(uint8_t *p, uint64_t value, int bytes){
+	for(int i = 0; i < bytes; i++)
+		p[i] = value >> (8 * i);
+}
+
+// write the result of a frame, unless the client is gone
+static void canal_reply(canal_t *canal, uint32_t corr, bool binary, int status, int64_t saldo, int64_t limite){
+	char text[96];
+	fio_str_info_s msg = {.data = text};
+
+	if(binary){
+		canal_put((uint8_t*)text, corr, 4);
+		canal_put((uint8_t*)text + 4, status, 2);
+		canal_put((uint8_t*)text + 6, saldo, 8);
+		canal_put((uint8_t*)text + 14, limite, 8);
+		msg.len = CANAL_BIN_RESPONSE;
+	}
+	else if(status == http_status_code_Ok)
+		msg.len = snprintf(text, sizeof(text), "{\"id\":%u,\"status\":%d,\"limite\":%ld,\"saldo\":%ld}", corr, status, limite, saldo);
+	else
+		msg.len = snprintf(text, sizeof(text), "{\"id\":%u,\"status\":%d}", corr, status);
+
+	pthread_mutex_lock(&(canal->lock));
+	if(canal->ws != NULL)
+		websocket_write(canal->ws, msg, !binary);
+	pthread_mutex_unlock(&(canal->lock));
+}
+
+// apply a transaction on a pool thread, same path as post_transa
+static void canal_transar(void *udata, void *unused){
+	canal_job_t *job = udata;
+	canal_t *canal = job->canal;
+
+	int64_t saldo = 0, limite = 0;
+	int status = http_status_code_ServiceUnavailable;
+	if(cliente_tarefa_comecar(&(job->tarefa)))
+		status = transar(canal->id, job->valor, job->tipo, job->desc, &saldo, &limite);
+	cliente_tarefa_terminar(&(job->tarefa));
+	canal_reply(canal, job->corr, job->binary, status, saldo, limite);
+	free(job);
+
+	// the slot goes to the oldest waiting frame
+	pthread_mutex_lock(&(canal->lock));
+	canal_job_t *next = canal->queue;
+	if(next != NULL){
+		canal->queue = next->next;
+		if(canal->queue == NULL)
+			canal->queue_tail = &(canal->queue);
+		canal->queued--;
+	}
+	else
+		canal->depth--;
+
+	bool resume = canal->suspended && canal->queue == NULL && canal->ws != NULL;
+	if(resume)
+		canal->suspended = false;
+	pthread_mutex_unlock(&(canal->lock));
+
+	if(resume)
+		fio_force_event(canal->uuid, FIO_EVENT_ON_DATA);
+
+	if(next != NULL)
+		cliente_tarefa(&(next->tarefa), true, canal_transar, next);
+	else
+		canal_release(canal);
+}
+
+// text: {"id":1,"valor":1000,"tipo":"c","descricao":"descricao"}, fields in this order
+static bool canal_parse_text(fio_str_info_s msg, canal_job_t *job){
+	char text[256];
+	if(msg.len < 6 || msg.len >= sizeof(text) || memcmp(msg.data, "{\"id\":", 6) != 0)
+		return false;
+
+	// frames aren't nul terminated
+	memcpy(text, msg.data, msg.len);
+	text[msg.len] = '\0';
+
+	char *tmp;
+	job->corr = strtoul(text + 6, &tmp, 10);
+	if(*tmp != ',')
+		return false;
+
+	char *desc = job->desc;
+	return parseTransa(tmp, &(job->valor), &(job->tipo), &desc);
+}
+
+static bool canal_parse_binary(fio_str_info_s msg, canal_job_t *job){
+	const uint8_t *data = (const uint8_t*)msg.data;
+	if(msg.len < CANAL_BIN_REQUEST)
+		return false;
+
+	size_t len = data[9];
+	if(msg.len != CANAL_BIN_REQUEST + len || (data[8] != 'c' && data[8] != 'd'))
+		return false;
+
+	// the 400 carries the id from here on
+	job->corr = canal_u32(data);
+
+	// copied into the extrato json as is
+	if(!validDescricao((const char*)data + CANAL_BIN_REQUEST, len))
+		return false;
+
+	job->valor = canal_u32(data + 4);
+	job->tipo = data[8];
+	memcpy(job->desc, data + CANAL_BIN_REQUEST, len);
+	return true;
+}
+
+static void canal_on_message(ws_s *ws, fio_str_info_s msg, uint8_t is_text){
+	canal_t *canal = websocket_udata_get(ws);
+
+	canal_job_t *job = calloc(1, sizeof(canal_job_t));
+	job->canal = canal;
+	job->binary = !is_text;
+
+	if(!(is_text ? canal_parse_text(msg, job) : canal_parse_binary(msg, job))){
+		canal_reply(canal, job->corr, job->binary, http_status_code_BadRequest, 0, 0);
+		free(job);
+		return;
+	}
+
+	// past the depth, wait in order and stop reading until the queue drains
+	pthread_mutex_lock(&(canal->lock));
+	bool run = canal->depth < CANAL_MAX_DEPTH;
+	bool full = !run && canal->queued >= CANAL_MAX_QUEUE;
+	if(run){
+		canal->depth++;
+		canal->refs++;
+	}
+	else if(!full){
+		*(canal->queue_tail) = job;
+		canal->queue_tail = &(job->next);
+		canal->queued++;
+
+		// every time: a read already scheduled lifts the suspension
+		canal->suspended = true;
+		fio_suspend(canal->uuid);
+	}
+	pthread_mutex_unlock(&(canal->lock));
+
+	if(full){
+		canal_reply(canal, job->corr, job->binary, http_status_code_TooManyRequests, 0, 0);
+		free(job);
+		return;
+	}
+
+	// transar blocks on the db, keep the reactor reading frames. It runs once the admission gate lets it
+	if(run)
+		cliente_tarefa(&(job->tarefa), true, canal_transar, job);
+}
+
+static void canal_on_close(intptr_t uuid, void *udata){
+	canal_t *canal = udata;
+
+	// waiting frames still run, their answers are dropped
+	pthread_mutex_lock(&(canal->lock));
+	canal->ws = NULL;
+	pthread_mutex_unlock(&(canal->lock));
+
+	canal_release(canal);
+}
+
+static void canal_on_open(ws_s *ws){
+	canal_t *canal = websocket_udata_get(ws);
+	canal->ws = ws;
+	canal->uuid = websocket_uuid(ws);
+}
+
+// upgrade to a transaction channel of the client
+void canal_open(http_s *h, int64_t id){
+	// the saldo lives in the owner's cache
+	if(cluster_owner(h, id) >= 0){
+		http_send_error(h, http_status_code_MisdirectedRequest);
+		return;
+	}
+
+	canal_t *canal = calloc(1, sizeof(canal_t));
+	pthread_mutex_init(&(canal->lock), NULL);
+	canal->id = id;
+	canal->queue_tail = &(canal->queue);
+	canal->refs = 1;
+	http_upgrade2ws(h, .on_open = canal_on_open, .on_message = canal_on_message, .on_close = canal_on_close, .udata = canal);
+}
+
+#endif
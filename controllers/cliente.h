@@ -1,4 +1,8 @@
+#ifndef _CLIENTE_CONTROLLER_HEADER_
+#define _CLIENTE_CONTROLLER_HEADER_
+
 #include <time.h>
+#include <unistd.h>
 #include "../facil.io/http.h"
 #include "../src/httpStatusCodes.h"
 #include "../src/utils.h"
@@ -7,12 +11,224 @@
 #include "../models/context.h"
 #include "../models/cliente.h"
 #include "../models/transa.h"
+#include "cluster.h"
+#include "eventos.h"
+#include "historico.h"
+#include "exportar.h"
+#include "voo.h"
+#include "metricas.h"
+#include "rastro.h"
 
 void get_extrato(http_s *h, int64_t id);
 void post_transa(http_s *h, int64_t id);
+void post_transa_lote(http_s *h, int64_t id);
+void canal_open(http_s *h, int64_t id);
 
-// handle request
-void cliente_request(http_s *h){
+// static headers of the json responses, built once by cliente_init
+http_template_s *cliente_headers = NULL;
+
+// tells this process' cache apart in etags, versions start over with it
+static uint64_t cliente_epoca = 0;
+
+#define CLIENTE_ETAG_LEN 64
+
+#define CLIENTE_FILA_MS 5						// how often queued requests are checked against the admission budget
+
+// sheds the requests whose admission budget ran out in the queue
+static void cliente_expirar(void *unused){
+	admission_expire(ctx.admission);
+	admission_expire(ctx.admission_streams);
+}
+
+static void cliente_on_start(void *unused){
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	cliente_epoca = ((uint64_t)getpid() << 40) ^ (uint64_t)ts.tv_sec;
+
+	if(ctx.admission != NULL)
+		fio_run_every(CLIENTE_FILA_MS, 0, cliente_expirar, NULL, NULL);
+}
+
+// build response header templates. Call before http_listen
+void cliente_init(void){
+	cliente_headers = http_template_new("content-type:application/json\r\n");
+	fio_state_callback_add(FIO_CALL_ON_START, cliente_on_start, NULL);
+}
+
+// take a token of the client's bucket, answering 429 when it is empty. The reactor's clock, no syscall
+static bool cliente_limitar(http_s *h, int64_t id){
+	if(clientes_consumir(&ctx.clientes, id, clientes_ms(fio_last_tick())))
+		return true;
+
+	http_send_error(h, http_status_code_TooManyRequests);
+	return false;
+}
+
+// shed request, told when to come back
+static void cliente_recusar(http_s *h, uint32_t retry_after){
+	char value[16];
+	int len = snprintf(value, sizeof(value), "%u", retry_after);
+	http_set_header2(h, (fio_str_info_s){.data = "retry-after", .len = 11}, (fio_str_info_s){.data = value, .len = len});
+	http_send_error(h, http_status_code_ServiceUnavailable);
+}
+
+// the db work of a request, holding its admission slot (gate NULL for none) until the handler returns
+static void cliente_atender(http_s *h, int64_t id, admission_t *gate, uint64_t ticket){
+	const char *method = fiobj_obj2cstr(h->method).data;
+	int64_t unused;
+	char *action = parseIdAction(fiobj_obj2cstr(h->path).data, &unused);
+
+	// callers
+	if(*method == 'G' && action != NULL && strcmp(action, "transacoes") == 0)
+		historico_stream(h, id);
+	else if(*method == 'G' && action != NULL && strcmp(action, "exportar") == 0)
+		exportar_stream(h, id);
+	else if(*method == 'G')
+		get_extrato(h, id);
+	else if(action != NULL && strcmp(action, "transacoes/lote") == 0)
+		post_transa_lote(h, id);
+	else
+		post_transa(h, id);
+
+	if(gate != NULL)
+		admission_leave(gate, ticket);
+	db_deadline(0);
+}
+
+// request waiting in the admission queue, paused so that no thread waits with it
+typedef struct{
+	http_pause_handle_s *paused;
+	void *udata;							// h->udata while paused
+	int64_t id;
+	admission_t *gate;
+	bool escrita;
+	uint64_t prazo;							// its deadline, see db_deadline_get()
+	bool admitido;
+	uint64_t ticket;
+	uint32_t retry_after;
+}cliente_espera_t;
+
+// back on a pool thread with the outcome
+static void cliente_retomar(http_s *h){
+	cliente_espera_t *espera = h->udata;
+	h->udata = espera->udata;
+
+	if(espera->admitido){
+		db_deadline_at(espera->prazo);
+		cliente_atender(h, espera->id, espera->gate, espera->ticket);
+	}
+	else
+		cliente_recusar(h, espera->retry_after);
+
+	free(espera);
+}
+
+// connection closed while paused, a slot it got goes back
+static void cliente_desistir(void *udata){
+	cliente_espera_t *espera = udata;
+	if(espera->admitido)
+		admission_leave(espera->gate, espera->ticket);
+	free(espera);
+}
+
+// admission settled, from the thread that freed the slot or the expiry timer
+static void cliente_admitido(void *udata, bool admitted, uint64_t ticket, uint32_t retry_after){
+	cliente_espera_t *espera = udata;
+	espera->admitido = admitted;
+	espera->ticket = ticket;
+	espera->retry_after = retry_after;
+	http_resume(espera->paused, cliente_retomar, cliente_desistir);
+}
+
+static void cliente_esperar(http_pause_handle_s *paused){
+	cliente_espera_t *espera = http_paused_udata_get(paused);
+	espera->paused = paused;
+	admission_enter(espera->gate, espera->escrita, cliente_admitido, espera);
+}
+
+// run the db work now when a slot is free, otherwise queue the request paused. Writes go first. Shed requests get 503
+static void cliente_admitir(http_s *h, int64_t id, admission_t *gate, bool escrita){
+	uint64_t ticket = 0;
+	uint64_t trace = trace_start();
+	if(gate == NULL || admission_try(gate, escrita, &ticket)){
+		trace_span("admission", trace);
+		cliente_atender(h, id, gate, ticket);
+		return;
+	}
+
+	cliente_espera_t *espera = calloc(1, sizeof(cliente_espera_t));
+	espera->udata = h->udata;
+	espera->id = id;
+	espera->gate = gate;
+	espera->escrita = escrita;
+	espera->prazo = db_deadline_get();
+
+	h->udata = espera;
+	http_pause(h, cliente_esperar);
+	db_deadline(0);
+}
+
+// db work of a websocket or binary frame, admitted through the same gate and deadline as a request
+typedef struct{
+	void (*run)(void *udata, void *unused);	// the job, on a pool thread once admission settled
+	void *udata;
+	uint64_t prazo;							// its deadline, see db_deadline_get()
+	bool recusado;							// shed, answer 503 without touching the db
+	bool admitido;							// holds a slot of ctx.admission
+	uint64_t ticket;
+}cliente_tarefa_t;
+
+static void cliente_tarefa_pronta(void *udata, bool admitted, uint64_t ticket, uint32_t retry_after){
+	cliente_tarefa_t *tarefa = udata;
+	tarefa->recusado = !admitted;
+	tarefa->admitido = admitted;
+	tarefa->ticket = ticket;
+
+	if(fio_defer(tarefa->run, tarefa->udata, NULL) != 0)
+		tarefa->run(tarefa->udata, NULL);
+}
+
+/**
+ * @brief start the frame's deadline and queue run for a slot of the admission gate, or straight on the pool without one. Writes go first
+*/
+static void cliente_tarefa(cliente_tarefa_t *tarefa, bool escrita, void (*run)(void *udata, void *unused), void *udata){
+	*tarefa = (cliente_tarefa_t){.run = run, .udata = udata};
+
+	// the deadline starts before the admission queue, as for a request
+	db_deadline(ctx.deadline_us);
+	tarefa->prazo = db_deadline_get();
+	db_deadline(0);
+
+	if(ctx.admission != NULL)
+		admission_enter(ctx.admission, escrita, cliente_tarefa_pronta, tarefa);
+	else
+		cliente_tarefa_pronta(tarefa, true, 0, 0);
+}
+
+/**
+ * @brief in run, before the db work: false when the frame was shed, otherwise the frame's deadline is set on the thread
+*/
+static bool cliente_tarefa_comecar(cliente_tarefa_t *tarefa){
+	if(tarefa->recusado)
+		return false;
+
+	db_deadline_at(tarefa->prazo);
+	return true;
+}
+
+/**
+ * @brief in run, after the db work: clear the deadline and give the slot back
+*/
+static void cliente_tarefa_terminar(cliente_tarefa_t *tarefa){
+	db_deadline(0);
+	if(tarefa->admitido && ctx.admission != NULL)
+		admission_leave(ctx.admission, tarefa->ticket);
+	tarefa->admitido = false;
+}
+
+// serve a request, the route phase goes up to the handler
+static void cliente_servir(http_s *h){
+	uint64_t trace = trace_start();
 	const char *method = fiobj_obj2cstr(h->method).data;
 	if(method[0] != 'G' && method[0] != 'P'){
 		http_send_error(h, http_status_code_MethodNotAllowed);
@@ -20,8 +236,21 @@ void cliente_request(http_s *h){
 	}
 
 	char *path = fiobj_obj2cstr(h->path).data;
-	int64_t id;
-	parseIdAction(path, &id);
+
+	// prometheus scrape, this process only
+	if(*method == 'G' && strcmp(path, "/metrics") == 0){
+		metricas_get(h);
+		return;
+	}
+
+	// sampled spans of this process
+	if(*method == 'G' && strcmp(path, "/trace") == 0){
+		rastro_get(h);
+		return;
+	}
+
+	int64_t id = 0;
+	char *action = parseIdAction(path, &id);
 
 	// not found
 	if(id < 1 || id > 5){
@@ -29,33 +258,78 @@ void cliente_request(http_s *h){
 		return;
 	}
 
-	// callers
-	switch(*method){
-		case 'G':
-			get_extrato(h, id);
-		break;
-		case 'P':
-			post_transa(h, id);
-		break;
+	// saldo stream, a long lived response that can't be relayed to the owner
+	bool eventos = *method == 'G' && action != NULL && strcmp(action, "eventos") == 0;
+
+	// history comes from the db, any instance streams it
+	bool stream = *method == 'G' && action != NULL && (strcmp(action, "transacoes") == 0 || strcmp(action, "exportar") == 0);
+
+	// another instance owns this client, its cache is the one that is current
+	int owner = eventos || stream ? -1 : cluster_owner(h, id);
+	if(owner >= 0){
+		cluster_forward(h, owner);
+		return;
+	}
+
+	// the client's rate limit, taken where the request is served
+	if(!cliente_limitar(h, id))
+		return;
+
+	if(eventos){
+		eventos_stream(h, id);
+		return;
+	}
+
+	trace_span("route", trace);
+
+	// the deadline starts before the admission queue. Streams run as long as the client reads, on their own slots
+	if(stream){
+		cliente_admitir(h, id, ctx.admission_streams, false);
+		return;
 	}
+
+	db_deadline(ctx.deadline_us);
+	cliente_admitir(h, id, ctx.admission, *method == 'P');
 }
 
-// get extrato
-void get_extrato(http_s *h, int64_t id){
-	db_results_t *res = transa_extrato(ctx.db, id);
-	if(res->code != db_error_ok){
-		printf("%s", res->msg);
+// handle request. Sampled ones are traced from here, one span per phase
+void cliente_request(http_s *h){
+	trace_begin();
+	uint64_t trace = trace_start();
+	cliente_servir(h);
+	trace_span("request", trace);
+	trace_end();
+}
+
+// websocket transaction channel and requests sent with "accept: text/event-stream"
+void cliente_upgrade(http_s *h, char *protocol, size_t len){
+	char *path = fiobj_obj2cstr(h->path).data;
+	int64_t id = 0;
+	char *action = parseIdAction(path, &id);
+
+	bool sse = len == 3 && memcmp(protocol, "sse", 3) == 0 && action != NULL && strcmp(action, "eventos") == 0;
+	bool ws = len == 9 && strncasecmp(protocol, "websocket", 9) == 0 && action != NULL && strcmp(action, "transacoes") == 0;
+	if(!sse && !ws){
+		http_send_error(h, http_status_code_BadRequest);
+		return;
 	}
-	
-	cliente_t c = clientes_get_cached(&ctx.clientes, id);
 
-	// update db
-	db_results_t *updateRes = clientes_update(ctx.db, id, c.saldo);
-	if(updateRes->code != db_error_ok){
-		printf("%s", updateRes->msg);
+	if(id < 1 || id > 5){
+		http_send_error(h, http_status_code_NotFound);
+		return;
 	}
-	db_results_destroy(ctx.db, updateRes);
 
+	if(!cliente_limitar(h, id))
+		return;
+
+	if(sse)
+		eventos_stream(h, id);
+	else
+		canal_open(h, id);
+}
+
+// write extrato json. Transaction fields start at column col of res
+static void extrato_json(string *json, int64_t saldo, int64_t limite, db_results_t *res, uint32_t col){
 	// cur time
 	time_t curTime;
 	struct tm * curTimeInfo;
@@ -64,17 +338,22 @@ void get_extrato(http_s *h, int64_t id){
 	curTimeInfo = localtime(&curTime);
 	strftime(timeBuffer, 29, "%F %T.000000", curTimeInfo);
 
-	string *json = string_new_sized(1750);
-	string_write(json, "{\"saldo\":{\"total\":%ld,\"data_extrato\":\"%s\",\"limite\":%ld},\"ultimas_transacoes\":[", 225, c.saldo, timeBuffer, c.limite);
+	string_write(json, "{\"saldo\":{\"total\":%ld,\"data_extrato\":\"%s\",\"limite\":%ld},\"ultimas_transacoes\":[", 225, saldo, timeBuffer, limite);
 
+	bool first = true;
 	for(uint32_t r = 0; r < res->entries_count; r++){
-		int valor  = db_read_field(res, r, 0).value.as_int;
-		bool tipo  = db_read_field(res, r, 1).value.as_bool;
-		char *desc = db_read_field(res, r, 2).value.as_string;
-		char *time = db_read_field(res, r, 3).value.as_string;
+		// left join without transactions
+		if(db_read_field(res, r, col).type != db_type_int)
+			continue;
+
+		int64_t valor = db_read_field(res, r, col).value.as_int;
+		bool tipo     = db_read_field(res, r, col + 1).value.as_bool;
+		char *desc    = db_read_field(res, r, col + 2).value.as_string;
+		char *time    = db_read_field(res, r, col + 3).value.as_string;
 
-		if(r != 0)
+		if(!first)
 			string_cat_raw(json, ",", 1);
+		first = false;
 
 		string_write(json, "{\"valor\":%ld,\"tipo\":\"%c\",\"descricao\":\"%s\",\"realizada_em\":\"%s\"}", 200, 
 			valor,
@@ -85,13 +364,189 @@ void get_extrato(http_s *h, int64_t id){
 	}
 	
 	string_write(json, "]}", 5);
+}
 
-	size_t len = json->len;
-	
+// status of a failed db call: an exhausted pool is overload, the client may retry
+static int cliente_db_status(db_results_t *res){
+	switch(res->code){
+		case db_error_no_connection:
+			return http_status_code_ServiceUnavailable;
+		case db_error_timeout:
+			return http_status_code_GatewayTimeout;
+		default:
+			return http_status_code_InternalServerError;
+	}
+}
+
+// extrato data: saldo, limite and the transactions of res, starting at column col. returns http status, res is left to the caller on 200
+static int extrato(int64_t id, int64_t *saldo, int64_t *limite, db_results_t **res, uint32_t *col){
+	if(ctx.consistencia == consistencia_db){
+		*res = transa_extrato_saldo(ctx.db, id);
+		if((*res)->code != db_error_ok || (*res)->entries_count == 0){
+			printf("%s", (*res)->msg);
+			int status = (*res)->code != db_error_ok ? cliente_db_status(*res) : http_status_code_InternalServerError;
+			db_results_destroy(ctx.db, *res);
+			return status;
+		}
+
+		*saldo = db_read_field(*res, 0, 0).value.as_int;
+		*limite = db_read_field(*res, 0, 1).value.as_int;
+		*col = 2;
+	}
+	else{
+		*res = transa_extrato(ctx.db, id);
+		if((*res)->code != db_error_ok){
+			printf("%s", (*res)->msg);
+			int status = cliente_db_status(*res);
+			db_results_destroy(ctx.db, *res);
+			return status;
+		}
+
+		cliente_t c = clientes_get_cached(&ctx.clientes, id);
+
+		// update db
+		db_results_t *updateRes = clientes_update(ctx.db, id, c.saldo);
+		if(updateRes->code != db_error_ok){
+			printf("%s", updateRes->msg);
+		}
+		db_results_destroy(ctx.db, updateRes);
+
+		*saldo = c.saldo;
+		*limite = c.limite;
+		*col = 0;
+	}
+
+	return http_status_code_Ok;
+}
+
+// weak etag of the client's cached state, the body also carries the current time
+static fio_str_info_s extrato_etag(char etag[CLIENTE_ETAG_LEN], int64_t id, uint64_t versao){
+	int len = snprintf(etag, CLIENTE_ETAG_LEN, "W/\"%lx-%lx-%lx\"", cliente_epoca, id, versao);
+	return (fio_str_info_s){.data = etag, .len = len};
+}
+
+// get extrato
+void get_extrato(http_s *h, int64_t id){
+	int64_t saldo, limite;
+	db_results_t *res;
+	uint32_t col;
+
+	// read before the data, so it never claims more than was served
+	uint64_t versao = clientes_get_cached(&ctx.clientes, id).versao;
+
+	// the etag needs the cache to hold the saldo
+	char buffer[CLIENTE_ETAG_LEN];
+	fio_str_info_s etag = {0};
+	if(ctx.consistencia == consistencia_cache){
+		etag = extrato_etag(buffer, id, versao);
+
+		// unchanged since the poller's copy: no query, no json
+		fio_str_info_s match = http_header_get(h, "if-none-match", 13);
+		if(match.len == etag.len && memcmp(match.data, etag.data, etag.len) == 0){
+			h->status = http_status_code_NotModified;
+			http_set_header2(h, (fio_str_info_s){.data = "etag", .len = 4}, etag);
+			http_finish(h);
+			return;
+		}
+	}
+
+	// a burst for the same client rides on one read, started after its last write
+	voo_t *voo = voo_decolar(h, id, versao);
+	if(voo == NULL)
+		return;
+
+	int status = extrato(id, &saldo, &limite, &res, &col);
+	if(status != http_status_code_Ok){
+		voo_pousar(voo, status, NULL, 0, NULL, etag);
+		http_send_error(h, status);
+		return;
+	}
+
+	uint64_t trace = trace_start();
+	string *json = string_new_sized(1750);
+	extrato_json(json, saldo, limite, res, col);
+	db_results_destroy(ctx.db, res);
+	trace_span("serialize", trace);
+	voo_pousar(voo, http_status_code_Ok, json->raw, json->len, cliente_headers, etag);
+
+	// the body is handed over, not copied
 	h->status = http_status_code_Ok;
-	http_send_body(h, json->raw, len);
-	string_destroy(json);
+	http_set_template(h, cliente_headers);
+	if(etag.len > 0)
+		http_set_header2(h, (fio_str_info_s){.data = "etag", .len = 4}, etag);
+	size_t len = json->len;
+	trace = trace_start();
+	http_send_body2(h, string_unwrap(json), len, free);
+	trace_span("write", trace);
+}
+
+// apply transaction on the cache and record it. returns http status
+static int transar_cache(int64_t id, int64_t valor, char tipo, char *desc, int64_t *saldo, int64_t *limite){
+	// saldo update
+	if(tipo == 'c')
+		*saldo = clientes_creditar(&ctx.clientes, id, valor);
+	else
+		*saldo = clientes_debitar(&ctx.clientes, id, valor);
+
+	// on error
+	if(*saldo == INT64_MIN)
+		return http_status_code_UnprocessableEntity;
+
+	// insert transa
+	db_results_t *res = ctx.coerencia ?
+		transa_insert_publicar(ctx.db, id, tipo == 'c', valor, desc, ctx.origem) :
+		transa_insert(ctx.db, id, tipo == 'c', valor, desc);
+
+	// not recorded, the saldo goes back
+	if(res->code != db_error_ok){
+		printf("%s", res->msg);
+		clientes_creditar(&ctx.clientes, id, tipo == 'c' ? -valor : valor);
+		int status = cliente_db_status(res);
+		db_results_destroy(ctx.db, res);
+		return status;
+	}
+		
 	db_results_destroy(ctx.db, res);
+
+	// an extrato read between the saldo change and the insert got the old transactions under the new version
+	clientes_tocar(&ctx.clientes, id);
+
+	*limite = ctx.clientes.cliente[id].limite;
+	return http_status_code_Ok;
+}
+
+// apply transaction atomically on the db. returns http status
+static int transar_db(int64_t id, int64_t valor, char tipo, char *desc, int64_t *saldo, int64_t *limite){
+	db_results_t *res = clientes_transar(ctx.db, id, valor, tipo == 'c', desc);
+
+	int status = http_status_code_Ok;
+	if(res->code != db_error_ok){
+		printf("%s", res->msg);
+		status = cliente_db_status(res);
+	}
+	else if(res->entries_count == 0){
+		status = http_status_code_UnprocessableEntity;
+	}
+	else{
+		*saldo = db_read_field(res, 0, 0).value.as_int;
+		*limite = db_read_field(res, 0, 1).value.as_int;
+		clientes_tocar(&ctx.clientes, id);
+	}
+
+	db_results_destroy(ctx.db, res);
+	return status;
+}
+
+// apply transaction on the configured source of truth and notify saldo consumers. returns http status
+static int transar(int64_t id, int64_t valor, char tipo, char *desc, int64_t *saldo, int64_t *limite){
+	int status = ctx.consistencia == consistencia_db ?
+		transar_db(id, valor, tipo, desc, saldo, limite) :
+		transar_cache(id, valor, tipo, desc, saldo, limite);
+
+	if(status == http_status_code_Ok)
+		eventos_publicar(id, *saldo, *limite);
+
+	return status;
 }
 
 // saldar cliente
@@ -101,39 +556,238 @@ void post_transa(http_s *h, int64_t id){
 	char tipo;
 
 	// parse json
+	uint64_t trace = trace_start();
 	if(!parseTransa(fiobj_obj2cstr(h->body).data, &valor, &tipo, &desc)){
 		http_send_error(h, http_status_code_BadRequest);
 		free(desc);
 		return;
 	}
+	trace_span("parse", trace);
 
-	// saldo update
-	int64_t saldo;
-	if(tipo == 'c')
-		saldo = clientes_creditar(&ctx.clientes, id, valor);
-	else
-		saldo = clientes_debitar(&ctx.clientes, id, valor);
+	int64_t saldo, limite;
+	int status = transar(id, valor, tipo, desc, &saldo, &limite);
+	free(desc);
 
 	// on error
-	if(saldo == INT64_MIN){
-		http_send_error(h, http_status_code_UnprocessableEntity);
-		free(desc);
+	if(status != http_status_code_Ok){
+		http_send_error(h, status);
 		return;
 	}
 
-	// insert transa
-	db_results_t *res = transa_insert(ctx.db, id, tipo == 'c', valor, desc);
+	// response
+	trace = trace_start();
+	char *json = malloc(150);
+	int len = snprintf(json, 149, "{\"limite\":%ld,\"saldo\":%ld}", limite, saldo);
+	trace_span("serialize", trace);
+
+	trace = trace_start();
+	h->status = http_status_code_Ok;
+	http_set_template(h, cliente_headers);
+	http_send_body2(h, json, len, free);
+	trace_span("write", trace);
+}
 
-	if(res->code != db_error_ok)
+#define TRANSA_LOTE_MAX 1000
+
+// transactions of a batch request, in order
+typedef struct{
+	size_t count;
+	int64_t *valores;						// signed, credits are positive
+	char **descricoes;
+	char *descricoes_buffer;
+}transa_lote_t;
+
+static void transa_lote_free(transa_lote_t *lote){
+	free(lote->valores);
+	free(lote->descricoes);
+	free(lote->descricoes_buffer);
+}
+
+// parse a json array of transactions, each validated as in post_transa
+static bool transa_lote_parse(fio_str_info_s body, transa_lote_t *lote){
+	FIOBJ json = FIOBJ_INVALID;
+	if(body.len == 0 || fiobj_json2obj(&json, body.data, body.len) == 0)
+		return false;
+
+	size_t count = FIOBJ_TYPE_IS(json, FIOBJ_T_ARRAY) ? fiobj_ary_count(json) : 0;
+	if(count < 1 || count > TRANSA_LOTE_MAX){
+		fiobj_free(json);
+		return false;
+	}
+
+	lote->count = count;
+	lote->valores = malloc(sizeof(int64_t) * count);
+	lote->descricoes = malloc(sizeof(char*) * count);
+	lote->descricoes_buffer = malloc(11 * count);
+
+	bool ok = true;
+	for(size_t i = 0; i < count; i++){
+		FIOBJ item = fiobj_ary_index(json, i);
+		if(!FIOBJ_TYPE_IS(item, FIOBJ_T_HASH)){
+			ok = false;
+			break;
+		}
+
+		FIOBJ valor = fiobj_hash_get2(item, fiobj_hash_string("valor", 5));
+		FIOBJ tipo  = fiobj_hash_get2(item, fiobj_hash_string("tipo", 4));
+		FIOBJ desc  = fiobj_hash_get2(item, fiobj_hash_string("descricao", 9));
+		if(!FIOBJ_TYPE_IS(valor, FIOBJ_T_NUMBER) || !FIOBJ_TYPE_IS(tipo, FIOBJ_T_STRING) || !FIOBJ_TYPE_IS(desc, FIOBJ_T_STRING)){
+			ok = false;
+			break;
+		}
+
+		int64_t v = fiobj_obj2num(valor);
+		fio_str_info_s t = fiobj_obj2cstr(tipo);
+		fio_str_info_s d = fiobj_obj2cstr(desc);
+		// the same descricao rule as every other way in, it goes into the extrato json as is
+		ok = v > 0 && v <= INT32_MAX && t.len == 1 && (*t.data == 'c' || *t.data == 'd') && validDescricao(d.data, d.len);
+		if(!ok)
+			break;
+
+		lote->valores[i] = *t.data == 'c' ? v : -v;
+		lote->descricoes[i] = lote->descricoes_buffer + 11 * i;
+		memcpy(lote->descricoes[i], d.data, d.len);
+		lote->descricoes[i][d.len] = '\0';
+	}
+
+	fiobj_free(json);
+	if(!ok)
+		transa_lote_free(lote);
+
+	return ok;
+}
+
+// apply the batch on the cache, then record the accepted ones with one insert. returns http status
+static int transar_lote_cache(int64_t id, transa_lote_t *lote, int64_t *saldos, int64_t *limite){
+	clientes_lote(&ctx.clientes, id, lote->count, lote->valores, saldos);
+
+	// accepted transactions, unsigned as in transa_insert
+	size_t count = 0;
+	int64_t delta = 0;
+	bool *tipos = malloc(sizeof(bool) * lote->count);
+	int64_t *valores = malloc(sizeof(int64_t) * lote->count);
+	char **descricoes = malloc(sizeof(char*) * lote->count);
+	for(size_t i = 0; i < lote->count; i++){
+		if(saldos[i] == INT64_MIN)
+			continue;
+
+		tipos[count] = lote->valores[i] > 0;
+		valores[count] = lote->valores[i] > 0 ? lote->valores[i] : -lote->valores[i];
+		descricoes[count] = lote->descricoes[i];
+		delta += lote->valores[i];
+		count++;
+	}
+
+	int status = http_status_code_Ok;
+	if(count > 0){
+		db_results_t *res = ctx.coerencia ?
+			transa_insert_lote_publicar(ctx.db, id, count, tipos, valores, descricoes, ctx.origem) :
+			transa_insert_lote(ctx.db, id, count, tipos, valores, descricoes);
+
+		// not recorded, the whole batch goes back
+		if(res->code != db_error_ok){
+			printf("%s", res->msg);
+			clientes_creditar(&ctx.clientes, id, -delta);
+			status = cliente_db_status(res);
+		}
+
+		db_results_destroy(ctx.db, res);
+		clientes_tocar(&ctx.clientes, id);
+	}
+
+	free(tipos);
+	free(valores);
+	free(descricoes);
+
+	*limite = ctx.clientes.cliente[id].limite;
+	return status;
+}
+
+// apply the batch atomically on the db, one row back per transaction. returns http status
+static int transar_lote_db(int64_t id, transa_lote_t *lote, int64_t *saldos, int64_t *limite){
+	db_results_t *res = clientes_transar_lote(ctx.db, id, lote->count, lote->valores, lote->descricoes);
+
+	int status = http_status_code_Ok;
+	if(res->code != db_error_ok){
 		printf("%s", res->msg);
-		
+		status = cliente_db_status(res);
+	}
+	else if(res->entries_count != (int64_t)lote->count){
+		status = http_status_code_InternalServerError;
+	}
+	else{
+		for(size_t i = 0; i < lote->count; i++){
+			db_field_t saldo = db_read_field(res, i, 0);
+			saldos[i] = saldo.type == db_type_int ? saldo.value.as_int : INT64_MIN;
+		}
+		*limite = db_read_field(res, 0, 1).value.as_int;
+		clientes_tocar(&ctx.clientes, id);
+	}
+
 	db_results_destroy(ctx.db, res);
+	return status;
+}
+
+// apply a batch in order on the configured source of truth. saldos gets the saldo after each transaction, INT64_MIN when refused. returns http status
+static int transar_lote(int64_t id, transa_lote_t *lote, int64_t *saldos, int64_t *limite){
+	int status = ctx.consistencia == consistencia_db ?
+		transar_lote_db(id, lote, saldos, limite) :
+		transar_lote_cache(id, lote, saldos, limite);
+
+	if(status != http_status_code_Ok)
+		return status;
+
+	// saldo consumers only need the last one
+	for(size_t i = lote->count; i > 0; i--){
+		if(saldos[i - 1] != INT64_MIN){
+			eventos_publicar(id, saldos[i - 1], *limite);
+			break;
+		}
+	}
+
+	return status;
+}
+
+// saldar cliente with a batch of transactions, applied in order. Each one gets its own result
+void post_transa_lote(http_s *h, int64_t id){
+	transa_lote_t lote;
+	if(!transa_lote_parse(fiobj_obj2cstr(h->body), &lote)){
+		http_send_error(h, http_status_code_BadRequest);
+		return;
+	}
+
+	int64_t *saldos = malloc(sizeof(int64_t) * lote.count);
+	int64_t limite;
+	int status = transar_lote(id, &lote, saldos, &limite);
+
+	if(status != http_status_code_Ok){
+		http_send_error(h, status);
+		free(saldos);
+		transa_lote_free(&lote);
+		return;
+	}
 
 	// response
-	char *json = malloc(150);
-	int len = snprintf(json, 149, "{\"limite\":%ld,\"saldo\":%ld}", ctx.clientes.cliente[id].limite, saldo);
+	string *json = string_new_sized(40 + 50 * lote.count);
+	string_write(json, "{\"limite\":%ld,\"transacoes\":[", 50, limite);
+	for(size_t i = 0; i < lote.count; i++){
+		if(i > 0)
+			string_cat_raw(json, ",", 1);
+
+		if(saldos[i] != INT64_MIN)
+			string_write(json, "{\"status\":200,\"saldo\":%ld}", 50, saldos[i]);
+		else
+			string_cat_raw(json, "{\"status\":422,\"erro\":\"limite insuficiente\"}", 0);
+	}
+	string_cat_raw(json, "]}", 0);
+
+	free(saldos);
+	transa_lote_free(&lote);
+
 	h->status = http_status_code_Ok;
-	http_send_body(h, json, len);
-	free(json);
-	free(desc);
+	http_set_template(h, cliente_headers);
+	size_t len = json->len;
+	http_send_body2(h, string_unwrap(json), len, free);
 }
+
+#endif
\ No newline at end of file
@@ -0,0 +1,150 @@
+#ifndef _CLUSTER_HEADER_
+#define _CLUSTER_HEADER_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "../facil.io/http.h"
+#include "../src/httpStatusCodes.h"
+#include "../src/proxy.h"
+#include "../models/context.h"
+
+// marks a request already forwarded by a peer
+#define CLUSTER_HOP_HEADER "x-cluster-hop"
+
+// request relayed to the instance that owns its client
+typedef struct{
+	int owner;
+	void *udata;							// h->udata while paused
+	char *response;							// raw response, NULL when the owner didn't answer
+	size_t response_len;
+	size_t len;
+	char request[];
+}cluster_forward_t;
+
+// join the cluster: members as in PROXY_BACKENDS, self is this instance's entry. Call before fio_start
+bool cluster_init(const char *members, const char *self, size_t conns){
+	ctx.cluster = proxy_new(members, conns);
+	if(ctx.cluster == NULL)
+		return false;
+
+	ctx.cluster_self = proxy_find(ctx.cluster, self);
+	if(ctx.cluster_self < 0){
+		proxy_destroy(ctx.cluster);
+		ctx.cluster = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+// instance that owns the client, -1 when it is this one. The fixed ring point, whatever the health views say
+static int cluster_owner(http_s *h, int64_t id){
+	if(ctx.cluster == NULL)
+		return -1;
+
+	int owner = proxy_route(ctx.cluster, id);
+	return owner == ctx.cluster_self ? -1 : owner;
+}
+
+// write the owner's answer on the paused request
+static void cluster_relay(http_s *h){
+	cluster_forward_t *forward = h->udata;
+	h->udata = forward->udata;
+
+	char *response = forward->response;
+	size_t len = forward->response_len;
+	free(forward);
+
+	const char *body = response != NULL ? strstr(response, "\r\n\r\n") : NULL;
+	if(body == NULL || len < 12){
+		free(response);
+		http_send_error(h, http_status_code_BadGateway);
+		return;
+	}
+
+	body += 4;
+	h->status = atoi(response + 9);
+
+	// content-type and etag are the only headers the api sets
+	for(const char *line = strchr(response, '\n') + 1; line < body - 2; line = strchr(line, '\n') + 1){
+		size_t name;
+		if(strncasecmp(line, "content-type:", 13) == 0)
+			name = 12;
+		else if(strncasecmp(line, "etag:", 5) == 0)
+			name = 4;
+		else
+			continue;
+
+		const char *value = line + name + 1;
+		while(*value == ' ')
+			value++;
+		http_set_header2(h, (fio_str_info_s){.data = (char*)line, .len = name}, (fio_str_info_s){.data = (char*)value, .len = strcspn(value, "\r")});
+	}
+
+	// the body moves to the start of the buffer, which is handed over
+	size_t body_len = len - (body - response);
+	memmove(response, body, body_len);
+	http_send_body2(h, response, body_len, free);
+}
+
+// connection closed while waiting for the owner
+static void cluster_drop(void *udata){
+	cluster_forward_t *forward = udata;
+	free(forward->response);
+	free(forward);
+}
+
+static void cluster_on_response(char *response, size_t len, void *udata){
+	http_pause_handle_s *paused = udata;
+	cluster_forward_t *forward = http_paused_udata_get(paused);
+	forward->response = response;
+	forward->response_len = len;
+	http_resume(paused, cluster_relay, cluster_drop);
+}
+
+static void cluster_send(http_pause_handle_s *paused){
+	cluster_forward_t *forward = http_paused_udata_get(paused);
+	proxy_forward(ctx.cluster, forward->owner, forward->request, forward->len, cluster_on_response, paused);
+}
+
+// relay the request to its owner over the pooled internal connections
+void cluster_forward(http_s *h, int owner){
+	// only the owner's cache is current: no other instance serves the client while it is down
+	if(!proxy_healthy(ctx.cluster, owner)){
+		http_send_error(h, http_status_code_ServiceUnavailable);
+		return;
+	}
+
+	// a peer thinks we own it, so the member lists differ. Relaying again could loop
+	if(http_header_get(h, CLUSTER_HOP_HEADER, sizeof(CLUSTER_HOP_HEADER) - 1).len > 0){
+		http_send_error(h, http_status_code_ServiceUnavailable);
+		return;
+	}
+
+	fio_str_info_s method = fiobj_obj2cstr(h->method);
+	fio_str_info_s path = fiobj_obj2cstr(h->path);
+	fio_str_info_s query = h->query ? fiobj_obj2cstr(h->query) : (fio_str_info_s){0};
+	fio_str_info_s body = h->body ? fiobj_obj2cstr(h->body) : (fio_str_info_s){0};
+	fio_str_info_s match = http_header_get(h, "if-none-match", 13);
+
+	size_t capa = method.len + path.len + query.len + body.len + match.len + 190;
+	cluster_forward_t *forward = malloc(sizeof(cluster_forward_t) + capa);
+	forward->owner = owner;
+	forward->udata = h->udata;
+	forward->response = NULL;
+	forward->len = snprintf(forward->request, capa,
+		"%s %s%s%s HTTP/1.1\r\nhost:cluster\r\n" CLUSTER_HOP_HEADER ":1\r\ncontent-type:application/json\r\n%s%.*s%scontent-length:%zu\r\n\r\n",
+		method.data, path.data, query.len ? "?" : "", query.len ? query.data : "",
+		match.len ? "if-none-match:" : "", (int)match.len, match.len ? match.data : "", match.len ? "\r\n" : "",
+		body.len
+	);
+	memcpy(forward->request + forward->len, body.data, body.len);
+	forward->len += body.len;
+
+	h->udata = forward;
+	http_pause(h, cluster_send);
+}
+
+#endif
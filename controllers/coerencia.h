@@ -0,0 +1,89 @@
+#ifndef _COERENCIA_HEADER_
+#define _COERENCIA_HEADER_
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../facil.io/fio.h"
+#include "../src/db.h"
+#include "../models/context.h"
+#include "../models/cliente.h"
+#include "eventos.h"
+
+// channel used by transar_publicar in init.sql
+#define COERENCIA_CANAL "saldos"
+
+// apply deltas published by other instances. payload: "origem:cliente:delta"
+static void coerencia_on_notify(const char *channel, const char *payload, void *udata){
+	char origem[32];
+	int id;
+	int64_t delta;
+
+	if(sscanf(payload, "%31[^:]:%d:%ld", origem, &id, &delta) != 3)
+		return;
+
+	// our own transactions are already in the cache
+	if(strcmp(origem, ctx.origem) == 0)
+		return;
+
+	if(id < 1 || id > 5)
+		return;
+
+	clientes_aplicar(&ctx.clientes, id, delta);
+
+	cliente_t c = clientes_get_cached(&ctx.clientes, id);
+	eventos_publicar(id, c.saldo, c.limite);
+
+	// and a new transaction in its extrato
+	char tag[CLIENTES_TAG_LEN];
+	clientes_tag(tag, id);
+	db_cache_invalidate(ctx.db, tag);
+}
+
+// listener socket is readable
+static void coerencia_on_data(intptr_t uuid, fio_protocol_s *protocol){
+	db_notifications(ctx.db, coerencia_on_notify, NULL);
+}
+
+static fio_protocol_s coerencia_protocol = {
+	.on_data = coerencia_on_data,
+};
+
+// per worker, after the fork: its own listener connection and origin, or siblings would share one socket and skip each other's deltas
+static void coerencia_start(void *db){
+	int fd = db_listen(db, COERENCIA_CANAL);
+	if(fd < 0){
+		printf("Could not listen for saldo changes on postgres\n");
+		fio_stop();
+		return;
+	}
+
+	snprintf(ctx.origem, sizeof(ctx.origem), "%d-%ld", getpid(), (long)time(NULL));
+
+	// the reactor closes the fds it watches, so give it a copy and keep libpq's socket
+	fd = dup(fd);
+	if(fd < 0){
+		printf("Could not listen for saldo changes on postgres\n");
+		fio_stop();
+		return;
+	}
+
+	fio_set_non_block(fd);
+	fio_attach_fd(fd, &coerencia_protocol);
+	printf("Saldo coherence origin: [%s]\n", ctx.origem);
+
+	// catch anything that arrived while connecting
+	db_notifications(db, coerencia_on_notify, NULL);
+}
+
+// listen for peer saldo changes once each worker is up. Call before fio_start
+bool coerencia_init(db_t *db){
+	if(db == NULL || (db->vendor != db_vendor_postgres && db->vendor != db_vendor_postgres15))
+		return false;
+
+	fio_state_callback_add(FIO_CALL_ON_START, coerencia_start, db);
+	return true;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef _EVENTOS_HEADER_
+#define _EVENTOS_HEADER_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../facil.io/http.h"
+#include "../models/context.h"
+#include "../models/cliente.h"
+#include "../models/transa.h"
+#include "cluster.h"
+
+#define EVENTOS_CANAL_LEN 24
+#define EVENTOS_MSG_LEN 64
+
+// saldo stream of one consumer
+typedef struct{
+	pthread_mutex_t lock;
+	int64_t id;
+	char latest[EVENTOS_MSG_LEN];			// newest saldo not written yet
+	size_t len;
+	bool dirty;
+}eventos_t;
+
+// pub/sub channel of a client
+static fio_str_info_s eventos_canal(char canal[EVENTOS_CANAL_LEN], int64_t id){
+	int len = snprintf(canal, EVENTOS_CANAL_LEN, "saldo:%ld", id);
+	return (fio_str_info_s){.data = canal, .len = len};
+}
+
+// notify the client's consumers, in every worker
+void eventos_publicar(int64_t id, int64_t saldo, int64_t limite){
+	char canal[EVENTOS_CANAL_LEN];
+	char msg[EVENTOS_MSG_LEN];
+	int len = snprintf(msg, sizeof(msg), "{\"saldo\":%ld,\"limite\":%ld}", saldo, limite);
+	fio_publish(.channel = eventos_canal(canal, id), .message = {.data = msg, .len = len}, .is_json = 1);
+}
+
+static void eventos_write(http_sse_s *sse, const char *msg, size_t len){
+	http_sse_write(sse, .event = {.data = "saldo", .len = 5}, .data = {.data = (char*)msg, .len = len});
+}
+
+// a consumer that still has events queued only gets the newest saldo once it catches up
+static void eventos_on_message(http_sse_s *sse, fio_str_info_s channel, fio_str_info_s msg, void *udata){
+	eventos_t *eventos = udata;
+	if(msg.len >= EVENTOS_MSG_LEN)
+		return;
+
+	pthread_mutex_lock(&(eventos->lock));
+	bool slow = eventos->dirty || fio_pending(http_sse2uuid(sse)) > 0;
+	if(slow){
+		memcpy(eventos->latest, msg.data, msg.len);
+		eventos->len = msg.len;
+		eventos->dirty = true;
+	}
+	pthread_mutex_unlock(&(eventos->lock));
+
+	if(!slow)
+		eventos_write(sse, msg.data, msg.len);
+}
+
+// socket buffer drained, send what was coalesced
+static void eventos_on_ready(http_sse_s *sse){
+	eventos_t *eventos = sse->udata;
+	char msg[EVENTOS_MSG_LEN];
+
+	pthread_mutex_lock(&(eventos->lock));
+	size_t len = eventos->dirty ? eventos->len : 0;
+	memcpy(msg, eventos->latest, len);
+	eventos->dirty = false;
+	pthread_mutex_unlock(&(eventos->lock));
+
+	if(len > 0)
+		eventos_write(sse, msg, len);
+}
+
+// subscriptions are gone by now, and messages for a closed stream are dropped
+static void eventos_on_close(http_sse_s *sse){
+	eventos_t *eventos = sse->udata;
+	pthread_mutex_destroy(&(eventos->lock));
+	free(eventos);
+}
+
+static void eventos_on_open(http_sse_s *sse){
+	eventos_t *eventos = sse->udata;
+	int64_t id = eventos->id;
+
+	char canal[EVENTOS_CANAL_LEN];
+	if(!http_sse_subscribe(sse, .channel = eventos_canal(canal, id), .on_message = eventos_on_message, .udata = eventos)){
+		http_sse_close(sse);
+		return;
+	}
+
+	// current saldo first, from where it is kept: the cache, or the db (through its result cache)
+	int64_t saldo, limite;
+	if(ctx.consistencia == consistencia_cache){
+		cliente_t c = clientes_get_cached(&ctx.clientes, id);
+		saldo = c.saldo;
+		limite = c.limite;
+	}
+	else{
+		db_results_t *res = transa_extrato_saldo(ctx.db, id);
+		bool ok = res->code == db_error_ok && res->entries_count > 0;
+		if(ok){
+			saldo = db_read_field(res, 0, 0).value.as_int;
+			limite = db_read_field(res, 0, 1).value.as_int;
+		}
+		else
+			printf("%s", res->msg);
+		db_results_destroy(ctx.db, res);
+
+		// the next write still reaches it
+		if(!ok)
+			return;
+	}
+
+	char msg[EVENTOS_MSG_LEN];
+	int len = snprintf(msg, sizeof(msg), "{\"saldo\":%ld,\"limite\":%ld}", saldo, limite);
+	eventos_write(sse, msg, len);
+}
+
+// upgrade to a saldo event stream of the client
+void eventos_stream(http_s *h, int64_t id){
+	// saldo changes are only published where the client lives
+	if(cluster_owner(h, id) >= 0){
+		http_send_error(h, http_status_code_MisdirectedRequest);
+		return;
+	}
+
+	eventos_t *eventos = calloc(1, sizeof(eventos_t));
+	pthread_mutex_init(&(eventos->lock), NULL);
+	eventos->id = id;
+	http_upgrade2sse(h, .on_open = eventos_on_open, .on_ready = eventos_on_ready, .on_close = eventos_on_close, .udata = eventos);
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef _EXPORTAR_HEADER_
+#define _EXPORTAR_HEADER_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../facil.io/http.h"
+#include "../src/httpStatusCodes.h"
+#include "../src/db.h"
+#include "../models/context.h"
+#include "../models/transa.h"
+
+#define EXPORTAR_CHUNK 65536					// copy rows are gathered up to this size before each chunk
+
+// state of an export while the copy runs
+typedef struct{
+	http_s *h;
+	transa_formato_t formato;
+	char chunk[EXPORTAR_CHUNK];
+	size_t len;
+	bool started;								// headers already sent
+	bool failed;								// client gone
+}exportar_t;
+
+static void exportar_flush(exportar_t *exp, const char *data, size_t len){
+	if(!exp->started){
+		fio_str_info_s type = exp->formato == transa_formato_ndjson ?
+			(fio_str_info_s){.data = "application/x-ndjson", .len = 20} :
+			(fio_str_info_s){.data = "text/csv", .len = 8};
+
+		exp->h->status = http_status_code_Ok;
+		http_set_header2(exp->h, (fio_str_info_s){.data = "content-type", .len = 12}, type);
+		exp->started = true;
+	}
+
+	// http_stream waits here while the client lags behind
+	if(http_stream(exp->h, (void*)data, len) != 0)
+		exp->failed = true;
+}
+
+// copy data callback, rows are only concatenated, never parsed
+static bool exportar_data(const char *data, size_t len, void *udata){
+	exportar_t *exp = udata;
+
+	if(exp->len + len > EXPORTAR_CHUNK){
+		exportar_flush(exp, exp->chunk, exp->len);
+		exp->len = 0;
+	}
+
+	// a row bigger than the chunk goes on its own
+	if(len > EXPORTAR_CHUNK)
+		exportar_flush(exp, data, len);
+	else{
+		memcpy(exp->chunk + exp->len, data, len);
+		exp->len += len;
+	}
+
+	return !exp->failed;
+}
+
+// ledger of a client, oldest first, relayed from a postgres copy with chunked encoding.
+// GET /clientes/{id}/exportar?formato=csv|ndjson
+void exportar_stream(http_s *h, int64_t id){
+	transa_formato_t formato = transa_formato_csv;
+
+	http_parse_query(h);
+	FIOBJ param = FIOBJ_TYPE_IS(h->params, FIOBJ_T_HASH) ? fiobj_hash_get2(h->params, fiobj_hash_string("formato", 7)) : FIOBJ_INVALID;
+	if(param != FIOBJ_INVALID){
+		fio_str_info_s str = fiobj_obj2cstr(param);
+		if(str.len == 6 && memcmp(str.data, "ndjson", 6) == 0)
+			formato = transa_formato_ndjson;
+		else if(str.len != 3 || memcmp(str.data, "csv", 3) != 0){
+			http_send_error(h, http_status_code_BadRequest);
+			return;
+		}
+	}
+
+	exportar_t *exp = calloc(1, sizeof(exportar_t));
+	exp->h = h;
+	exp->formato = formato;
+
+	db_results_t *res = transa_exportar(ctx.db, id, formato, exportar_data, exp);
+	if(res->code != db_error_ok)
+		printf("%s", res->msg);
+
+	// nothing was sent yet, the status can still tell. Otherwise the body is cut short without the last chunk
+	if(res->code != db_error_ok && !exp->started)
+		http_send_error(h, res->code == db_error_unsupported ? http_status_code_NotImplemented : http_status_code_InternalServerError);
+	else if(res->code != db_error_ok){
+		h->status = http_status_code_InternalServerError;
+		http_finish(h);
+	}
+	else{
+		exportar_flush(exp, exp->chunk, exp->len);
+		http_finish(h);
+	}
+
+	db_results_destroy(ctx.db, res);
+	free(exp);
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef _HISTORICO_HEADER_
+#define _HISTORICO_HEADER_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../facil.io/http.h"
+#include "../src/httpStatusCodes.h"
+#include "../src/db.h"
+#include "../models/context.h"
+#include "../models/transa.h"
+
+#define HISTORICO_CHUNK 16384					// rows are written to the socket in chunks of about this size
+#define HISTORICO_ROW 200						// max json length of a row
+
+// state of a history response while rows arrive
+typedef struct{
+	http_s *h;
+	char chunk[HISTORICO_CHUNK];
+	size_t len;
+	size_t rows;
+	int64_t last;								// id of the last row, the next page cursor
+	bool started;								// headers already sent
+	bool failed;								// client gone
+}historico_t;
+
+static void historico_flush(historico_t *hist){
+	if(!hist->started){
+		hist->h->status = http_status_code_Ok;
+		http_set_header2(hist->h, (fio_str_info_s){.data = "content-type", .len = 12}, (fio_str_info_s){.data = "application/json", .len = 16});
+		hist->started = true;
+	}
+
+	if(http_stream(hist->h, hist->chunk, hist->len) != 0)
+		hist->failed = true;
+
+	hist->len = 0;
+}
+
+static void historico_write(historico_t *hist, const char *data, size_t len){
+	if(hist->len + len > HISTORICO_CHUNK)
+		historico_flush(hist);
+
+	memcpy(hist->chunk + hist->len, data, len);
+	hist->len += len;
+}
+
+// row callback, stops the query when the client went away
+static bool historico_row(db_results_t *row, void *udata){
+	historico_t *hist = udata;
+
+	char json[HISTORICO_ROW];
+	int len = snprintf(json, sizeof(json), "%s{\"id\":%ld,\"valor\":%ld,\"tipo\":\"%c\",\"descricao\":\"%s\",\"realizada_em\":\"%s\"}",
+		hist->rows > 0 ? "," : "",
+		db_read_field(row, 0, 0).value.as_int,
+		db_read_field(row, 0, 1).value.as_int,
+		db_read_field(row, 0, 2).value.as_bool ? 'c' : 'd',
+		db_read_field(row, 0, 3).value.as_string,
+		db_read_field(row, 0, 4).value.as_string
+	);
+
+	hist->last = db_read_field(row, 0, 0).value.as_int;
+	hist->rows++;
+	historico_write(hist, json, len < (int)sizeof(json) ? len : (int)sizeof(json) - 1);
+	return !hist->failed;
+}
+
+// positive integer query param, def when absent. false when invalid
+static bool historico_param(http_s *h, const char *name, int64_t def, int64_t *out){
+	// no params hash without a query string
+	FIOBJ value = FIOBJ_TYPE_IS(h->params, FIOBJ_T_HASH) ? fiobj_hash_get2(h->params, fiobj_hash_string(name, strlen(name))) : FIOBJ_INVALID;
+	if(value == FIOBJ_INVALID){
+		*out = def;
+		return true;
+	}
+
+	char *end;
+	fio_str_info_s str = fiobj_obj2cstr(value);
+	errno = 0;
+	*out = strtoll(str.data, &end, 10);
+	return str.len > 0 && *end == '\0' && errno == 0 && *out > 0;
+}
+
+// full transaction history, newest first, streamed with chunked encoding while the rows come from the db.
+// GET /clientes/{id}/transacoes?antes_de=<id>&limite=N, keyset pagination: the next page starts before "proximo"
+void historico_stream(http_s *h, int64_t id){
+	int64_t antes_de, limite;
+	http_parse_query(h);
+	if(!historico_param(h, "antes_de", INT64_MAX, &antes_de) || !historico_param(h, "limite", INT64_MAX, &limite)){
+		http_send_error(h, http_status_code_BadRequest);
+		return;
+	}
+
+	historico_t *hist = calloc(1, sizeof(historico_t));
+	hist->h = h;
+	historico_write(hist, "{\"transacoes\":[", 15);
+
+	db_results_t *res = transa_historico(ctx.db, id, antes_de, limite, historico_row, hist);
+
+	// nothing was sent yet, the status can still tell
+	if(res->code != db_error_ok && !hist->started){
+		printf("%s", res->msg);
+		http_send_error(h, res->code == db_error_unsupported ? http_status_code_NotImplemented : http_status_code_InternalServerError);
+	}
+	else{
+		char tail[64];
+		int len;
+		if(res->code != db_error_ok){
+			printf("%s", res->msg);
+			len = snprintf(tail, sizeof(tail), "],\"erro\":\"falha no db\"}");
+		}
+		else if(hist->rows > 0 && (int64_t)hist->rows == limite)
+			len = snprintf(tail, sizeof(tail), "],\"proximo\":%ld}", hist->last);
+		else
+			len = snprintf(tail, sizeof(tail), "],\"proximo\":null}");
+
+		historico_write(hist, tail, len);
+		historico_flush(hist);
+		http_finish(h);
+	}
+
+	db_results_destroy(ctx.db, res);
+	free(hist);
+}
+
+#endif
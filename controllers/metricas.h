@@ -0,0 +1,232 @@
+#ifndef _METRICAS_HEADER_
+#define _METRICAS_HEADER_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "../facil.io/http.h"
+#include "../src/httpStatusCodes.h"
+#include "../src/utils.h"
+#include "../src/db.h"
+#include "../src/metrics.h"
+#include "../src/string+.h"
+#include "../models/context.h"
+#include "voo.h"
+
+#define METRICAS_STATEMENTS 32					// distinct statements with their own histogram, the rest share one
+#define METRICAS_LABEL 64
+
+// routes of the request histograms
+typedef enum{
+	metricas_rota_extrato,
+	metricas_rota_transacao,
+	metricas_rota_lote,
+	metricas_rota_historico,
+	metricas_rota_exportar,
+	metricas_rota_eventos,
+	metricas_rota_metrics,
+	metricas_rota_outra,
+	metricas_rotas
+}metricas_rota_t;
+
+static const char *metricas_rota_nomes[metricas_rotas] = {"extrato", "transacao", "lote", "historico", "exportar", "eventos", "metrics", "outra"};
+
+// statuses with their own histogram, the last one takes the rest
+static const int metricas_status[] = {200, 304, 400, 404, 405, 422, 429, 500, 503, 504, 0};
+#define METRICAS_STATUS (sizeof(metricas_status) / sizeof(metricas_status[0]))
+
+// histogram indexes: requests per route and status, then the pool wait, then a query histogram per statement
+#define METRICAS_ACQUIRE (metricas_rotas * METRICAS_STATUS)
+#define METRICAS_QUERY (METRICAS_ACQUIRE + 1)
+#define METRICAS_HISTOGRAMS (METRICAS_QUERY + METRICAS_STATEMENTS + 1)
+
+// statements seen by the db observer, keyed by the query pointer: the models pass string literals
+static struct{
+	const char *query;
+	char label[METRICAS_LABEL];
+}metricas_statements[METRICAS_STATEMENTS];
+static size_t metricas_statements_count = 0;
+static pthread_mutex_t metricas_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static metricas_rota_t metricas_rota(http_s *h){
+	fio_str_info_s method = fiobj_obj2cstr(h->method);
+	char *path = fiobj_obj2cstr(h->path).data;
+	if(method.len == 0 || path == NULL)
+		return metricas_rota_outra;
+
+	if(strcmp(path, "/metrics") == 0)
+		return metricas_rota_metrics;
+
+	int64_t id = 0;
+	char *action = parseIdAction(path, &id);
+	if(id < 1 || id > 5 || action == NULL)
+		return metricas_rota_outra;
+
+	if(*method.data == 'P')
+		return strcmp(action, "transacoes/lote") == 0 ? metricas_rota_lote : metricas_rota_transacao;
+	if(strcmp(action, "extrato") == 0)
+		return metricas_rota_extrato;
+	if(strcmp(action, "transacoes") == 0)
+		return metricas_rota_historico;
+	if(strcmp(action, "exportar") == 0)
+		return metricas_rota_exportar;
+	if(strcmp(action, "eventos") == 0)
+		return metricas_rota_eventos;
+	return metricas_rota_outra;
+}
+
+static size_t metricas_status_index(int status){
+	size_t i = 0;
+	while(metricas_status[i] != 0 && metricas_status[i] != status)
+		i++;
+	return i;
+}
+
+// prometheus label value: a prepared name as is, query text squeezed into one line
+static void metricas_label(char label[METRICAS_LABEL], const char *query){
+	size_t len = 0;
+	bool space = false;
+	for(const char *c = query; *c != '\0' && len < METRICAS_LABEL - 2; c++){
+		if(*c == ' ' || *c == '\n' || *c == '\t' || *c == '\r'){
+			space = len > 0;
+			continue;
+		}
+
+		if(space)
+			label[len++] = ' ';
+		space = false;
+		label[len++] = *c == '"' || *c == '\\' ? '\'' : *c;
+	}
+	label[len] = '\0';
+}
+
+// histogram of a statement, registered on its first run
+static size_t metricas_statement(const char *query){
+	size_t count = __atomic_load_n(&metricas_statements_count, __ATOMIC_ACQUIRE);
+	for(size_t i = 0; i < count; i++){
+		if(metricas_statements[i].query == query)
+			return METRICAS_QUERY + i;
+	}
+
+	pthread_mutex_lock(&metricas_lock);
+	size_t i = 0;
+	count = metricas_statements_count;
+	while(i < count && metricas_statements[i].query != query)
+		i++;
+
+	if(i == count && count < METRICAS_STATEMENTS){
+		metricas_statements[i].query = query;
+		metricas_label(metricas_statements[i].label, query);
+		__atomic_store_n(&metricas_statements_count, count + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&metricas_lock);
+
+	return METRICAS_QUERY + i;
+}
+
+// db observer: pool waits and query times on the calling thread's histograms
+static void metricas_db(db_event_t event, const char *statement, uint64_t usec, void *udata){
+	if(event == db_event_acquire)
+		metrics_observe(METRICAS_ACQUIRE, usec);
+	else
+		metrics_observe(metricas_statement(statement), usec);
+}
+
+/**
+ * @brief http on_sent callback: request latency by route and status, from the reactor tick that read it
+*/
+void metricas_request(http_s *h){
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t usec = (now.tv_sec - h->received_at.tv_sec) * 1000000 + (now.tv_nsec - h->received_at.tv_nsec) / 1000;
+
+	metrics_observe(metricas_rota(h) * METRICAS_STATUS + metricas_status_index(h->status), usec > 0 ? usec : 0);
+}
+
+/**
+ * @brief size the registry and observe the db. Call before fio_start
+*/
+void metricas_init(db_t *db){
+	metrics_init(METRICAS_HISTOGRAMS);
+	db_observe(db, metricas_db, NULL);
+}
+
+static void metricas_counter(string *out, const char *name, const char *help, uint64_t value){
+	string_write(out, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", 512, name, help, name, name, value);
+}
+
+/**
+ * @brief GET /metrics, prometheus text format. Every thread's histograms are summed on each scrape, counters come from their owners
+*/
+void metricas_get(http_s *h){
+	string *out = string_new_sized(65536);
+	metrics_histogram_t *histogram = malloc(sizeof(metrics_histogram_t));
+	char labels[128];
+
+	string_write(out, "# HELP api_request_duration_seconds Request latency by route and status.\n# TYPE api_request_duration_seconds histogram\n", 256);
+	for(size_t rota = 0; rota < metricas_rotas; rota++){
+		for(size_t status = 0; status < METRICAS_STATUS; status++){
+			metrics_histogram_read(rota * METRICAS_STATUS + status, histogram);
+			if(histogram->count == 0)
+				continue;
+
+			if(metricas_status[status] != 0)
+				snprintf(labels, sizeof(labels), "route=\"%s\",status=\"%d\"", metricas_rota_nomes[rota], metricas_status[status]);
+			else
+				snprintf(labels, sizeof(labels), "route=\"%s\",status=\"other\"", metricas_rota_nomes[rota]);
+			metrics_write_histogram(out, "api_request_duration_seconds", labels, histogram);
+		}
+	}
+
+	string_write(out, "# HELP api_db_acquire_seconds Wait for a pool connection.\n# TYPE api_db_acquire_seconds histogram\n", 256);
+	metrics_histogram_read(METRICAS_ACQUIRE, histogram);
+	metrics_write_histogram(out, "api_db_acquire_seconds", "", histogram);
+
+	string_write(out, "# HELP api_db_query_seconds Query time by statement, round trip included.\n# TYPE api_db_query_seconds histogram\n", 256);
+	size_t statements = __atomic_load_n(&metricas_statements_count, __ATOMIC_ACQUIRE);
+	for(size_t i = 0; i <= statements && i <= METRICAS_STATEMENTS; i++){
+		metrics_histogram_read(METRICAS_QUERY + i, histogram);
+		if(histogram->count == 0)
+			continue;
+
+		snprintf(labels, sizeof(labels), "statement=\"%s\"", i < statements ? metricas_statements[i].label : "other");
+		metrics_write_histogram(out, "api_db_query_seconds", labels, histogram);
+	}
+	free(histogram);
+
+	metricas_counter(out, "api_saldo_lock_contended_total", "Saldo cache lock found held by another thread.", __atomic_load_n(&ctx.clientes.contencoes, __ATOMIC_RELAXED));
+	string_write(out, "# HELP api_saldo_lock_wait_seconds_total Time waiting for the saldo cache lock.\n# TYPE api_saldo_lock_wait_seconds_total counter\napi_saldo_lock_wait_seconds_total %.9f\n", 512,
+		__atomic_load_n(&ctx.clientes.espera_ns, __ATOMIC_RELAXED) / 1e9);
+
+	metricas_counter(out, "api_extrato_coalesced_total", "Extrato requests answered from another request's read.", voo_coalescidas_total());
+
+	if(ctx.db->cache != NULL){
+		db_cache_stats_t stats = db_cache_stats(ctx.db);
+		metricas_counter(out, "api_db_cache_hits_total", "Db result cache hits.", stats.hits);
+		metricas_counter(out, "api_db_cache_misses_total", "Db result cache misses.", stats.misses);
+		metricas_counter(out, "api_db_cache_invalidations_total", "Db result cache invalidations.", stats.invalidations);
+	}
+
+	if(ctx.admission != NULL){
+		admission_stats_t stats = admission_stats(ctx.admission);
+		metricas_counter(out, "api_admission_admitted_total", "Requests admitted to db work.", stats.admitted);
+		metricas_counter(out, "api_admission_queued_total", "Requests admitted after waiting in the queue.", stats.queued);
+		metricas_counter(out, "api_admission_shed_total", "Requests shed with 503.", stats.shed);
+	}
+
+	if(ctx.admission_streams != NULL){
+		admission_stats_t stats = admission_stats(ctx.admission_streams);
+		metricas_counter(out, "api_admission_streams_admitted_total", "History streams admitted to db work.", stats.admitted);
+		metricas_counter(out, "api_admission_streams_queued_total", "History streams admitted after waiting in the queue.", stats.queued);
+		metricas_counter(out, "api_admission_streams_shed_total", "History streams shed with 503.", stats.shed);
+	}
+
+	h->status = http_status_code_Ok;
+	http_set_header2(h, (fio_str_info_s){.data = "content-type", .len = 12}, (fio_str_info_s){.data = "text/plain; version=0.0.4", .len = 25});
+	size_t len = out->len;
+	http_send_body2(h, string_unwrap(out), len, free);
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _RASTRO_HEADER_
+#define _RASTRO_HEADER_
+
+#include <stdlib.h>
+#include "../facil.io/http.h"
+#include "../src/httpStatusCodes.h"
+#include "../src/trace.h"
+#include "../src/string+.h"
+
+/**
+ * @brief GET /trace, the sampled spans of every thread as chrome trace event json. Open it in chrome://tracing or ui.perfetto.dev
+*/
+void rastro_get(http_s *h){
+	string *out = string_new_sized(1 << 20);
+	trace_dump(out);
+
+	h->status = http_status_code_Ok;
+	http_set_header2(h, (fio_str_info_s){.data = "content-type", .len = 12}, (fio_str_info_s){.data = "application/json", .len = 16});
+	size_t len = out->len;
+	http_send_body2(h, string_unwrap(out), len, free);
+}
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef _VOO_HEADER_
+#define _VOO_HEADER_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../facil.io/http.h"
+#include "../src/httpStatusCodes.h"
+
+#define VOO_CHAVES 6							// one flight at a time per cliente id
+#define VOO_ETAG_LEN 64
+
+// one db read shared by every request for the same key that arrives while it runs
+typedef struct{
+	int64_t chave;
+	uint64_t versao;							// requests only board a flight that started at their version
+	size_t refs;								// leader plus passengers still to answer
+	bool pousou;
+	int status;
+	char *body;
+	size_t len;
+	http_template_s *headers;
+	char etag[VOO_ETAG_LEN];
+	size_t etag_len;
+	struct voo_passageiro_t *espera;			// paused before landing
+}voo_t;
+
+// a request waiting on a flight
+typedef struct voo_passageiro_t{
+	voo_t *voo;
+	void *udata;								// h->udata while paused
+	http_pause_handle_s *paused;
+	struct voo_passageiro_t *next;
+}voo_passageiro_t;
+
+static pthread_mutex_t voo_lock = PTHREAD_MUTEX_INITIALIZER;
+static voo_t *voo_voando[VOO_CHAVES];
+static size_t voo_coalescidas = 0;
+
+// requests answered from another request's db read, since start
+size_t voo_coalescidas_total(void){
+	return __atomic_load_n(&voo_coalescidas, __ATOMIC_RELAXED);
+}
+
+static void voo_free(voo_t *voo){
+	free(voo->body);
+	free(voo);
+}
+
+static void voo_release(voo_t *voo){
+	pthread_mutex_lock(&voo_lock);
+	bool last = --voo->refs == 0;
+	pthread_mutex_unlock(&voo_lock);
+
+	if(last)
+		voo_free(voo);
+}
+
+// answer a passenger with a copy of the leader's response
+static void voo_responder(http_s *h){
+	voo_passageiro_t *passageiro = h->udata;
+	voo_t *voo = passageiro->voo;
+	h->udata = passageiro->udata;
+	free(passageiro);
+
+	if(voo->status != http_status_code_Ok)
+		http_send_error(h, voo->status);
+	else{
+		h->status = voo->status;
+		if(voo->headers != NULL)
+			http_set_template(h, voo->headers);
+		if(voo->etag_len > 0)
+			http_set_header2(h, (fio_str_info_s){.data = "etag", .len = 4}, (fio_str_info_s){.data = voo->etag, .len = voo->etag_len});
+		http_send_body(h, voo->body, voo->len);
+	}
+
+	voo_release(voo);
+}
+
+// connection closed while waiting
+static void voo_drop(void *udata){
+	voo_passageiro_t *passageiro = udata;
+	voo_release(passageiro->voo);
+	free(passageiro);
+}
+
+// paused: wait for the landing, unless it already happened
+static void voo_esperar(http_pause_handle_s *paused){
+	voo_passageiro_t *passageiro = http_paused_udata_get(paused);
+	voo_t *voo = passageiro->voo;
+
+	pthread_mutex_lock(&voo_lock);
+	bool pousou = voo->pousou;
+	if(!pousou){
+		passageiro->paused = paused;
+		passageiro->next = voo->espera;
+		voo->espera = passageiro;
+	}
+	pthread_mutex_unlock(&voo_lock);
+
+	if(pousou)
+		http_resume(paused, voo_responder, voo_drop);
+}
+
+/**
+ * @brief board the flight of chave started at versao, or start one.
+ * Returns the new flight when the caller leads it: it runs the read, then calls voo_pousar.
+ * Returns NULL when h was paused as a passenger of a flight in the air, h must not be used anymore
+*/
+voo_t *voo_decolar(http_s *h, int64_t chave, uint64_t versao){
+	pthread_mutex_lock(&voo_lock);
+	voo_t *voo = voo_voando[chave];
+	if(voo != NULL && voo->versao == versao){
+		voo->refs++;
+		pthread_mutex_unlock(&voo_lock);
+
+		__atomic_add_fetch(&voo_coalescidas, 1, __ATOMIC_RELAXED);
+
+		voo_passageiro_t *passageiro = calloc(1, sizeof(voo_passageiro_t));
+		passageiro->voo = voo;
+		passageiro->udata = h->udata;
+		h->udata = passageiro;
+		http_pause(h, voo_esperar);
+		return NULL;
+	}
+
+	// a flight of an older version keeps going for its passengers, new requests wait on this one
+	voo = calloc(1, sizeof(voo_t));
+	voo->chave = chave;
+	voo->versao = versao;
+	voo->refs = 1;
+	voo_voando[chave] = voo;
+	pthread_mutex_unlock(&voo_lock);
+
+	return voo;
+}
+
+/**
+ * @brief land a flight with the leader's response and resume its passengers. The body is copied only when someone waits on it.
+ * The leader still answers its own request, and must not use voo afterwards
+*/
+void voo_pousar(voo_t *voo, int status, const char *body, size_t len, http_template_s *headers, fio_str_info_s etag){
+	pthread_mutex_lock(&voo_lock);
+	if(voo_voando[voo->chave] == voo)
+		voo_voando[voo->chave] = NULL;
+
+	// late passengers only see pousou after the response is set
+	if(voo->refs > 1 && status == http_status_code_Ok){
+		voo->body = malloc(len);
+		memcpy(voo->body, body, len);
+		voo->len = len;
+		voo->headers = headers;
+		voo->etag_len = etag.len < VOO_ETAG_LEN ? etag.len : 0;
+		memcpy(voo->etag, etag.data, voo->etag_len);
+	}
+	voo->status = status;
+	voo->pousou = true;
+
+	voo_passageiro_t *espera = voo->espera;
+	voo->espera = NULL;
+	bool last = --voo->refs == 0;
+	pthread_mutex_unlock(&voo_lock);
+
+	while(espera != NULL){
+		voo_passageiro_t *next = espera->next;
+		http_resume(espera->paused, voo_responder, voo_drop);
+		espera = next;
+	}
+
+	if(last)
+		voo_free(voo);
+}
+
+#endif
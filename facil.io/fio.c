@@ -31,6 +31,7 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 
@@ -58,6 +59,16 @@ Feel free to copy, use and enjoy according to the license provided.
 #endif
 #endif
 
+/* io_uring readiness engine, linux only, falls back to epoll at runtime */
+#ifndef FIO_ENGINE_URING
+#define FIO_ENGINE_URING 0
+#endif
+
+#if FIO_ENGINE_URING && !FIO_ENGINE_EPOLL
+#undef FIO_ENGINE_URING
+#define FIO_ENGINE_URING 0
+#endif
+
 /* for kqueue and epoll only */
 #ifndef FIO_POLL_MAX_EVENTS
 #define FIO_POLL_MAX_EVENTS 64
@@ -183,6 +194,8 @@ typedef struct {
   uint8_t open;
   /** indicated that the connection should be closed. */
   uint8_t close;
+  /** the queue holds `more` packets waiting for the next write. */
+  uint8_t corked;
   /** peer address length */
   uint8_t addr_len;
   /** peer address length */
@@ -283,6 +296,10 @@ static inline fio_packet_s *fio_packet_alloc(void) {
 Core Connection Data Clearing
 ***************************************************************************** */
 
+#if FIO_ENGINE_URING
+static inline void fio_uring_remove(intptr_t fd);
+#endif
+
 /* resets connection data, marking it as either open or closed. */
 static inline int fio_clear_fd(intptr_t fd, uint8_t is_open) {
   fio_packet_s *packet;
@@ -312,6 +329,11 @@ static inline int fio_clear_fd(intptr_t fd, uint8_t is_open) {
       --fio_data->max_protocol_fd;
   }
   fio_unlock(&(fd_data(fd).sock_lock));
+#if FIO_ENGINE_URING
+  /* however the previous file went away, its polls are stale: cancel them and
+   * reset the armed state, or the next file on this fd is never armed */
+  fio_uring_remove(fd);
+#endif
   if (rw_hooks && rw_hooks->cleanup)
     rw_hooks->cleanup(rw_udata);
   while (packet) {
@@ -1620,17 +1642,333 @@ Section Start Marker
 #if FIO_ENGINE_EPOLL
 #include <sys/epoll.h>
 
+#if FIO_ENGINE_URING
+/* *****************************************************************************
+io_uring readiness engine
+
+One shot IORING_OP_POLL_ADD requests replace the EPOLLONESHOT re-arms, so
+re-arming a socket is a ring write instead of an `epoll_ctl` system call. Arms
+queued by the worker threads are submitted by the reactor in the same
+`io_uring_enter` call that waits for completions (or immediately, when the
+reactor is already blocked). When the kernel refuses io_uring (old kernels,
+container seccomp profiles) or FIO_ENGINE=epoll is set, epoll is used instead.
+***************************************************************************** */
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+#ifndef FIO_URING_ENTRIES
+#define FIO_URING_ENTRIES 4096
+#endif
+
+/* user_data layout: fd << 9 | sequence << 1 | direction (0 read, 1 write) */
+#define FIO_URING_UDATA(fd, seq, dir)                                          \
+  (((uint64_t)(fd) << 9) | ((uint64_t)(seq) << 1) | (uint64_t)(dir))
+
+/* per fd state: pending directions and the sequence of each pending poll */
+typedef struct {
+  uint8_t armed;
+  uint8_t seq[2];
+} fio_uring_fd_s;
+
+static struct {
+  int fd;
+  fio_lock_i lock;
+  volatile uint8_t waiting; /* the reactor is blocked in io_uring_enter */
+  unsigned pending;         /* queued and not yet submitted */
+  unsigned entries;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+  fio_uring_fd_s *fds;
+  size_t capa;
+} fio_uring = {.fd = -1, .lock = FIO_LOCK_INIT};
+
+static inline int fio_uring_enter(unsigned to_submit, unsigned min_complete,
+                                  unsigned flags, void *arg, size_t argsz) {
+  return (int)syscall(__NR_io_uring_enter, fio_uring.fd, to_submit,
+                      min_complete, flags, arg, argsz);
+}
+
+static void fio_uring_close(void) {
+  if (fio_uring.fd == -1)
+    return;
+  if (fio_uring.sqes)
+    munmap(fio_uring.sqes, fio_uring.sqes_size);
+  if (fio_uring.cq_ring && fio_uring.cq_ring != fio_uring.sq_ring)
+    munmap(fio_uring.cq_ring, fio_uring.cq_ring_size);
+  if (fio_uring.sq_ring)
+    munmap(fio_uring.sq_ring, fio_uring.sq_ring_size);
+  close(fio_uring.fd);
+  free(fio_uring.fds);
+  fio_uring.fd = -1;
+  fio_uring.sqes = NULL;
+  fio_uring.sq_ring = fio_uring.cq_ring = NULL;
+  fio_uring.fds = NULL;
+  fio_uring.capa = 0;
+}
+
+/* returns -1 when io_uring can't be used and epoll should take over */
+static int fio_uring_init(void) {
+  fio_uring_close();
+  fio_uring.lock = FIO_LOCK_INIT;
+  fio_uring.waiting = 0;
+  fio_uring.pending = 0;
+
+  char const *engine = getenv("FIO_ENGINE");
+  if (engine && !strcmp(engine, "epoll"))
+    return -1;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  fio_uring.fd = (int)syscall(__NR_io_uring_setup, FIO_URING_ENTRIES, &params);
+  if (fio_uring.fd == -1) {
+    FIO_LOG_DEBUG("io_uring unavailable (%s), using epoll.", strerror(errno));
+    return -1;
+  }
+  /* the timed wait needs EXT_ARG (5.11), NODROP keeps completions safe */
+  if (!(params.features & IORING_FEAT_EXT_ARG) ||
+      !(params.features & IORING_FEAT_NODROP))
+    goto error;
+
+  fio_uring.entries = params.sq_entries;
+  fio_uring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  fio_uring.cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (fio_uring.cq_ring_size > fio_uring.sq_ring_size)
+      fio_uring.sq_ring_size = fio_uring.cq_ring_size;
+    fio_uring.cq_ring_size = fio_uring.sq_ring_size;
+  }
+  fio_uring.sq_ring =
+      mmap(NULL, fio_uring.sq_ring_size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, fio_uring.fd, IORING_OFF_SQ_RING);
+  if (fio_uring.sq_ring == MAP_FAILED) {
+    fio_uring.sq_ring = NULL;
+    goto error;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    fio_uring.cq_ring = fio_uring.sq_ring;
+  } else {
+    fio_uring.cq_ring =
+        mmap(NULL, fio_uring.cq_ring_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, fio_uring.fd, IORING_OFF_CQ_RING);
+    if (fio_uring.cq_ring == MAP_FAILED) {
+      fio_uring.cq_ring = NULL;
+      goto error;
+    }
+  }
+  fio_uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  fio_uring.sqes =
+      mmap(NULL, fio_uring.sqes_size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, fio_uring.fd, IORING_OFF_SQES);
+  if (fio_uring.sqes == MAP_FAILED) {
+    fio_uring.sqes = NULL;
+    goto error;
+  }
+
+  uint8_t *sq = fio_uring.sq_ring;
+  uint8_t *cq = fio_uring.cq_ring;
+  fio_uring.sq_head = (unsigned *)(sq + params.sq_off.head);
+  fio_uring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  fio_uring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  fio_uring.sq_array = (unsigned *)(sq + params.sq_off.array);
+  fio_uring.cq_head = (unsigned *)(cq + params.cq_off.head);
+  fio_uring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  fio_uring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  fio_uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  /* the fd table is sized like the reactor's (see fio_lib_init) */
+  struct rlimit rlim = {.rlim_cur = 0};
+  getrlimit(RLIMIT_NOFILE, &rlim);
+  fio_uring.capa = rlim.rlim_cur ? (size_t)rlim.rlim_cur : 1024;
+  fio_uring.fds = calloc(fio_uring.capa, sizeof(*fio_uring.fds));
+  if (!fio_uring.fds)
+    goto error;
+  return 0;
+
+error:
+  FIO_LOG_DEBUG("io_uring setup failed, using epoll.");
+  fio_uring_close();
+  return -1;
+}
+
+/* submits queued requests, call with the lock held */
+static inline void fio_uring_submit(void) {
+  if (!fio_uring.pending)
+    return;
+  int ret;
+  do {
+    ret = fio_uring_enter(fio_uring.pending, 0, 0, NULL, 0);
+  } while (ret == -1 && errno == EINTR);
+  fio_uring.pending = 0;
+}
+
+/* next free submission entry, call with the lock held */
+static inline struct io_uring_sqe *fio_uring_sqe(void) {
+  unsigned tail = *fio_uring.sq_tail;
+  if (tail - __atomic_load_n(fio_uring.sq_head, __ATOMIC_ACQUIRE) >=
+      fio_uring.entries)
+    fio_uring_submit();
+  unsigned index = tail & *fio_uring.sq_mask;
+  fio_uring.sq_array[index] = index;
+  struct io_uring_sqe *sqe = fio_uring.sqes + index;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+/* publishes the entry returned by fio_uring_sqe */
+static inline void fio_uring_push(void) {
+  __atomic_store_n(fio_uring.sq_tail, *fio_uring.sq_tail + 1, __ATOMIC_RELEASE);
+  ++fio_uring.pending;
+}
+
+/* queues a one shot poll, call with the lock held */
+static inline void fio_uring_arm(intptr_t fd, uint8_t dir) {
+  if (fd < 0 || (size_t)fd >= fio_uring.capa)
+    return;
+  fio_uring_fd_s *state = fio_uring.fds + fd;
+  if (state->armed & (1 << dir))
+    return;
+  state->armed |= (1 << dir);
+  ++state->seq[dir];
+  struct io_uring_sqe *sqe = fio_uring_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = (int)fd;
+  sqe->poll32_events = (dir ? POLLOUT : POLLIN) | POLLRDHUP | POLLHUP;
+  sqe->user_data = FIO_URING_UDATA(fd, state->seq[dir], dir);
+  fio_uring_push();
+}
+
+static inline void fio_uring_add(intptr_t fd, uint8_t read, uint8_t write) {
+  fio_lock(&fio_uring.lock);
+  if (read)
+    fio_uring_arm(fd, 0);
+  if (write)
+    fio_uring_arm(fd, 1);
+  /* the reactor won't submit before its wait ends, don't delay the arm */
+  if (fio_uring.waiting)
+    fio_uring_submit();
+  fio_unlock(&fio_uring.lock);
+}
+
+/* cancels pending polls, they hold a reference to the file */
+static inline void fio_uring_remove(intptr_t fd) {
+  if (fd < 0 || (size_t)fd >= fio_uring.capa)
+    return;
+  fio_lock(&fio_uring.lock);
+  fio_uring_fd_s *state = fio_uring.fds + fd;
+  if (!state->armed) {
+    fio_unlock(&fio_uring.lock);
+    return;
+  }
+  for (uint8_t dir = 0; dir < 2; ++dir) {
+    if (!(state->armed & (1 << dir)))
+      continue;
+    state->armed &= ~(1 << dir);
+    struct io_uring_sqe *sqe = fio_uring_sqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = FIO_URING_UDATA(fd, state->seq[dir], dir);
+    sqe->user_data = 0;
+    fio_uring_push();
+  }
+  fio_uring_submit();
+  fio_unlock(&fio_uring.lock);
+}
+
+static size_t fio_uring_poll(void) {
+  int timeout_millisec = fio_timer_calc_first_interval();
+  struct __kernel_timespec ts = {
+      .tv_sec = timeout_millisec / 1000,
+      .tv_nsec = (timeout_millisec % 1000) * 1000000,
+  };
+  struct io_uring_getevents_arg arg = {.ts = (uint64_t)(uintptr_t)&ts};
+
+  /* submit what the workers queued and wait, in a single system call */
+  fio_lock(&fio_uring.lock);
+  unsigned to_submit = fio_uring.pending;
+  fio_uring.pending = 0;
+  fio_uring.waiting = 1;
+  fio_unlock(&fio_uring.lock);
+  fio_uring_enter(to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                  &arg, sizeof(arg));
+  fio_uring.waiting = 0;
+
+  size_t total = 0;
+  unsigned head = *fio_uring.cq_head;
+  unsigned tail = __atomic_load_n(fio_uring.cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    struct io_uring_cqe *cqe = fio_uring.cqes + (head & *fio_uring.cq_mask);
+    uint64_t udata = cqe->user_data;
+    int res = cqe->res;
+    if (!udata)
+      continue; /* poll removal */
+    intptr_t fd = (intptr_t)(udata >> 9);
+    uint8_t dir = udata & 1;
+    uint8_t seq = (udata >> 1) & 255;
+
+    /* completions of removed (or already re-armed) polls are stale */
+    uint8_t valid = 0;
+    fio_lock(&fio_uring.lock);
+    if ((size_t)fd < fio_uring.capa &&
+        (fio_uring.fds[fd].armed & (1 << dir)) &&
+        fio_uring.fds[fd].seq[dir] == seq) {
+      fio_uring.fds[fd].armed &= ~(1 << dir);
+      valid = 1;
+    }
+    fio_unlock(&fio_uring.lock);
+    if (!valid || res == -ECANCELED)
+      continue;
+
+    if (res < 0 || (res & (~(POLLIN | POLLOUT)))) {
+      // errors are hendled as disconnections (on_close)
+      fio_force_close_in_poll(fd2uuid(fd));
+    } else if (dir) {
+      fio_defer_push_urgent(deferred_on_ready, (void *)fd2uuid(fd), NULL);
+    } else {
+      fio_defer_push_task(deferred_on_data, (void *)fd2uuid(fd), NULL);
+    }
+    ++total;
+  }
+  __atomic_store_n(fio_uring.cq_head, head, __ATOMIC_RELEASE);
+  return total;
+}
+
+/**
+ * Returns a C string detailing the IO engine selected during compilation.
+ *
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
+ */
+char const *fio_engine(void) {
+  return fio_uring.fd == -1 ? "epoll" : "io_uring";
+}
+#else
 /**
  * Returns a C string detailing the IO engine selected during compilation.
  *
  * Valid values are "kqueue", "epoll" and "poll".
  */
 char const *fio_engine(void) { return "epoll"; }
+#endif
 
 /* epoll tester, in and out */
 static int evio_fd[3] = {-1, -1, -1};
 
 static void fio_poll_close(void) {
+#if FIO_ENGINE_URING
+  fio_uring_close();
+#endif
   for (int i = 0; i < 3; ++i) {
     if (evio_fd[i] != -1) {
       close(evio_fd[i]);
@@ -1641,6 +1979,10 @@ static void fio_poll_close(void) {
 
 static void fio_poll_init(void) {
   fio_poll_close();
+#if FIO_ENGINE_URING
+  if (fio_uring_init() == 0)
+    return;
+#endif
   for (int i = 0; i < 3; ++i) {
     evio_fd[i] = epoll_create1(EPOLL_CLOEXEC);
     if (evio_fd[i] == -1)
@@ -1686,18 +2028,36 @@ static inline int fio_poll_add2(int fd, uint32_t events, int ep_fd) {
 }
 
 static inline void fio_poll_add_read(intptr_t fd) {
+#if FIO_ENGINE_URING
+  if (fio_uring.fd != -1) {
+    fio_uring_add(fd, 1, 0);
+    return;
+  }
+#endif
   fio_poll_add2(fd, (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLONESHOT),
                 evio_fd[1]);
   return;
 }
 
 static inline void fio_poll_add_write(intptr_t fd) {
+#if FIO_ENGINE_URING
+  if (fio_uring.fd != -1) {
+    fio_uring_add(fd, 0, 1);
+    return;
+  }
+#endif
   fio_poll_add2(fd, (EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLONESHOT),
                 evio_fd[2]);
   return;
 }
 
 static inline void fio_poll_add(intptr_t fd) {
+#if FIO_ENGINE_URING
+  if (fio_uring.fd != -1) {
+    fio_uring_add(fd, 1, 1);
+    return;
+  }
+#endif
   if (fio_poll_add2(fd, (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLONESHOT),
                     evio_fd[1]) == -1)
     return;
@@ -1707,12 +2067,22 @@ static inline void fio_poll_add(intptr_t fd) {
 }
 
 FIO_FUNC inline void fio_poll_remove_fd(intptr_t fd) {
+#if FIO_ENGINE_URING
+  if (fio_uring.fd != -1) {
+    fio_uring_remove(fd);
+    return;
+  }
+#endif
   struct epoll_event chevent = {.events = (EPOLLOUT | EPOLLIN), .data.fd = fd};
   epoll_ctl(evio_fd[1], EPOLL_CTL_DEL, fd, &chevent);
   epoll_ctl(evio_fd[2], EPOLL_CTL_DEL, fd, &chevent);
 }
 
 static size_t fio_poll(void) {
+#if FIO_ENGINE_URING
+  if (fio_uring.fd != -1)
+    return fio_uring_poll();
+#endif
   int timeout_millisec = fio_timer_calc_first_interval();
   struct epoll_event internal[2];
   struct epoll_event events[FIO_POLL_MAX_EVENTS];
@@ -2621,7 +2991,41 @@ static inline void fio_sock_packet_rotate_unsafe(uintptr_t fd) {
   fio_packet_free(packet);
 }
 
+#ifndef FIO_WRITEV_MAX
+/** The maximum number of queued buffers sent in a single `writev`. */
+#define FIO_WRITEV_MAX 16
+#endif
+
 static int fio_sock_write_buffer(int fd, fio_packet_s *packet) {
+  if (packet->next && packet->next->write_func == fio_sock_write_buffer &&
+      fd_data(fd).rw_hooks == &FIO_DEFAULT_RW_HOOKS) {
+    /* gather the queued buffers into a single system call */
+    struct iovec iov[FIO_WRITEV_MAX];
+    int count = 0;
+    for (fio_packet_s *pos = packet;
+         pos && count < FIO_WRITEV_MAX &&
+         pos->write_func == fio_sock_write_buffer;
+         pos = pos->next) {
+      iov[count].iov_base = (uint8_t *)pos->data.buffer + pos->offset;
+      iov[count].iov_len = pos->length;
+      ++count;
+    }
+    ssize_t total = writev(fd, iov, count);
+    if (total <= 0)
+      return (int)total;
+    const int written = (int)total;
+    while (total > 0) {
+      packet = fd_data(fd).packet;
+      if ((uintptr_t)total < packet->length) {
+        packet->length -= total;
+        packet->offset += total;
+        break;
+      }
+      total -= packet->length;
+      fio_sock_packet_rotate_unsafe(fd);
+    }
+    return written;
+  }
   int written = fd_data(fd).rw_hooks->write(
       fd2uuid(fd), fd_data(fd).rw_udata,
       ((uint8_t *)packet->data.buffer + packet->offset), packet->length);
@@ -2818,8 +3222,9 @@ ssize_t fio_write2_fn(intptr_t uuid, fio_write_args_s options) {
   if (!uuid_is_valid(uuid)) {
     goto locked_error;
   }
-  if (uuid_data(uuid).packet)
+  if (uuid_data(uuid).packet && !uuid_data(uuid).corked)
     was_empty = 0;
+  uuid_data(uuid).corked = options.more;
   if (options.urgent == 0) {
     *uuid_data(uuid).packet_last = packet;
     uuid_data(uuid).packet_last = &packet->next;
@@ -2836,7 +3241,7 @@ ssize_t fio_write2_fn(intptr_t uuid, fio_write_args_s options) {
   fio_atomic_add(&uuid_data(uuid).packet_count, 1);
   fio_unlock(&uuid_data(uuid).sock_lock);
 
-  if (was_empty) {
+  if (was_empty && !options.more) {
     touchfd(fio_uuid2fd(uuid));
     deferred_on_ready((void *)uuid, (void *)1);
   }
@@ -2923,6 +3328,7 @@ void fio_force_close(intptr_t uuid) {
   }
   fio_lock(&uuid_data(uuid).protocol_lock);
   fio_clear_fd(fio_uuid2fd(uuid), 0);
+  /* fio_clear_fd cancelled the pending polls, they pin the socket */
   fio_unlock(&uuid_data(uuid).protocol_lock);
   close(fio_uuid2fd(uuid));
 #if FIO_ENGINE_POLL
@@ -1172,6 +1172,13 @@ typedef struct {
   uintptr_t offset;
   /** The packet will be sent as soon as possible. */
   unsigned urgent : 1;
+  /**
+   * More data follows: the packet is queued without being flushed, so it goes
+   * out together with the next write (one vectored system call).
+   *
+   * Note: the packet waits until the next write, which MUST follow.
+   */
+  unsigned more : 1;
   /**
    * The data union contains the value of a file descriptor (`int`). i.e.:
    *  `.data.fd = fd` or `.data.buffer = (void*)fd;`
@@ -18,4 +18,14 @@ static inline __attribute__((unused)) ssize_t fiobj_send_free(intptr_t uuid,
                     .length = s.len, .after.dealloc = fiobj4sock_dealloc);
 }
 
+/** send a FIOBJ object together with the next write (see `more`). */
+static inline __attribute__((unused)) ssize_t fiobj_send_free_more(intptr_t uuid,
+                                                                   FIOBJ o) {
+  fio_str_info_s s = fiobj_obj2cstr(o);
+  return fio_write2(uuid, .data.buffer = (void *)(o),
+                    .offset = (uintptr_t)(((intptr_t)s.data) - ((intptr_t)(o))),
+                    .length = s.len, .after.dealloc = fiobj4sock_dealloc,
+                    .more = 1);
+}
+
 #endif
@@ -84,14 +84,7 @@ static inline void add_content_type(http_s *r) {
 static FIOBJ current_date;
 static time_t last_date_added;
 static fio_lock_i date_lock;
-static inline void add_date(http_s *r) {
-  static uint64_t date_hash = 0;
-  if (!date_hash)
-    date_hash = fiobj_hash_string("date", 4);
-  static uint64_t mod_hash = 0;
-  if (!mod_hash)
-    mod_hash = fiobj_hash_string("last-modified", 13);
-
+static inline void refresh_date(void) {
   if (fio_last_tick().tv_sec > last_date_added) {
     fio_lock(&date_lock);
     if (fio_last_tick().tv_sec > last_date_added) { /* retest inside lock */
@@ -105,6 +98,16 @@ static inline void add_date(http_s *r) {
     }
     fio_unlock(&date_lock);
   }
+}
+static inline void add_date(http_s *r) {
+  static uint64_t date_hash = 0;
+  if (!date_hash)
+    date_hash = fiobj_hash_string("date", 4);
+  static uint64_t mod_hash = 0;
+  if (!mod_hash)
+    mod_hash = fiobj_hash_string("last-modified", 13);
+
+  refresh_date();
 
   if (!fiobj_hash_get2(r->private_data.out_headers, date_hash)) {
     fiobj_hash_set(r->private_data.out_headers, HTTP_HEADER_DATE,
@@ -117,6 +120,14 @@ static inline void add_date(http_s *r) {
   }
 }
 
+/** Writes the cached Date header value (refreshed once a second) to `dest`. */
+void http_date_write(FIOBJ dest) {
+  refresh_date();
+  fio_lock(&date_lock);
+  fiobj_str_join(dest, current_date);
+  fio_unlock(&date_lock);
+}
+
 struct header_writer_s {
   FIOBJ dest;
   FIOBJ name;
@@ -154,6 +165,30 @@ The Request / Response type and functions
 static const char hex_chars[] = {'0', '1', '2', '3', '4', '5', '6', '7',
                                  '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
 
+/**
+ * Finds a request header by its (lower case) name, without building the
+ * `headers` hash when the connection parses headers lazily.
+ */
+fio_str_info_s http_header_get(http_s *h, const char *name, size_t name_len) {
+  if (!h || !name)
+    return (fio_str_info_s){.len = 0, .data = NULL};
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  if (vtbl && vtbl->http_header_get)
+    return vtbl->http_header_get(h, name, name_len);
+  return http_headers_find(h->headers, name, name_len);
+}
+
+/**
+ * Builds the `headers` hash from headers recorded lazily.
+ */
+void http_headers_load(http_s *h) {
+  if (!h)
+    return;
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  if (vtbl && vtbl->http_headers_load)
+    vtbl->http_headers_load(h);
+}
+
 /**
  * Sets a response header, taking ownership of the value object, but NOT the
  * name object (so name objects could be reused in future responses).
@@ -332,12 +367,73 @@ int http_send_body(http_s *r, void *data, uintptr_t length) {
     http_finish(r);
     return 0;
   }
-  add_content_length(r, length);
-  // add_content_type(r);
-  add_date(r);
+  /* templates splice the length and date in themselves */
+  if (!r->private_data.header_template) {
+    add_content_length(r, length);
+    // add_content_type(r);
+    add_date(r);
+  }
   return ((http_vtable_s *)r->private_data.vtbl)
       ->http_send_body(r, data, length);
 }
+/**
+ * Sends the response headers and body, taking ownership of the body.
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_body2(http_s *r, void *data, uintptr_t length,
+                    void (*dealloc)(void *)) {
+  if (!dealloc)
+    dealloc = free;
+  if (HTTP_INVALID_HANDLE(r)) {
+    if (data)
+      dealloc(data);
+    return -1;
+  }
+  http_vtable_s *vtbl = (http_vtable_s *)r->private_data.vtbl;
+  if (!length || !data || !vtbl->http_send_body2) {
+    int ret = http_send_body(r, data, length);
+    if (data)
+      dealloc(data);
+    return ret;
+  }
+  if (!r->private_data.header_template) {
+    add_content_length(r, length);
+    add_date(r);
+  }
+  return vtbl->http_send_body2(r, data, length, dealloc);
+}
+
+/**
+ * Builds a response header template from a block of `name:value\r\n` lines.
+ */
+http_template_s *http_template_new(const char *headers) {
+  size_t len = headers ? strlen(headers) : 0;
+  /* make sure the last line is terminated */
+  uint8_t eol = len >= 2 && headers[len - 2] == '\r' && headers[len - 1] == '\n';
+  http_template_s *t = malloc(sizeof(*t) + len + (eol ? 0 : 2));
+  FIO_ASSERT_ALLOC(t);
+  if (len)
+    memcpy(t->block, headers, len);
+  if (len && !eol) {
+    t->block[len++] = '\r';
+    t->block[len++] = '\n';
+  }
+  t->len = len;
+  return t;
+}
+
+/** Frees a template. No response may still be using it. */
+void http_template_free(http_template_s *t) { free(t); }
+
+/** Selects the header template for the response. */
+void http_set_template(http_s *h, http_template_s *t) {
+  if (HTTP_INVALID_HANDLE(h))
+    return;
+  h->private_data.header_template = t;
+}
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -430,6 +526,7 @@ int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
   uint8_t is_gz = 0;
 
   fio_str_info_s s = fiobj_obj2cstr(filename);
+  http_headers_load(h);
   {
     FIOBJ tmp = fiobj_hash_get2(h->headers, accept_enc_hash);
     if (!tmp)
@@ -624,6 +721,7 @@ int http_send_error(http_s *r, size_t error) {
   if (error < 100 || error >= 1000)
     error = 500;
   r->status = error;
+  r->private_data.header_template = NULL;
   char buffer[16];
   buffer[0] = '/';
   size_t pos = 1 + fio_ltoa(buffer + 1, error, 10);
@@ -644,6 +742,21 @@ int http_send_error(http_s *r, size_t error) {
   return 0;
 }
 
+/**
+ * Sends the next part of a response body whose length isn't known upfront.
+ *
+ * Returns -1 on error and 0 on success.
+ */
+int http_stream(http_s *r, void *data, uintptr_t length) {
+  if (HTTP_INVALID_HANDLE(r))
+    return -1;
+  http_vtable_s *vtbl = (http_vtable_s *)r->private_data.vtbl;
+  if (!vtbl->http_stream)
+    return -1;
+  add_date(r);
+  return vtbl->http_stream(r, data, length);
+}
+
 /**
  * Sends the response headers for a header only response.
  *
@@ -653,7 +766,9 @@ void http_finish(http_s *r) {
   if (!r || !r->private_data.vtbl) {
     return;
   }
-  add_content_length(r, 0);
+  /* 304 and 204 carry no body, a zero length would misstate the resource */
+  if (r->status != 304 && r->status != 204)
+    add_content_length(r, 0);
   add_date(r);
   ((http_vtable_s *)r->private_data.vtbl)->http_finish(r);
 }
@@ -1529,6 +1644,7 @@ static inline void http_parse_cookies_setcookie_str(FIOBJ dest, FIOBJ str,
 void http_parse_cookies(http_s *h, uint8_t is_url_encoded) {
   if (!h->headers)
     return;
+  http_headers_load(h);
   if (h->cookies && fiobj_hash_count(h->cookies)) {
     FIO_LOG_WARNING("(http) attempting to parse cookies more than once.");
     return;
@@ -1922,6 +2038,7 @@ int http_parse_body(http_s *h) {
     return -1;
   if (!content_type_hash)
     content_type_hash = fiobj_hash_string("content-type", 12);
+  http_headers_load(h);
   FIOBJ ct = fiobj_hash_get2(h->headers, content_type_hash);
   fio_str_info_s content_type = fiobj_obj2cstr(ct);
   if (content_type.len < 16)
@@ -1980,6 +2097,7 @@ HTTP Helper functions that could be used globally
  * debugging.
  */
 FIOBJ http_req2str(http_s *h) {
+  http_headers_load(h);
   if (HTTP_INVALID_HANDLE(h) || !fiobj_hash_count(h->headers))
     return FIOBJ_INVALID;
 
@@ -80,6 +80,8 @@ typedef struct {
     uintptr_t flag;
     /** The response headers, if they weren't sent. Don't access directly. */
     FIOBJ out_headers;
+    /** The response header template, if any. Don't access directly. */
+    void *header_template;
   } private_data;
   /** a time merker indicating when the request was received. */
   struct timespec received_at;
@@ -155,6 +157,24 @@ typedef struct {
   unsigned http_only : 1;
 } http_cookie_args_s;
 
+/**
+ * Finds a request header by its (lower case) name, without building the
+ * `headers` hash when the connection parses headers lazily.
+ *
+ * Returns the first value of repeated headers, or an empty `fio_str_info_s`
+ * when the header is missing. The data is only valid until the handler returns
+ * or pauses - copy it to keep it.
+ */
+fio_str_info_s http_header_get(http_s *h, const char *name, size_t name_len);
+
+/**
+ * Builds the `headers` hash from headers recorded lazily (see the
+ * `lazy_headers` setting). Call before accessing `h->headers` directly.
+ *
+ * Does nothing when the headers were already loaded.
+ */
+void http_headers_load(http_s *h);
+
 /**
  * Sets a response header, taking ownership of the value object, but NOT the
  * name object (so name objects could be reused in future responses).
@@ -196,6 +216,45 @@ int http_set_cookie(http_s *h, http_cookie_args_s);
  */
 int http_send_body(http_s *h, void *data, uintptr_t length);
 
+/**
+ * Sends the response headers and body, taking ownership of the body.
+ *
+ * Small bodies are copied next to the headers and `dealloc` is called right
+ * away. Larger bodies aren't copied, they are queued after the headers (both
+ * sent in a single vectored write) and `dealloc(data)` is called once the data
+ * was sent. If `dealloc` is NULL, `free` is used.
+ *
+ * Returns -1 on error and 0 on success (the body is released either way).
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_body2(http_s *h, void *data, uintptr_t length,
+                    void (*dealloc)(void *));
+
+/** A precomputed block of static response headers. */
+typedef struct http_template_s http_template_s;
+
+/**
+ * Builds a response header template from a block of `name:value\r\n` lines.
+ *
+ * Templates are meant to be created at startup (i.e., one per route) and kept
+ * for the life of the server. A response using a template emits the block as
+ * is, only the status line, the connection header, Content-Length and the
+ * cached Date are added. Headers set with `http_set_header` are still sent.
+ */
+http_template_s *http_template_new(const char *headers);
+
+/** Frees a template. No response may still be using it. */
+void http_template_free(http_template_s *t);
+
+/**
+ * Selects the header template for the response.
+ *
+ * The template is used by `http_send_body` and `http_send_body2`, other
+ * responses build their headers from the headers hash as usual.
+ */
+void http_set_template(http_s *h, http_template_s *t);
+
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -236,6 +295,25 @@ int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
  */
 int http_send_error(http_s *h, size_t error_code);
 
+/**
+ * Sends the next part of a response body whose length isn't known upfront.
+ *
+ * The first call sends the response headers, without a Content-Length and
+ * without the header template. HTTP/1.1 bodies are sent with chunked transfer
+ * encoding, HTTP/1.0 bodies end when the connection closes. `data` is copied.
+ *
+ * The call blocks while the client is slow to read, so the body is never
+ * queued whole in memory. Stream from a worker thread.
+ *
+ * Call `http_finish` to end the body. When the body can't be completed, set
+ * `h->status` to 500 or above first: the connection is closed without ending
+ * the body, so the client knows it was cut short.
+ *
+ * Returns -1 on error (i.e. the client disconnected, `http_finish` must still
+ * be called) and 0 on success.
+ */
+int http_stream(http_s *h, void *data, uintptr_t length);
+
 /**
  * Sends the response headers for a header only response.
  *
@@ -328,6 +406,12 @@ struct http_settings_s {
   void (*on_response)(http_s *response);
   /** (optional) the callback to be performed when the HTTP service closes. */
   void (*on_finish)(struct http_settings_s *settings);
+  /**
+   * (optional) called once a response was written, on the thread that
+   * finished it and before the handle is cleared: method, path, status and
+   * `received_at` are still valid. For metrics, must not send anything.
+   */
+  void (*on_sent)(http_s *h);
   /** Opaque user data. Facil.io will ignore this field, but you can use it. */
   void *udata;
   /**
@@ -403,6 +487,15 @@ struct http_settings_s {
   uint8_t log;
   /** a read only flag set automatically to indicate the protocol's mode. */
   uint8_t is_client;
+  /**
+   * Lazy headers flag - set to TRUE to record request headers as offsets into
+   * the connection buffer instead of building the `headers` hash for every
+   * request.
+   *
+   * Use `http_header_get` to read a header, or call `http_headers_load` before
+   * accessing `h->headers` directly. Ignored by clients.
+   */
+  uint8_t lazy_headers;
 };
 
 /**
@@ -12,12 +12,22 @@ License: MIT
 #include <fiobj.h>
 
 #include <assert.h>
+#include <poll.h>
 #include <stddef.h>
+#include <time.h>
 
 /* *****************************************************************************
 The HTTP/1.1 Protocol Object
 ***************************************************************************** */
 
+/** a request header recorded in the connection buffer (lazy headers mode) */
+typedef struct {
+  char *name;
+  char *value;
+  uint32_t name_len;
+  uint32_t value_len;
+} http1_lazy_header_s;
+
 typedef struct http1pr_s {
   http_fio_protocol_s p;
   http1_parser_s parser;
@@ -28,6 +38,11 @@ typedef struct http1pr_s {
   uint8_t close;
   uint8_t is_client;
   uint8_t stop;
+  uint8_t lazy;
+  uint8_t streaming; /* 1: chunked body, 2: body until close (HTTP/1.0) */
+  uint64_t stream_waited_ms; /* time the streaming handler was held by the client */
+  uintptr_t lazy_count;
+  http1_lazy_header_s lazy_headers[HTTP_MAX_HEADER_COUNT + 1];
   uint8_t buf[];
 } http1pr_s;
 
@@ -40,16 +55,62 @@ Internal Helpers
 #define parser2http(x)                                                         \
   ((http1pr_s *)((uintptr_t)(x) - (uintptr_t)(&((http1pr_s *)0)->parser)))
 
-inline static void h1_reset(http1pr_s *p) { p->header_size = 0; }
+inline static void h1_reset(http1pr_s *p) {
+  p->header_size = 0;
+  p->lazy_count = 0;
+}
 
 #define http1_pr2handle(pr) (((http1pr_s *)(pr))->request)
 #define handle2pr(h) ((http1pr_s *)h->private_data.flag)
 
 static fio_str_info_s http1pr_status2str(uintptr_t status);
 
+/* builds the headers hash from the headers recorded in the buffer */
+static void http1_headers_load(http_s *h) {
+  http1pr_s *p = handle2pr(h);
+  if (h != &p->request || !p->lazy_count)
+    return;
+  for (uintptr_t i = 0; i < p->lazy_count; ++i) {
+    FIOBJ sym = fiobj_str_new(p->lazy_headers[i].name,
+                              p->lazy_headers[i].name_len);
+    FIOBJ obj = fiobj_str_new(p->lazy_headers[i].value,
+                              p->lazy_headers[i].value_len);
+    set_header_add(h->headers, sym, obj);
+    fiobj_free(sym);
+  }
+  p->lazy_count = 0;
+}
+
+/* finds a request header, recorded or loaded. Repeated headers are loaded,
+ * so they are merged by set_header_add as in the eager path */
+static fio_str_info_s http1_header_get(http_s *h, const char *name,
+                                       size_t name_len) {
+  http1pr_s *p = handle2pr(h);
+  if (h == &p->request) {
+    http1_lazy_header_s *found = NULL;
+    for (uintptr_t i = 0; i < p->lazy_count; ++i) {
+      if (p->lazy_headers[i].name_len != name_len ||
+          memcmp(p->lazy_headers[i].name, name, name_len))
+        continue;
+      if (found) {
+        http1_headers_load(h);
+        return http_headers_find(h->headers, name, name_len);
+      }
+      found = p->lazy_headers + i;
+    }
+    if (found && !http_headers_find(h->headers, name, name_len).data)
+      return (fio_str_info_s){.len = found->value_len, .data = found->value};
+    if (found)
+      http1_headers_load(h);
+  }
+  return http_headers_find(h->headers, name, name_len);
+}
+
 /* cleanup an HTTP/1.1 handler object */
 static inline void http1_after_finish(http_s *h) {
   http1pr_s *p = handle2pr(h);
+  if (p->p.settings->on_sent)
+    p->p.settings->on_sent(h);
   p->stop = p->stop & (~1UL);
   if (h != &p->request) {
     http_s_destroy(h, 0);
@@ -95,11 +156,44 @@ static int write_header(FIOBJ o, void *w_) {
   return 0;
 }
 
+static uintptr_t connection_hash;
+
+/** writes the response status line and connection header */
+static void http1_write_status(http_s *h, FIOBJ dest) {
+  http1pr_s *p = handle2pr(h);
+  fio_str_info_s t = http1pr_status2str(h->status);
+  fiobj_str_write(dest, t.data, t.len);
+  FIOBJ tmp = fiobj_hash_get2(h->private_data.out_headers, connection_hash);
+  if (tmp) {
+    t = fiobj_obj2cstr(tmp);
+    if (t.data[0] == 'c' || t.data[0] == 'C')
+      p->close = 1;
+  } else {
+    t = http1_header_get(h, "connection", 10);
+    if (t.data) {
+      if (!t.len || t.data[0] == 'k' || t.data[0] == 'K')
+        fiobj_str_write(dest, "connection:keep-alive\r\n", 23);
+      else {
+        fiobj_str_write(dest, "connection:close\r\n", 18);
+        p->close = 1;
+      }
+    } else {
+      t = fiobj_obj2cstr(h->version);
+      if (!p->close && t.len > 7 && t.data && t.data[5] == '1' &&
+          t.data[6] == '.' && t.data[7] == '1')
+        fiobj_str_write(dest, "connection:keep-alive\r\n", 23);
+      else {
+        fiobj_str_write(dest, "connection:close\r\n", 18);
+        p->close = 1;
+      }
+    }
+  }
+}
+
 static FIOBJ headers2str(http_s *h, uintptr_t padding) {
   if (!h->method && !!h->status_str)
     return FIOBJ_INVALID;
 
-  static uintptr_t connection_hash;
   if (!connection_hash)
     connection_hash = fiobj_hash_string("connection", 10);
 
@@ -112,34 +206,7 @@ static FIOBJ headers2str(http_s *h, uintptr_t padding) {
   http1pr_s *p = handle2pr(h);
 
   if (p->is_client == 0) {
-    fio_str_info_s t = http1pr_status2str(h->status);
-    fiobj_str_write(w.dest, t.data, t.len);
-    FIOBJ tmp = fiobj_hash_get2(h->private_data.out_headers, connection_hash);
-    if (tmp) {
-      t = fiobj_obj2cstr(tmp);
-      if (t.data[0] == 'c' || t.data[0] == 'C')
-        p->close = 1;
-    } else {
-      tmp = fiobj_hash_get2(h->headers, connection_hash);
-      if (tmp) {
-        t = fiobj_obj2cstr(tmp);
-        if (!t.data || !t.len || t.data[0] == 'k' || t.data[0] == 'K')
-          fiobj_str_write(w.dest, "connection:keep-alive\r\n", 23);
-        else {
-          fiobj_str_write(w.dest, "connection:close\r\n", 18);
-          p->close = 1;
-        }
-      } else {
-        t = fiobj_obj2cstr(h->version);
-        if (!p->close && t.len > 7 && t.data && t.data[5] == '1' &&
-            t.data[6] == '.' && t.data[7] == '1')
-          fiobj_str_write(w.dest, "connection:keep-alive\r\n", 23);
-        else {
-          fiobj_str_write(w.dest, "connection:close\r\n", 18);
-          p->close = 1;
-        }
-      }
-    }
+    http1_write_status(h, w.dest);
   } else {
     if (h->method) {
       fiobj_str_join(w.dest, h->method);
@@ -173,10 +240,43 @@ static FIOBJ headers2str(http_s *h, uintptr_t padding) {
   return w.dest;
 }
 
+/** response headers from a template: the precomputed block plus the spliced
+ * content-length and date */
+static FIOBJ template2str(http_s *h, uintptr_t length, uintptr_t padding) {
+  if (!h->method && !!h->status_str)
+    return FIOBJ_INVALID;
+
+  if (!connection_hash)
+    connection_hash = fiobj_hash_string("connection", 10);
+
+  http_template_s *t = h->private_data.header_template;
+  struct header_writer_s w;
+  w.dest = fiobj_str_buf(t->len + 128 + padding);
+
+  http1_write_status(h, w.dest);
+  fiobj_str_write(w.dest, t->block, t->len);
+
+  char num[24];
+  size_t len = fio_ltoa(num, (int64_t)length, 10);
+  fiobj_str_write(w.dest, "content-length:", 15);
+  fiobj_str_write(w.dest, num, len);
+  fiobj_str_write(w.dest, "\r\ndate:", 7);
+  http_date_write(w.dest);
+  fiobj_str_write(w.dest, "\r\n", 2);
+
+  /* anything the handler added on top of the template */
+  if (fiobj_hash_count(h->private_data.out_headers))
+    fiobj_each1(h->private_data.out_headers, 0, write_header, &w);
+  fiobj_str_write(w.dest, "\r\n", 2);
+  return w.dest;
+}
+
 /** Should send existing headers and data */
 static int http1_send_body(http_s *h, void *data, uintptr_t length) {
 
-  FIOBJ packet = headers2str(h, length);
+  FIOBJ packet = h->private_data.header_template
+                     ? template2str(h, length, length)
+                     : headers2str(h, length);
   if (!packet) {
     http1_after_finish(h);
     return -1;
@@ -186,6 +286,33 @@ static int http1_send_body(http_s *h, void *data, uintptr_t length) {
   http1_after_finish(h);
   return 0;
 }
+#ifndef HTTP1_COPY_LIMIT
+/** Bodies up to this size are copied next to the headers by `send_body2`. */
+#define HTTP1_COPY_LIMIT 1024
+#endif
+
+/** Should send existing headers and data, taking ownership of the data */
+static int http1_send_body2(http_s *h, void *data, uintptr_t length,
+                            void (*dealloc)(void *)) {
+  if (length <= HTTP1_COPY_LIMIT) {
+    int ret = http1_send_body(h, data, length);
+    dealloc(data);
+    return ret;
+  }
+  FIOBJ packet = h->private_data.header_template ? template2str(h, length, 0)
+                                                 : headers2str(h, 0);
+  if (!packet) {
+    dealloc(data);
+    http1_after_finish(h);
+    return -1;
+  }
+  /* the headers wait for the body, both leave in one `writev` */
+  fiobj_send_free_more((handle2pr(h)->p.uuid), packet);
+  fio_write2((handle2pr(h)->p.uuid), .data.buffer = data, .length = length,
+             .after.dealloc = dealloc);
+  http1_after_finish(h);
+  return 0;
+}
 /** Should send existing headers and file */
 static int http1_sendfile(http_s *h, int fd, uintptr_t length,
                           uintptr_t offset) {
@@ -219,8 +346,103 @@ static int http1_sendfile(http_s *h, int fd, uintptr_t length,
   return 0;
 }
 
+#ifndef HTTP1_STREAM_PENDING
+/** Packets a streamed response may queue before `http_stream` waits. */
+#define HTTP1_STREAM_PENDING 4
+#endif
+
+#ifndef HTTP1_STREAM_TIMEOUT_MS
+/**
+ * Total time `http_stream` may wait for a slow client over the whole
+ * response. Past it the connection is dropped and the handler gets -1, so a
+ * stalled reader can't hold a worker thread (and a db connection) forever.
+ */
+#define HTTP1_STREAM_TIMEOUT_MS 10000
+#endif
+
+static uint64_t http1_monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** Should send existing headers and data and prepare for streaming */
+static int http1_stream(http_s *h, void *data, uintptr_t length) {
+  http1pr_s *p = handle2pr(h);
+  intptr_t uuid = p->p.uuid;
+
+  FIOBJ packet = FIOBJ_INVALID;
+  if (!p->streaming) {
+    /* the length is unknown, templates always splice one in */
+    fio_str_info_s v = fiobj_obj2cstr(h->version);
+    if (v.len > 7 && v.data[5] == '1' && v.data[6] == '.' && v.data[7] == '1') {
+      http_set_header2(h, (fio_str_info_s){.data = "transfer-encoding", .len = 17},
+                       (fio_str_info_s){.data = "chunked", .len = 7});
+      p->streaming = 1;
+    } else {
+      /* HTTP/1.0 has no chunks, the body ends with the connection */
+      http_set_header(h, HTTP_HEADER_CONNECTION, fiobj_dup(HTTP_HVALUE_CLOSE));
+      p->streaming = 2;
+    }
+    p->stream_waited_ms = 0;
+    packet = headers2str(h, length + 32);
+    if (!packet)
+      return -1;
+  } else {
+    packet = fiobj_str_buf(length + 32);
+  }
+
+  if (length) {
+    if (p->streaming == 1) {
+      /* fio_ltoa would prefix hex with 0x */
+      char num[24];
+      int len = snprintf(num, sizeof(num), "%lX\r\n", (unsigned long)length);
+      fiobj_str_write(packet, num, len);
+    }
+    fiobj_str_write(packet, data, length);
+    if (p->streaming == 1)
+      fiobj_str_write(packet, "\r\n", 2);
+  }
+  fiobj_send_free(uuid, packet);
+
+  /* backpressure: the handler waits for a slow client instead of queuing the
+   * whole body in memory, up to HTTP1_STREAM_TIMEOUT_MS in total */
+  if (fio_pending(uuid) <= HTTP1_STREAM_PENDING)
+    return fio_is_valid(uuid) ? 0 : -1;
+  uint64_t start = http1_monotonic_ms();
+  while (fio_pending(uuid) > HTTP1_STREAM_PENDING && fio_is_valid(uuid)) {
+    uint64_t waited = p->stream_waited_ms + (http1_monotonic_ms() - start);
+    if (waited >= HTTP1_STREAM_TIMEOUT_MS) {
+      fio_force_close(uuid);
+      return -1;
+    }
+    ssize_t flushed = fio_flush(uuid);
+    if (flushed < 0 && errno != EWOULDBLOCK)
+      break;
+    if (flushed) {
+      uint64_t left = HTTP1_STREAM_TIMEOUT_MS - waited;
+      struct pollfd pfd = {.fd = fio_uuid2fd(uuid), .events = POLLOUT};
+      poll(&pfd, 1, left < 100 ? (int)left : 100);
+    }
+  }
+  p->stream_waited_ms += http1_monotonic_ms() - start;
+  return fio_is_valid(uuid) ? 0 : -1;
+}
+
 /** Should send existing headers or complete streaming */
 static void htt1p_finish(http_s *h) {
+  http1pr_s *p = handle2pr(h);
+  if (p->streaming) {
+    /* the last chunk, or the close that ends an HTTP/1.0 body. A failed body
+     * closes without it, so the client can tell it was cut short */
+    if (h->status >= 500)
+      p->close = 1;
+    else if (p->streaming == 1)
+      fio_write(p->p.uuid, "0\r\n\r\n", 5);
+    p->streaming = 0;
+    http1_after_finish(h);
+    return;
+  }
   FIOBJ packet = headers2str(h, 0);
   if (packet)
     fiobj_send_free((handle2pr(h)->p.uuid), packet);
@@ -250,9 +472,10 @@ static int http1_push_file(http_s *h, FIOBJ filename, FIOBJ mime_type) {
  * Called befor a pause task,
  */
 static void http1_on_pause(http_s *h, http_fio_protocol_s *pr) {
+  /* the buffer is reused while the request waits */
+  http1_headers_load(h);
   ((http1pr_s *)pr)->stop = 1;
   fio_suspend(pr->uuid);
-  (void)h;
 }
 
 /**
@@ -266,6 +489,7 @@ static void http1_on_resume(http_s *h, http_fio_protocol_s *pr) {
 }
 
 static intptr_t http1_hijack(http_s *h, fio_str_info_s *leftover) {
+  http1_headers_load(h);
   if (leftover) {
     intptr_t len =
         handle2pr(h)->buf_len -
@@ -325,6 +549,7 @@ static int http1_http2websocket_server(http_s *h, websocket_settings_s *args) {
   static char ws_key_accpt_str[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
   static uintptr_t sec_version = 0;
   static uintptr_t sec_key = 0;
+  http1_headers_load(h);
   if (!sec_version)
     sec_version = fiobj_hash_string("sec-websocket-version", 21);
   if (!sec_key)
@@ -528,7 +753,9 @@ Virtual Table Decleration
 
 struct http_vtable_s HTTP1_VTABLE = {
     .http_send_body = http1_send_body,
+    .http_send_body2 = http1_send_body2,
     .http_sendfile = http1_sendfile,
+    .http_stream = http1_stream,
     .http_finish = htt1p_finish,
     .http_push_data = http1_push_data,
     .http_push_file = http1_push_file,
@@ -539,6 +766,8 @@ struct http_vtable_s HTTP1_VTABLE = {
     .http_upgrade2sse = http1_upgrade2sse,
     .http_sse_write = http1_sse_write,
     .http_sse_close = http1_sse_close,
+    .http_header_get = http1_header_get,
+    .http_headers_load = http1_headers_load,
 };
 
 void *http1_vtable(void) { return (void *)&HTTP1_VTABLE; }
@@ -568,6 +797,7 @@ static int http1_on_response(http1_parser_s *parser) {
 /** called when a request method is parsed. */
 static int http1_on_method(http1_parser_s *parser, char *method,
                            size_t method_len) {
+  parser2http(parser)->lazy_count = 0;
   http1_pr2handle(parser2http(parser)).method =
       fiobj_str_new(method, method_len);
   parser2http(parser)->header_size += method_len;
@@ -624,17 +854,29 @@ static int http1_on_header(http1_parser_s *parser, char *name, size_t name_len,
                      parser2http(parser)->p.settings);
     return -1;
   }
-  parser2http(parser)->header_size += name_len + data_len;
-  if (parser2http(parser)->header_size >=
-          parser2http(parser)->max_header_size ||
-      fiobj_hash_count(http1_pr2handle(parser2http(parser)).headers) >
+  http1pr_s *p = parser2http(parser);
+  p->header_size += name_len + data_len;
+  if (p->header_size >= p->max_header_size ||
+      p->lazy_count + fiobj_hash_count(http1_pr2handle(p).headers) >
           HTTP_MAX_HEADER_COUNT) {
-    if (parser2http(parser)->p.settings->log) {
+    if (p->p.settings->log) {
       FIO_LOG_WARNING("(HTTP) security alert - header flood detected.");
     }
-    http_send_error(&http1_pr2handle(parser2http(parser)), 413);
+    http_send_error(&http1_pr2handle(p), 413);
     return -1;
   }
+  /* record headers that live in the buffer, build the rest */
+  if (p->lazy && (uint8_t *)name >= p->buf && (uint8_t *)data >= p->buf &&
+      (uint8_t *)name + name_len <= p->buf + HTTP_MAX_HEADER_LENGTH &&
+      (uint8_t *)data + data_len <= p->buf + HTTP_MAX_HEADER_LENGTH) {
+    p->lazy_headers[p->lazy_count++] = (http1_lazy_header_s){
+        .name = name,
+        .value = data,
+        .name_len = (uint32_t)name_len,
+        .value_len = (uint32_t)data_len,
+    };
+    return 0;
+  }
   sym = fiobj_str_new(name, name_len);
   obj = fiobj_str_new(data, data_len);
   set_header_add(http1_pr2handle(parser2http(parser)).headers, sym, obj);
@@ -691,6 +933,10 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
     --pipeline_limit;
   } while (i && p->buf_len && pipeline_limit && !p->stop);
 
+  /* a request split between reads has headers in the bytes consumed */
+  if (org_len != p->buf_len)
+    http1_headers_load(&p->request);
+
   if (p->buf_len && org_len != p->buf_len) {
     memmove(p->buf, p->buf + (org_len - p->buf_len), p->buf_len);
   }
@@ -799,6 +1045,7 @@ fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
       .p.settings = settings,
       .max_header_size = settings->max_header_size,
       .is_client = settings->is_client,
+      .lazy = settings->lazy_headers && !settings->is_client,
   };
   http_s_new(&p->request, &p->p, &HTTP1_VTABLE);
   if (unread_data && unread_length <= HTTP_MAX_HEADER_LENGTH) {
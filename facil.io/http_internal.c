@@ -16,31 +16,29 @@ static uint64_t http_upgrade_hash = 0;
 /** Use this function to handle HTTP requests.*/
 void http_on_request_handler______internal(http_s *h,
                                            http_settings_s *settings) {
-  if (!http_upgrade_hash)
-    http_upgrade_hash = fiobj_hash_string("upgrade", 7);
   h->udata = settings->udata;
 
-  static uint64_t host_hash = 0;
-  if (!host_hash)
-    host_hash = fiobj_hash_string("host", 4);
-
   if (1) {
     /* test for Host header and avoid duplicates */
-    FIOBJ tmp = fiobj_hash_get2(h->headers, host_hash);
-    if (!tmp)
+    static uint64_t host_hash = 0;
+    if (!host_hash)
+      host_hash = fiobj_hash_string("host", 4);
+    if (!http_header_get(h, "host", 4).data)
       goto missing_host;
+    FIOBJ tmp = fiobj_hash_get2(h->headers, host_hash);
     if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY)) {
       fiobj_hash_set(h->headers, HTTP_HEADER_HOST, fiobj_ary_pop(tmp));
     }
   }
 
-  FIOBJ t = fiobj_hash_get2(h->headers, http_upgrade_hash);
-  if (t)
+  /* lookups don't materialize lazily recorded headers */
+  fio_str_info_s t = http_header_get(h, "upgrade", 7);
+  if (t.data)
     goto upgrade;
 
-  if (fiobj_iseq(
-          fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_ACCEPT)),
-          HTTP_HVALUE_SSE_MIME))
+  fio_str_info_s accept = http_header_get(h, "accept", 6);
+  fio_str_info_s sse = fiobj_obj2cstr(HTTP_HVALUE_SSE_MIME);
+  if (accept.len == sse.len && !memcmp(accept.data, sse.data, sse.len))
     goto eventsource;
   if (settings->public_folder) {
     fio_str_info_s path_str = fiobj_obj2cstr(h->path);
@@ -55,17 +53,20 @@ void http_on_request_handler______internal(http_s *h,
 
 upgrade:
   if (1) {
-    fiobj_dup(t); /* allow upgrade name access after http_finish */
-    fio_str_info_s val = fiobj_obj2cstr(t);
+    /* allow upgrade name access after http_finish */
+    FIOBJ name = fiobj_str_new(t.data, t.len);
+    fio_str_info_s val = fiobj_obj2cstr(name);
     if (val.data[0] == 'h' && val.data[1] == '2') {
       http_send_error(h, 400);
     } else {
+      http_headers_load(h);
       settings->on_upgrade(h, val.data, val.len);
     }
-    fiobj_free(t);
+    fiobj_free(name);
     return;
   }
 eventsource:
+  http_headers_load(h);
   settings->on_upgrade(h, (char *)"sse", 3);
   return;
 missing_host:
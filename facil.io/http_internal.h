@@ -28,6 +28,9 @@ typedef struct http_vtable_s http_vtable_s;
 struct http_vtable_s {
   /** Should send existing headers and data */
   int (*const http_send_body)(http_s *h, void *data, uintptr_t length);
+  /** Should send existing headers and data, taking ownership (optional) */
+  int (*const http_send_body2)(http_s *h, void *data, uintptr_t length,
+                               void (*dealloc)(void *));
   /** Should send existing headers and file */
   int (*const http_sendfile)(http_s *h, int fd, uintptr_t length,
                              uintptr_t offset);
@@ -56,6 +59,11 @@ struct http_vtable_s {
   int (*http_sse_write)(http_sse_s *sse, FIOBJ str);
   /** Closes an EventSource (SSE) connection. */
   int (*http_sse_close)(http_sse_s *sse);
+  /** Finds a request header, even if it wasn't loaded. (optional) */
+  fio_str_info_s (*http_header_get)(http_s *h, const char *name,
+                                    size_t name_len);
+  /** Loads lazily recorded request headers into `headers`. (optional) */
+  void (*http_headers_load)(http_s *h);
 };
 
 struct http_fio_protocol_s {
@@ -148,6 +156,18 @@ void http_on_response_handler______internal(http_s *h,
                                             http_settings_s *settings);
 int http_send_error2(size_t error, intptr_t uuid, http_settings_s *settings);
 
+/* *****************************************************************************
+Header Templates
+***************************************************************************** */
+
+struct http_template_s {
+  size_t len;
+  char block[];
+};
+
+/** Writes the cached Date header value (refreshed once a second) to `dest`. */
+void http_date_write(FIOBJ dest);
+
 /* *****************************************************************************
 EventSource Support (SSE)
 ***************************************************************************** */
@@ -194,6 +214,17 @@ static inline void http_sse_destroy(http_sse_internal_s *sse) {
 Helpers
 ***************************************************************************** */
 
+/** finds a header in a headers hash, the first value of repeated headers */
+static inline fio_str_info_s http_headers_find(FIOBJ hash, const char *name,
+                                               size_t name_len) {
+  FIOBJ tmp = fiobj_hash_get2(hash, fiobj_hash_string(name, name_len));
+  if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY))
+    tmp = fiobj_ary_index(tmp, 0);
+  if (!tmp)
+    return (fio_str_info_s){.len = 0, .data = NULL};
+  return fiobj_obj2cstr(tmp);
+}
+
 /** sets an outgoing header only if it doesn't exist */
 static inline void set_header_if_missing(FIOBJ hash, FIOBJ name, FIOBJ value) {
   FIOBJ old = fiobj_hash_replace(hash, name, value);
@@ -275,8 +275,9 @@ static void on_data(intptr_t sockfd, fio_protocol_s *ws_) {
   }
   ws->length = websocket_consume(ws->buffer.data, ws->length + len, ws,
                                  (~(ws->is_client) & 1));
-
-  fio_force_event(sockfd, FIO_EVENT_ON_DATA);
+  /* the reactor re-arms the socket unless `fio_suspend` was called, forcing
+   * the next read would ignore the suspension */
+  (void)sockfd;
 }
 
 static void on_data_first(intptr_t sockfd, fio_protocol_s *ws_) {
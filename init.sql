@@ -1,7 +1,9 @@
 create unlogged table clientes(
 	id int primary key,
 	limite bigint not null,
-	saldo bigint not null default 0
+	saldo bigint not null default 0,
+	taxa int not null default 0,		-- requests per second the api accepts for the client, 0 is unlimited
+	rajada int not null default 0		-- requests accepted at once, 0 is one second of taxa
 );
 
 -- default clients
@@ -36,6 +38,7 @@ create table transacoes_default partition of transacoes default;
 create index on transacoes (id);
 create index on transacoes (cliente);
 create index on transacoes (realizada_em desc);
+create index on transacoes (cliente, id desc);
 
 -- insert transaction
 create or replace procedure transar(cliente_in int, tipo_in boolean, valor_in int, descricao_in varchar(10))
@@ -65,4 +68,82 @@ $$
 begin
 	return query select t.valor, t.tipo, t.descricao, t.realizada_em from transacoes as t where t.cliente = cliente_in order by t.realizada_em desc limit 10;
 end
+$$;
+
+-- insert transaction and publish the balance delta to peer instances on the 'saldos' channel
+create or replace procedure transar_publicar(cliente_in int, tipo_in boolean, valor_in int, descricao_in varchar(10), origem_in varchar)
+language plpgsql as 
 $$
+begin
+	-- record transaction
+   	insert into transacoes(cliente, tipo, valor, descricao, realizada_em)
+    values (cliente_in, tipo_in, valor_in, descricao_in, now());
+
+	-- payload: origem:cliente:delta
+	perform pg_notify('saldos', origem_in || ':' || cliente_in || ':' || (case when tipo_in then valor_in else -valor_in end));
+end
+$$;
+
+-- insert a batch of transactions of one client in a single statement, arrays in the same order
+create or replace procedure transar_lote(cliente_in int, tipos_in boolean[], valores_in int[], descricoes_in varchar(10)[])
+language plpgsql as 
+$$
+begin
+	-- record transactions
+	insert into transacoes(cliente, tipo, valor, descricao, realizada_em)
+	select cliente_in, t.tipo, t.valor, t.descricao, now() from unnest(tipos_in, valores_in, descricoes_in) as t(tipo, valor, descricao);
+end
+$$;
+
+-- insert a batch of transactions and publish the summed balance delta to peer instances, see transar_publicar
+create or replace procedure transar_lote_publicar(cliente_in int, tipos_in boolean[], valores_in int[], descricoes_in varchar(10)[], origem_in varchar)
+language plpgsql as 
+$$
+declare
+	delta bigint;
+begin
+	-- record transactions
+	insert into transacoes(cliente, tipo, valor, descricao, realizada_em)
+	select cliente_in, t.tipo, t.valor, t.descricao, now() from unnest(tipos_in, valores_in, descricoes_in) as t(tipo, valor, descricao);
+
+	-- payload: origem:cliente:delta
+	select coalesce(sum(case when t.tipo then t.valor else -t.valor end), 0) into delta from unnest(tipos_in, valores_in) as t(tipo, valor);
+	perform pg_notify('saldos', origem_in || ':' || cliente_in || ':' || delta);
+end
+$$;
+
+-- apply a batch of signed valores in order under the limit check, with one saldo update and one insert.
+-- One row per item, novo_saldo is null for the ones over the limit. Same rule as the api cache: a debit must leave the saldo above -limite
+create or replace function transar_lote_atomico(cliente_in int, valores_in int[], descricoes_in varchar(10)[]) returns table(novo_saldo bigint, novo_limite bigint)
+language plpgsql as
+$$
+declare
+	saldo_atual bigint;
+	limite_atual bigint;
+	aceitas int[] := '{}';
+begin
+	-- the row stays locked until the batch commits
+	select c.saldo, c.limite into saldo_atual, limite_atual from clientes as c where c.id = cliente_in for update;
+	if not found then
+		return;
+	end if;
+
+	for i in 1 .. coalesce(array_length(valores_in, 1), 0) loop
+		if valores_in[i] >= 0 or saldo_atual + valores_in[i] > -limite_atual then
+			saldo_atual := saldo_atual + valores_in[i];
+			aceitas := aceitas || i;
+			novo_saldo := saldo_atual;
+		else
+			novo_saldo := null;
+		end if;
+
+		novo_limite := limite_atual;
+		return next;
+	end loop;
+
+	update clientes set saldo = saldo_atual where id = cliente_in;
+
+	insert into transacoes(cliente, tipo, valor, descricao, realizada_em)
+	select cliente_in, valores_in[a.pos] > 0, abs(valores_in[a.pos]), descricoes_in[a.pos], now() from unnest(aceitas) as a(pos);
+end
+$$;
@@ -1,15 +1,23 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "facil.io/http.h"
 #include "src/string+.h"
 #include "src/varenv.h"
 #include "src/utils.h"
 #include "src/db.h"
+#include "src/proxy.h"
 #include "models/cliente.h"
 #include "models/context.h"
 #include "controllers/cliente.h"
+#include "controllers/coerencia.h"
+#include "controllers/cluster.h"
+#include "controllers/canal.h"
+#include "controllers/binario.h"
 
 // global context
 ctx_t ctx = {0};
@@ -26,16 +34,75 @@ int main(int argq, char **argv, char **envp){
 	char *workers_env = getenv("SERVER_WORKERS");
 	char *threads_env = getenv("SERVER_THREADS");
 	char *conns_env = getenv("SERVER_DB_CONNS");
+	char *coherence_env = getenv("SERVER_COHERENCE");
+	char *consistency_env = getenv("SERVER_CONSISTENCY");
+	char *vendor_env = getenv("DB_VENDOR");
+	char *latency_env = getenv("DB_LATENCY_US");
+	char *cache_env = getenv("DB_CACHE_ENTRIES");
+	char *lazy_env = getenv("SERVER_LAZY_HEADERS");
+	char *unix_env = getenv("SERVER_UNIX_SOCKET");
+	char *cluster_env = getenv("SERVER_CLUSTER");
+	char *self_env = getenv("SERVER_SELF");
+	char *binary_env = getenv("SERVER_BINARY_PORT");
+	char *admission_env = getenv("SERVER_ADMISSION_MS");
+	char *admission_queue_env = getenv("SERVER_ADMISSION_QUEUE");
+	char *stream_slots_env = getenv("SERVER_STREAM_SLOTS");
+	char *deadline_env = getenv("SERVER_DEADLINE_MS");
+	char *trace_env = getenv("SERVER_TRACE_SAMPLE");
 	int threads = atoi(threads_env);
-	int conns = atoi(conns_env);
 	int workers = atoi(workers_env);
+	char *upstream_env = getenv("PROXY_UPSTREAM_CONNS");
+	int upstream = upstream_env != NULL && atoi(upstream_env) > 0 ? atoi(upstream_env) : 32;
+
+	// load balancer mode: no db, requests go to the api instances
+	char *backends_env = getenv("PROXY_BACKENDS");
+	if(backends_env != NULL && *backends_env != 0){
+		proxy_t *proxy = proxy_new(backends_env, upstream);
+		if(proxy == NULL){
+			printf("Invalid PROXY_BACKENDS [%s]\n", backends_env);
+			exit(1);
+		}
+
+		if(port == NULL || !proxy_listen(proxy, port)){
+			printf("Could not listen on port [%s]\n", port);
+			exit(1);
+		}
+
+		// clients stay on their api while it is down, unless the apis keep the saldo in the db
+		char *failover_env = getenv("PROXY_FAILOVER");
+		if(failover_env != NULL && atoi(failover_env))
+			proxy_set_failover(proxy, true);
+
+		printf("Load balancer with [%zu] backends, [%d] connections each\n", proxy_backends(proxy), upstream);
+		printf("Failover: [%s]\n", failover_env != NULL && atoi(failover_env) ? "on" : "off");
+		printf("Io engine: [%s]\n", fio_engine());
+		printf("Load balancer listening on port: [%s]\n", port);
+		fio_start(.threads = threads, .workers = workers);
+
+		printf("Stopping load balancer...\n");
+		proxy_destroy(proxy);
+		return 0;
+	}
+
+	int conns = atoi(conns_env);
+
+	// postgres, the in memory mock to profile the webserver alone, or the embedded log storage
+	db_vendor_t vendor = db_vendor_postgres;
+	char *database = getenv("DB_DATABASE");
+	if(vendor_env != NULL && strcmp(vendor_env, "memory") == 0)
+		vendor = db_vendor_memory;
+
+	if(vendor_env != NULL && strcmp(vendor_env, "log") == 0){
+		vendor = db_vendor_log;
+		database = getenv("DB_LOG_DIR") != NULL ? getenv("DB_LOG_DIR") : "dados";
+	}
 
 	// db connection
 	db_t **db = &ctx.db;
-	*db = db_create(db_vendor_postgres, conns,
+	*db = db_create(vendor, conns,
 		getenv("DB_HOST"),
 		getenv("DB_PORT"),
-		getenv("DB_DATABASE"),
+		database,
 		getenv("DB_USER"),
 		getenv("DB_PASSWORD"),
 		getenv("DB_ROLE"),
@@ -47,7 +114,10 @@ int main(int argq, char **argv, char **envp){
 		exit(2);
 	}
 
-	printf("Creating postgres connections [%d]\n", conns);
+	if(latency_env != NULL)
+		db_set_latency(*db, strtoull(latency_env, NULL, 10));
+
+	printf("Creating %s connections [%d]\n", vendor_env != NULL ? vendor_env : "postgres", conns);
 	db_connect(*db);
 
 	bool wait = true;
@@ -58,7 +128,7 @@ int main(int argq, char **argv, char **envp){
 
 			case db_state_invalid_db:
 			case db_state_failed_connection:
-				printf("Failed to create connections to postgres db\n");
+				printf("Failed to create connections to the db\n");
 				db_destroy(*db);
 				exit(1);
 				break;
@@ -69,21 +139,163 @@ int main(int argq, char **argv, char **envp){
 		}
 	}
 
-	printf("Postgres connections up!\n");
+	printf("Db connections up!\n");
+
+	// saldo source of truth
+	if(consistency_env != NULL && strcmp(consistency_env, "db") == 0){
+		if(clientes_prepare(*db) != db_error_ok || transa_prepare(*db) != db_error_ok){
+			printf("Could not prepare statements for db consistency mode\n");
+			db_destroy(*db);
+			exit(1);
+		}
+
+		ctx.consistencia = consistencia_db;
+		printf("Saldo consistency: [db]\n");
+	}
+	else{
+		printf("Saldo consistency: [cache]\n");
+	}
+
+	// extrato results cache, invalidated by writes of this instance and, with coherence, of its peers
+	if(cache_env != NULL && atoi(cache_env) > 0){
+		db_cache_enable(*db, atoi(cache_env));
+		printf("Db result cache: [%d] entries\n", atoi(cache_env));
+	}
 
 	// clientes
 	clientes_init(*db, &(ctx.clientes));
 
+	// db calls of a request are cancelled once it runs out of time
+	if(deadline_env != NULL && atoi(deadline_env) > 0){
+		ctx.deadline_us = atoi(deadline_env) * 1000ull;
+		printf("Request deadline: [%d] ms\n", atoi(deadline_env));
+	}
+
+	// load shedding: one slot per connection, requests that would wait past the budget get 503.
+	// History streams get their own few slots, so slow readers can't take every connection
+	if(admission_env != NULL && atoi(admission_env) > 0){
+		int streams = stream_slots_env != NULL && atoi(stream_slots_env) > 0 ? atoi(stream_slots_env) : (conns / 4 > 0 ? conns / 4 : 1);
+		int slots = conns > streams ? conns - streams : 1;
+		size_t queue = admission_queue_env != NULL && atoi(admission_queue_env) > 0 ? atoi(admission_queue_env) : conns * 4;
+		ctx.admission = admission_new(slots, queue, atoi(admission_env) * 1000ull);
+		ctx.admission_streams = admission_new(streams, streams * 4, atoi(admission_env) * 1000ull);
+		printf("Admission control: [%d] slots, [%zu] queued, [%d] ms budget\n", slots, queue, atoi(admission_env));
+		printf("Stream admission: [%d] slots, [%d] queued\n", streams, streams * 4);
+	}
+
+	// cache coherence between instances, not needed when the db holds the saldo
+	if(ctx.consistencia == consistencia_cache && coherence_env != NULL && atoi(coherence_env)){
+		if(!coerencia_init(*db)){
+			printf("Could not listen for saldo changes on postgres\n");
+			db_destroy(*db);
+			exit(1);
+		}
+
+		ctx.coerencia = true;
+		printf("Saldo coherence enabled\n");
+	}
+
+	// client ownership between instances: requests for clients owned by a peer are forwarded to it
+	if(cluster_env != NULL && *cluster_env != 0){
+		if(!cluster_init(cluster_env, self_env, upstream)){
+			printf("Invalid SERVER_CLUSTER [%s] or SERVER_SELF [%s] not in it\n", cluster_env, self_env);
+			db_destroy(*db);
+			exit(1);
+		}
+
+		printf("Cluster with [%zu] instances, self: [%s]\n", proxy_backends(ctx.cluster), self_env);
+	}
+
+	// latency histograms, one set per thread, summed on GET /metrics
+	metricas_init(*db);
+
+	// phase spans of 1 in N requests, dumped on GET /trace
+	if(trace_env != NULL && atoi(trace_env) > 0){
+		trace_init(atoi(trace_env));
+		printf("Tracing 1 in [%d] requests\n", atoi(trace_env));
+	}
+
 	// webserver setup
-	http_listen(port, NULL, .on_request = cliente_request, .log = false);
+	// handlers never read request headers, only build them on lookup
+	bool lazy_headers = lazy_env == NULL || atoi(lazy_env);
+	cliente_init();
+	http_settings_s settings = {.on_request = cliente_request, .on_upgrade = cliente_upgrade, .on_sent = metricas_request, .log = false, .lazy_headers = lazy_headers};
+
+	// tcp port, unix socket for a proxy on the same host, or both
+	bool tcp = port != NULL && *port != 0;
+	bool unix_socket = unix_env != NULL && *unix_env != 0;
+	if(!tcp && !unix_socket){
+		printf("Set SERVER_PORT and/or SERVER_UNIX_SOCKET\n");
+		db_destroy(*db);
+		exit(1);
+	}
+
+	if(tcp && (http_listen)(port, NULL, settings) == -1){
+		printf("Could not listen on port [%s]\n", port);
+		db_destroy(*db);
+		exit(1);
+	}
+
+	// a stale socket file is replaced on bind
+	if(unix_socket){
+		if((http_listen)(NULL, unix_env, settings) == -1){
+			printf("Could not listen on unix socket [%s]\n", unix_env);
+			db_destroy(*db);
+			exit(1);
+		}
+
+		// the proxy usually runs as another user
+		if(chmod(unix_env, 0666) != 0)
+			printf("Could not chmod unix socket [%s]\n", unix_env);
+	}
+
+	// binary frames for internal callers
+	bool binary = binary_env != NULL && *binary_env != 0;
+	if(binary && !binario_listen(binary_env)){
+		printf("Could not listen on binary port [%s]\n", binary_env);
+		db_destroy(*db);
+		exit(1);
+	}
 
 	printf("Starting webserver with [%d] threads\n", threads);
-	printf("Webserver listening on port: [%s]\n", port);
+	printf("Io engine: [%s]\n", fio_engine());
+	if(tcp)
+		printf("Webserver listening on port: [%s]\n", port);
+	if(unix_socket)
+		printf("Webserver listening on unix socket: [%s]\n", unix_env);
+	if(binary)
+		printf("Binary protocol listening on port: [%s]\n", binary_env);
 	fio_start(.threads = threads, .workers = workers);
 
 	printf("Stopping server...\n");
 
+	if(unix_socket)
+		unlink(unix_env);
+
+	if((*db)->cache != NULL){
+		db_cache_stats_t stats = db_cache_stats(*db);
+		printf("Db result cache: [%lu] hits, [%lu] misses, [%lu] invalidations, [%zu] entries, [%zu] bytes\n", stats.hits, stats.misses, stats.invalidations, stats.entries, stats.bytes);
+	}
+
+	printf("Coalesced extrato requests: [%zu]\n", voo_coalescidas_total());
+
+	if(ctx.admission != NULL){
+		admission_stats_t stats = admission_stats(ctx.admission);
+		printf("Admission control: [%lu] admitted, [%lu] after queueing, [%lu] shed, [%lu] us average service\n", stats.admitted, stats.queued, stats.shed, stats.service_us);
+	}
+
+	if(ctx.admission_streams != NULL){
+		admission_stats_t stats = admission_stats(ctx.admission_streams);
+		printf("Stream admission: [%lu] admitted, [%lu] after queueing, [%lu] shed, [%lu] us average service\n", stats.admitted, stats.queued, stats.shed, stats.service_us);
+	}
+
 	db_destroy(*db);
+	proxy_destroy(ctx.cluster);
+	admission_destroy(ctx.admission);
+	admission_destroy(ctx.admission_streams);
+	http_template_free(cliente_headers);
+	metrics_destroy();
+	trace_destroy();
 
 	return 0;
 }
@@ -3,36 +3,92 @@
 
 #include <stdint.h>
 #include <pthread.h>
+#include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "../src/db.h"
+#include "../src/trace.h"
 
 typedef struct{
 	int64_t limite;
 	int64_t saldo;
+	uint64_t versao;						// bumped on every saldo change, see clientes_tocar()
+	uint32_t taxa;							// requests per second, 0 is unlimited
+	uint32_t rajada;						// bucket size, requests allowed at once
+	uint64_t balde;							// ms of the last take << 32 | milli tokens left, see clientes_consumir()
 }cliente_t;
 
 typedef struct{
 	cliente_t cliente[6];
 	pthread_mutex_t clientes_lock;
+	uint64_t contencoes;					// times the lock was already held, see clientes_travar()
+	uint64_t espera_ns;						// time spent waiting for it
 }clientes_t;
 
+#define CLIENTES_TAG_LEN 32
+#define CLIENTES_RAJADA_MAX 4000000			// bucket size limit, in requests
+#define CLIENTES_ATRASO_MS 60000			// a reading this far behind the bucket's is an older one from another thread, not a wrap
+
+// bucket clock: ms of a wall clock reading, the reactor's cached tick on requests, wrapping at 32 bits like the time in the bucket
+static inline uint32_t clientes_ms(struct timespec ts){
+	return (uint32_t)(ts.tv_sec * 1000ull + ts.tv_nsec / 1000000);
+}
+
+// result cache tag of everything read about a cliente, see db_exec_cached()
+void clientes_tag(char *tag, int id){
+	snprintf(tag, CLIENTES_TAG_LEN, "cliente:%d", id);
+}
+
+// take the cache lock, traced as the saldo lock phase. Only a busy lock pays for the clock reads that measure the contention
+static inline void clientes_travar(clientes_t *clientes){
+	uint64_t trace = trace_start();
+	if(pthread_mutex_trylock(&(clientes->clientes_lock)) == 0){
+		trace_span("saldo lock", trace);
+		return;
+	}
+
+	struct timespec inicio, fim;
+	clock_gettime(CLOCK_MONOTONIC, &inicio);
+	pthread_mutex_lock(&(clientes->clientes_lock));
+	clock_gettime(CLOCK_MONOTONIC, &fim);
+
+	__atomic_add_fetch(&(clientes->contencoes), 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(clientes->espera_ns), (fim.tv_sec - inicio.tv_sec) * 1000000000ull + fim.tv_nsec - inicio.tv_nsec, __ATOMIC_RELAXED);
+	trace_span("saldo lock", trace);
+}
+
 void clientes_init(db_t *db, clientes_t *clientes){
 	// cache mutex
 	pthread_mutex_init(&(clientes->clientes_lock), NULL);
 
 	// from db
-	char *query = "select id, limite, saldo from clientes";
+	char *query = "select id, limite, saldo, taxa, rajada from clientes";
 
 	db_results_t *res = db_exec(db, query, 0);
 	if(res->code != db_error_ok){
 		printf("%s", res->msg);
 	}
 	else{
+		// same clock as the reactor's tick, read once before the reactor runs
+		struct timespec agora;
+		clock_gettime(CLOCK_REALTIME, &agora);
+
 		for(int64_t i = 0; i < res->entries_count; i++){
 			int id = db_read_field(res, i, 0).value.as_int;
 			clientes->cliente[id].limite = db_read_field(res, i, 1).value.as_int;
 			clientes->cliente[id].saldo  = db_read_field(res, i, 2).value.as_int;
+
+			// rate limit, the bucket holds a second of requests unless told otherwise. Starts full, as of now
+			int64_t taxa = db_read_field(res, i, 3).value.as_int;
+			int64_t rajada = db_read_field(res, i, 4).value.as_int;
+			if(rajada <= 0)
+				rajada = taxa > 0 ? taxa : 1;
+
+			// the milli tokens must fit 32 bits
+			clientes->cliente[id].taxa = taxa > 0 ? (taxa < CLIENTES_RAJADA_MAX ? taxa : CLIENTES_RAJADA_MAX) : 0;
+			clientes->cliente[id].rajada = rajada < CLIENTES_RAJADA_MAX ? rajada : CLIENTES_RAJADA_MAX;
+			clientes->cliente[id].balde = (uint64_t)clientes_ms(agora) << 32 | (uint64_t)clientes->cliente[id].rajada * 1000;
 		}
 	}
 
@@ -40,27 +96,30 @@ void clientes_init(db_t *db, clientes_t *clientes){
 }
 
 cliente_t clientes_get_cached(clientes_t *clientes, int id){
-	pthread_mutex_lock(&(clientes->clientes_lock));
+	clientes_travar(clientes);
 	cliente_t c = clientes->cliente[id];
 	pthread_mutex_unlock(&(clientes->clientes_lock));
 	return c;
 }
 
 int64_t clientes_creditar(clientes_t *clientes, int id, int64_t valor){
-	pthread_mutex_lock(&(clientes->clientes_lock));
+	clientes_travar(clientes);
 	int64_t saldo = clientes->cliente[id].saldo + valor;
 	clientes->cliente[id].saldo = saldo;
+	clientes->cliente[id].versao++;
 	pthread_mutex_unlock(&(clientes->clientes_lock));
 
 	return saldo;
 }
 
 int64_t clientes_debitar(clientes_t *clientes, int id, int64_t valor){
-	pthread_mutex_lock(&(clientes->clientes_lock));
+	clientes_travar(clientes);
 
 	int64_t saldo = clientes->cliente[id].saldo - valor;
-	if(saldo > -clientes->cliente[id].limite)
+	if(saldo > -clientes->cliente[id].limite){
 		clientes->cliente[id].saldo = saldo;
+		clientes->cliente[id].versao++;
+	}
 	else
 		saldo = INT64_MIN;
 
@@ -69,6 +128,75 @@ int64_t clientes_debitar(clientes_t *clientes, int id, int64_t valor){
 	return saldo;
 }
 
+// apply signed valores in order under a single lock, same limit check as clientes_debitar. saldos gets the saldo after each one, INT64_MIN when refused
+void clientes_lote(clientes_t *clientes, int id, size_t count, const int64_t *valores, int64_t *saldos){
+	clientes_travar(clientes);
+
+	cliente_t *c = &(clientes->cliente[id]);
+	for(size_t i = 0; i < count; i++){
+		int64_t saldo = c->saldo + valores[i];
+		if(valores[i] >= 0 || saldo > -c->limite){
+			c->saldo = saldo;
+			c->versao++;
+			saldos[i] = saldo;
+		}
+		else
+			saldos[i] = INT64_MIN;
+	}
+
+	pthread_mutex_unlock(&(clientes->clientes_lock));
+}
+
+// apply saldo delta received from a peer instance. No limit check, the peer already did it
+void clientes_aplicar(clientes_t *clientes, int id, int64_t delta){
+	clientes_travar(clientes);
+	clientes->cliente[id].saldo += delta;
+	clientes->cliente[id].versao++;
+	pthread_mutex_unlock(&(clientes->clientes_lock));
+}
+
+// bump the version without a saldo change, e.g. once the transaction of a change is recorded
+void clientes_tocar(clientes_t *clientes, int id){
+	clientes_travar(clientes);
+	clientes->cliente[id].versao++;
+	pthread_mutex_unlock(&(clientes->clientes_lock));
+}
+
+// take a token from the client's bucket, false when it is empty. agora_ms comes from clientes_ms(), wrapping is fine.
+// Lock free: the bucket is refilled lazily from the elapsed time, tokens and time swap together in one compare and swap
+bool clientes_consumir(clientes_t *clientes, int id, uint32_t agora_ms){
+	cliente_t *c = &(clientes->cliente[id]);
+	if(c->taxa == 0)
+		return true;
+
+	uint64_t cheio = (uint64_t)c->rajada * 1000;
+	uint64_t balde = __atomic_load_n(&(c->balde), __ATOMIC_RELAXED);
+	for(;;){
+		uint32_t antes = balde >> 32;
+		uint64_t fichas = balde & UINT32_MAX;
+
+		// unsigned, so the wrap counts as time passing. A thread with an older reading doesn't move the clock back
+		uint32_t passou = agora_ms - antes;
+		if(passou > UINT32_MAX - CLIENTES_ATRASO_MS)
+			passou = 0;
+		uint32_t tempo = passou > 0 ? agora_ms : antes;
+
+		// taxa tokens per second are taxa milli tokens per ms
+		if(passou > 0)
+			fichas += (uint64_t)passou * c->taxa;
+		if(fichas > cheio)
+			fichas = cheio;
+
+		// refused requests leave the bucket alone, the refill keeps counting from antes
+		if(fichas < 1000)
+			return false;
+
+		uint64_t novo = (uint64_t)tempo << 32 | (fichas - 1000);
+		if(__atomic_compare_exchange_n(&(c->balde), &balde, novo, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			return true;
+	}
+}
+
 db_results_t *clientes_update(db_t *db, int id, int64_t saldo){
 	char *query = "call saldar($1, $2)";
 
@@ -81,4 +209,60 @@ db_results_t *clientes_update(db_t *db, int id, int64_t saldo){
 	);
 }
 
+// prepare statements used when the db is the source of truth for saldo
+db_error_t clientes_prepare(db_t *db){
+	// saldo update under the limit check and transaction insert, in a single statement.
+	// No row returned means limit exceeded. $2 is the signed valor, $4 the tipo (true for credit). Same limit rule as clientes_debitar()
+	char *query = 
+		"with c as ("
+			"update clientes set saldo = saldo + $2 "
+			"where id = $1 and ($4 or saldo + $2 > -limite) "
+			"returning saldo, limite"
+		"), t as ("
+			"insert into transacoes(cliente, tipo, valor, descricao, realizada_em) "
+			"select $1, $4, abs($2), $3, now() from c"
+		") "
+		"select saldo, limite from c";
+
+	db_error_t code = db_prepare(db, "clientes_transar", query, 4);
+	if(code != db_error_ok)
+		return code;
+
+	// batch in order with one saldo update and one insert, see transar_lote_atomico in init.sql. $2 are the signed valores
+	query = "select novo_saldo, novo_limite from transar_lote_atomico($1, $2, $3)";
+
+	return db_prepare(db, "clientes_transar_lote", query, 3);
+}
+
+// atomic transaction on the db, valor signed by tipo. returns saldo and limite, or no entries if limit exceeded
+db_results_t *clientes_transar(db_t *db, int id, int64_t valor, bool credito, char *descricao){
+	db_results_t *res = db_exec_prepared(db, "clientes_transar", 4,
+		db_param_integer(id),
+		db_param_integer(credito ? valor : -valor),
+		db_param_string(descricao, strlen(descricao)),
+		db_param_bool(credito)
+	);
+
+	char tag[CLIENTES_TAG_LEN];
+	clientes_tag(tag, id);
+	db_cache_invalidate(db, tag);
+
+	return res;
+}
+
+// atomic batch on the db. One row per valor with saldo and limite, saldo is null when it was over the limit
+db_results_t *clientes_transar_lote(db_t *db, int id, size_t count, int64_t *valores, char **descricoes){
+	db_results_t *res = db_exec_prepared(db, "clientes_transar_lote", 3,
+		db_param_integer(id),
+		db_param_integer_array(valores, count),
+		db_param_string_array(descricoes, count)
+	);
+
+	char tag[CLIENTES_TAG_LEN];
+	clientes_tag(tag, id);
+	db_cache_invalidate(db, tag);
+
+	return res;
+}
+
 #endif
\ No newline at end of file
@@ -3,13 +3,30 @@
 
 #include <stdint.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include "cliente.h"
 #include "../src/db.h"
+#include "../src/proxy.h"
+#include "../src/admission.h"
+
+// where the saldo source of truth lives
+typedef enum{
+	consistencia_cache = 0,							// in process cache, requires sticky routing per client
+	consistencia_db									// db, atomic update per transaction
+}consistencia_t;
 
 // app context
 typedef struct{
 	db_t *db;
+	consistencia_t consistencia;
 	clientes_t clientes;
+	bool coerencia;
+	char origem[32];
+	proxy_t *cluster;								// client ownership ring, NULL outside a cluster
+	int cluster_self;
+	admission_t *admission;							// gate in front of db work, NULL when disabled
+	admission_t *admission_streams;					// gate of the history streams, which hold a connection while the client reads
+	uint64_t deadline_us;							// time a request has for its db work, 0 for none
 }ctx_t;
 
 extern ctx_t ctx;
@@ -4,6 +4,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "../src/db.h"
+#include "cliente.h"
+
+// export formats, see transa_exportar()
+typedef enum{
+	transa_formato_csv = 0,
+	transa_formato_ndjson
+}transa_formato_t;
 
 typedef struct{
 	int cliente;
@@ -20,12 +27,74 @@ db_results_t * transa_insert(db_t *db, int cliente, bool tipo, int valor, char *
 	// 	"insert into transacoes(cliente, tipo, valor, descricao, realizada_em) "
 	// 	"values ($1, $2, $3, $4, now())";
 
-	return db_exec(db, query, 4,
+	db_results_t *res = db_exec(db, query, 4,
 		db_param_integer(cliente),
 		db_param_bool(tipo),
 		db_param_integer(valor),
 		db_param_string(descricao, strlen(descricao))
 	);
+
+	char tag[CLIENTES_TAG_LEN];
+	clientes_tag(tag, cliente);
+	db_cache_invalidate(db, tag);
+
+	return res;
+}
+
+// insert transaction and notify peers of the saldo delta, see transar_publicar in init.sql
+db_results_t *transa_insert_publicar(db_t *db, int cliente, bool tipo, int valor, char *descricao, char *origem){
+	char *query = "call transar_publicar($1, $2, $3, $4, $5)";
+
+	db_results_t *res = db_exec(db, query, 5,
+		db_param_integer(cliente),
+		db_param_bool(tipo),
+		db_param_integer(valor),
+		db_param_string(descricao, strlen(descricao)),
+		db_param_string(origem, strlen(origem))
+	);
+
+	char tag[CLIENTES_TAG_LEN];
+	clientes_tag(tag, cliente);
+	db_cache_invalidate(db, tag);
+
+	return res;
+}
+
+// insert a batch of transactions in one statement, see transar_lote in init.sql
+db_results_t *transa_insert_lote(db_t *db, int cliente, size_t count, bool *tipos, int64_t *valores, char **descricoes){
+	char *query = "call transar_lote($1, $2, $3, $4)";
+
+	db_results_t *res = db_exec(db, query, 4,
+		db_param_integer(cliente),
+		db_param_bool_array(tipos, count),
+		db_param_integer_array(valores, count),
+		db_param_string_array(descricoes, count)
+	);
+
+	char tag[CLIENTES_TAG_LEN];
+	clientes_tag(tag, cliente);
+	db_cache_invalidate(db, tag);
+
+	return res;
+}
+
+// insert a batch of transactions and notify peers of the summed saldo delta
+db_results_t *transa_insert_lote_publicar(db_t *db, int cliente, size_t count, bool *tipos, int64_t *valores, char **descricoes, char *origem){
+	char *query = "call transar_lote_publicar($1, $2, $3, $4, $5)";
+
+	db_results_t *res = db_exec(db, query, 5,
+		db_param_integer(cliente),
+		db_param_bool_array(tipos, count),
+		db_param_integer_array(valores, count),
+		db_param_string_array(descricoes, count),
+		db_param_string(origem, strlen(origem))
+	);
+
+	char tag[CLIENTES_TAG_LEN];
+	clientes_tag(tag, cliente);
+	db_cache_invalidate(db, tag);
+
+	return res;
 }
 
 db_results_t *transa_extrato(db_t *db, int cliente){
@@ -35,7 +104,64 @@ db_results_t *transa_extrato(db_t *db, int cliente){
 	// 	"select t.valor, t.tipo, t.descricao, t.realizada_em from "
 	// 	"transacoes as t where t.cliente = $1 order by t.realizada_em desc limit 10";
 
-	return db_exec(db, query, 1,
+	char tag[CLIENTES_TAG_LEN];
+	clientes_tag(tag, cliente);
+
+	return db_exec_cached(db, tag, query, 1,
+		db_param_integer(cliente)
+	);
+}
+
+// transactions of cliente with id below antes_de, newest first, at most limite. Rows go to cb as they arrive, see db_stream()
+db_results_t *transa_historico(db_t *db, int cliente, int64_t antes_de, int64_t limite, db_row_cb cb, void *udata){
+	char *query = 
+		"select id, valor, tipo, descricao, realizada_em from transacoes where cliente = $1 and id < $2 "
+		"order by id desc limit $3";
+
+	return db_stream(db, cb, udata, query, 3,
+		db_param_integer(cliente),
+		db_param_integer(antes_de),
+		db_param_integer(limite)
+	);
+}
+
+// every transaction of cliente, oldest first, relayed to cb as the db writes it. See db_copy_out()
+db_results_t *transa_exportar(db_t *db, int cliente, transa_formato_t formato, db_copy_cb cb, void *udata){
+	const char *rows =
+		"select id, valor, case when tipo then 'c' else 'd' end as tipo, descricao, realizada_em "
+		"from transacoes where cliente = %d order by id";
+
+	// one json per line. Quote and delimiter are bytes json never has, so csv leaves the lines untouched (text format would escape backslashes)
+	const char *copy = formato == transa_formato_ndjson ?
+		"copy (select row_to_json(t) from (%s) as t) to stdout with (format csv, quote e'\\x01', delimiter e'\\x02')" :
+		"copy (%s) to stdout with (format csv, header)";
+
+	// copy takes no params, cliente is an int
+	char select[256];
+	char query[512];
+	snprintf(select, sizeof(select), rows, cliente);
+	snprintf(query, sizeof(query), copy, select);
+
+	return db_copy_out(db, query, cb, udata);
+}
+
+// prepare statements used when the db is the source of truth for saldo
+db_error_t transa_prepare(db_t *db){
+	// saldo, limite and last transactions in one round trip. Clients without transactions get a single row with null transaction fields
+	char *query = 
+		"select c.saldo, c.limite, e.valor, e.tipo, e.descricao, e.realizada_em "
+		"from clientes as c left join extrato(c.id) as e on true "
+		"where c.id = $1 order by e.realizada_em desc";
+
+	return db_prepare(db, "transa_extrato_saldo", query, 1);
+}
+
+// saldo, limite and extrato from the db
+db_results_t *transa_extrato_saldo(db_t *db, int cliente){
+	char tag[CLIENTES_TAG_LEN];
+	clientes_tag(tag, cliente);
+
+	return db_exec_prepared_cached(db, tag, "transa_extrato_saldo", 1,
 		db_param_integer(cliente)
 	);
 }
@@ -0,0 +1,224 @@
+#include "admission.h"
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+// ------------------------------------------------------------ Types --------------------------------------------------------------
+
+// request in the queue, until a slot or its budget comes
+typedef struct admission_waiter_t{
+	struct admission_waiter_t *next;
+	uint64_t deadline_us;
+	admission_ready_cb on_ready;
+	void *udata;
+}admission_waiter_t;
+
+// waiters of one priority, oldest first
+typedef struct{
+	admission_waiter_t *head;
+	admission_waiter_t **tail;
+	size_t count;
+}admission_queue_t;
+
+struct admission_t{
+	pthread_mutex_t lock;
+	admission_queue_t high;					// writes are handed slots first
+	admission_queue_t low;
+	size_t slots;
+	size_t running;
+	size_t queue;
+	uint64_t budget_us;
+	admission_stats_t stats;
+};
+
+// ------------------------------------------------------------ Helpers ------------------------------------------------------------
+
+static uint64_t admission_now_us(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+// a free slot this request may take: low priority ones never pass a waiting write
+static bool admission_free(admission_t *admission, bool high){
+	return admission->running < admission->slots && (high || admission->high.count == 0);
+}
+
+// wait expected for a request entering the queue now, from the slots ahead of it
+static uint64_t admission_expected_us(admission_t *admission, bool high){
+	size_t ahead = admission->high.count + (high ? 0 : admission->low.count);
+	return (ahead / admission->slots + 1) * admission->stats.service_us;
+}
+
+static uint32_t admission_retry_after(uint64_t wait_us){
+	uint32_t secs = (wait_us + 999999) / 1000000;
+	return secs > 0 ? secs : 1;
+}
+
+static void admission_push(admission_queue_t *queue, admission_waiter_t *waiter){
+	*(queue->tail) = waiter;
+	queue->tail = &(waiter->next);
+	queue->count++;
+}
+
+static admission_waiter_t *admission_pop(admission_queue_t *queue){
+	admission_waiter_t *waiter = queue->head;
+	queue->head = waiter->next;
+	if(queue->head == NULL)
+		queue->tail = &(queue->head);
+	queue->count--;
+
+	waiter->next = NULL;
+	return waiter;
+}
+
+// move the waiters of a queue whose budget ran out to expired. Same budget for all, so they are the oldest
+static void admission_expire_queue(admission_queue_t *queue, uint64_t now, admission_waiter_t ***expired){
+	while(queue->head != NULL && queue->head->deadline_us <= now){
+		admission_waiter_t *waiter = admission_pop(queue);
+		**expired = waiter;
+		*expired = &(waiter->next);
+	}
+}
+
+static void admission_free_queue(admission_queue_t *queue){
+	while(queue->head != NULL)
+		free(admission_pop(queue));
+}
+
+// ------------------------------------------------------------ Functions ----------------------------------------------------------
+
+admission_t *admission_new(size_t slots, size_t queue, uint64_t budget_us){
+	if(slots == 0)
+		return NULL;
+
+	admission_t *admission = calloc(1, sizeof(admission_t));
+	admission->slots = slots;
+	admission->queue = queue;
+	admission->budget_us = budget_us;
+	admission->high.tail = &(admission->high.head);
+	admission->low.tail = &(admission->low.head);
+	pthread_mutex_init(&(admission->lock), NULL);
+
+	return admission;
+}
+
+void admission_destroy(admission_t *admission){
+	if(admission == NULL)
+		return;
+
+	admission_free_queue(&(admission->high));
+	admission_free_queue(&(admission->low));
+	pthread_mutex_destroy(&(admission->lock));
+	free(admission);
+}
+
+bool admission_try(admission_t *admission, bool high, uint64_t *ticket){
+	pthread_mutex_lock(&(admission->lock));
+	bool taken = admission_free(admission, high);
+	if(taken){
+		admission->running++;
+		admission->stats.admitted++;
+	}
+	pthread_mutex_unlock(&(admission->lock));
+
+	if(taken)
+		*ticket = admission_now_us();
+	return taken;
+}
+
+void admission_enter(admission_t *admission, bool high, admission_ready_cb on_ready, void *udata){
+	pthread_mutex_lock(&(admission->lock));
+
+	if(admission_free(admission, high)){
+		admission->running++;
+		admission->stats.admitted++;
+		pthread_mutex_unlock(&(admission->lock));
+
+		on_ready(udata, true, admission_now_us(), 0);
+		return;
+	}
+
+	// reads keep half of the queue free for writes
+	size_t waiting = admission->high.count + admission->low.count;
+	size_t limit = high ? admission->queue : admission->queue / 2;
+	uint64_t expected = admission_expected_us(admission, high);
+	if(waiting >= limit || expected > admission->budget_us){
+		admission->stats.shed++;
+		pthread_mutex_unlock(&(admission->lock));
+
+		on_ready(udata, false, 0, admission_retry_after(expected));
+		return;
+	}
+
+	// the slot comes from admission_leave, or the budget runs out in admission_expire
+	admission_waiter_t *waiter = malloc(sizeof(admission_waiter_t));
+	waiter->next = NULL;
+	waiter->deadline_us = admission_now_us() + admission->budget_us;
+	waiter->on_ready = on_ready;
+	waiter->udata = udata;
+	admission_push(high ? &(admission->high) : &(admission->low), waiter);
+	pthread_mutex_unlock(&(admission->lock));
+}
+
+void admission_leave(admission_t *admission, uint64_t ticket){
+	uint64_t now = admission_now_us();
+	uint64_t service = now - ticket;
+
+	pthread_mutex_lock(&(admission->lock));
+
+	// moving average, the first sample sets it
+	if(admission->stats.service_us == 0)
+		admission->stats.service_us = service;
+	else
+		admission->stats.service_us += ((int64_t)service - (int64_t)admission->stats.service_us) >> ADMISSION_EWMA_SHIFT;
+
+	// the slot goes straight to the oldest write, or read, so it is never seen free by a newcomer
+	admission_waiter_t *next = NULL;
+	if(admission->high.count > 0)
+		next = admission_pop(&(admission->high));
+	else if(admission->low.count > 0)
+		next = admission_pop(&(admission->low));
+
+	if(next != NULL){
+		admission->stats.admitted++;
+		admission->stats.queued++;
+	}
+	else
+		admission->running--;
+	pthread_mutex_unlock(&(admission->lock));
+
+	if(next != NULL){
+		next->on_ready(next->udata, true, now, 0);
+		free(next);
+	}
+}
+
+void admission_expire(admission_t *admission){
+	admission_waiter_t *expired = NULL;
+	admission_waiter_t **tail = &expired;
+	uint64_t now = admission_now_us();
+
+	pthread_mutex_lock(&(admission->lock));
+	admission_expire_queue(&(admission->high), now, &tail);
+	admission_expire_queue(&(admission->low), now, &tail);
+
+	uint32_t retry_after = admission_retry_after(admission_expected_us(admission, false));
+	for(admission_waiter_t *waiter = expired; waiter != NULL; waiter = waiter->next)
+		admission->stats.shed++;
+	pthread_mutex_unlock(&(admission->lock));
+
+	while(expired != NULL){
+		admission_waiter_t *next = expired->next;
+		expired->on_ready(expired->udata, false, 0, retry_after);
+		free(expired);
+		expired = next;
+	}
+}
+
+admission_stats_t admission_stats(admission_t *admission){
+	pthread_mutex_lock(&(admission->lock));
+	admission_stats_t stats = admission->stats;
+	pthread_mutex_unlock(&(admission->lock));
+	return stats;
+}
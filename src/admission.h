@@ -0,0 +1,73 @@
+#ifndef _ADMISSION_HEADER_
+#define _ADMISSION_HEADER_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define ADMISSION_EWMA_SHIFT 3				// weight of a new service time in the average: 1/8
+
+// ------------------------------------------------------------ Types --------------------------------------------------------------
+
+/**
+ * @brief gate in front of db work: at most slots requests run at once, the rest wait in a bounded queue.
+ * Writes are served before reads, and a request that would wait longer than the budget is shed instead of queued.
+ * Nobody blocks in it: a queued request is handed its slot, or shed, through a callback
+*/
+typedef struct admission_t admission_t;
+
+/**
+ * @brief outcome of admission_enter, called exactly once. On admitted pass ticket to admission_leave once the db work is done,
+ * otherwise retry_after is a hint in seconds. Called from whichever thread settled it, it must not block
+*/
+typedef void (*admission_ready_cb)(void *udata, bool admitted, uint64_t ticket, uint32_t retry_after);
+
+// admission counters since start
+typedef struct{
+	uint64_t admitted;
+	uint64_t queued;						/**< admitted after waiting */
+	uint64_t shed;							/**< rejected, queue full or budget exceeded */
+	uint64_t service_us;					/**< moving average of the time a slot is held */
+}admission_stats_t;
+
+// ------------------------------------------------------------ Functions ----------------------------------------------------------
+
+/**
+ * @brief create the gate. slots is the concurrent db work (usually the pool size), queue the max requests waiting,
+ * budget_us the max time one may wait before it is shed
+*/
+admission_t *admission_new(size_t slots, size_t queue, uint64_t budget_us);
+
+/**
+ * @brief free the gate and whoever still waits, without calling them. Call after fio_start returns
+*/
+void admission_destroy(admission_t *admission);
+
+/**
+ * @brief take a free slot if there is one, without queueing. On true, pass ticket to admission_leave once the db work is done
+*/
+bool admission_try(admission_t *admission, bool high, uint64_t *ticket);
+
+/**
+ * @brief take a slot, waiting behind the queue when needed. high priority requests go first and may use the whole queue,
+ * low priority ones only half of it. on_ready runs before this returns when a slot is free or the request is shed,
+ * otherwise once admission_leave hands it a slot or admission_expire finds its budget spent
+*/
+void admission_enter(admission_t *admission, bool high, admission_ready_cb on_ready, void *udata);
+
+/**
+ * @brief give the slot back, straight to the next waiter when there is one
+*/
+void admission_leave(admission_t *admission, uint64_t ticket);
+
+/**
+ * @brief shed the waiters whose budget ran out. Call it periodically, e.g. from a reactor timer
+*/
+void admission_expire(admission_t *admission);
+
+/**
+ * @brief read the counters
+*/
+admission_stats_t admission_stats(admission_t *admission);
+
+#endif
@@ -0,0 +1,181 @@
+#include "binario.h"
+#include "utils.h"
+#include <string.h>
+
+// ------------------------------------------------------------ Little endian ------------------------------------------------------
+
+static void put(uint8_t *buffer, size_t *pos, uint64_t value, int bytes){
+	for(int i = 0; i < bytes; i++)
+		buffer[(*pos)++] = value >> (8 * i);
+}
+
+static uint64_t get(const uint8_t *buffer, size_t *pos, int bytes){
+	uint64_t value = 0;
+	for(int i = 0; i < bytes; i++)
+		value |= (uint64_t)buffer[(*pos)++] << (8 * i);
+
+	return value;
+}
+
+// length prefixed string
+static void put_string(uint8_t *buffer, size_t *pos, const char *str, size_t max){
+	size_t len = strnlen(str, max);
+	buffer[(*pos)++] = len;
+	memcpy(buffer + *pos, str, len);
+	*pos += len;
+}
+
+// false when it overflows the frame or dest
+static bool get_string(const uint8_t *buffer, size_t *pos, size_t end, char *dest, size_t max){
+	if(*pos >= end)
+		return false;
+
+	size_t len = buffer[(*pos)++];
+	if(len > max || *pos + len > end)
+		return false;
+
+	memcpy(dest, buffer + *pos, len);
+	dest[len] = '\0';
+	*pos += len;
+	return true;
+}
+
+// total frame size once the length prefix arrived, 0 before
+static size_t frame_len(const uint8_t *buffer, size_t len){
+	if(len < 4)
+		return 0;
+
+	size_t pos = 0;
+	return 4 + get(buffer, &pos, 4);
+}
+
+// ------------------------------------------------------------ Requests -----------------------------------------------------------
+
+size_t binario_encode_request(uint8_t *buffer, const binario_request_t *request){
+	size_t pos = 4;
+	put(buffer, &pos, request->id, 4);
+	put(buffer, &pos, request->op, 1);
+	put(buffer, &pos, request->cliente, 4);
+
+	if(request->op == binario_op_transacao){
+		put(buffer, &pos, request->tipo, 1);
+		put(buffer, &pos, request->valor, 4);
+		put_string(buffer, &pos, request->descricao, 10);
+	}
+
+	size_t len = 0;
+	put(buffer, &len, pos - 4, 4);
+	return pos;
+}
+
+ssize_t binario_decode_request(const uint8_t *buffer, size_t len, binario_request_t *request){
+	size_t total = frame_len(buffer, len);
+	if(total > BINARIO_MAX_REQUEST || (total != 0 && total < BINARIO_HEAD))
+		return -1;
+	if(total == 0 || len < total)
+		return 0;
+
+	size_t pos = 4;
+	request->id = get(buffer, &pos, 4);
+	request->op = get(buffer, &pos, 1);
+	request->cliente = get(buffer, &pos, 4);
+
+	switch(request->op){
+		case binario_op_extrato:
+			return total;
+
+		case binario_op_transacao:
+			if(pos + 5 > total)
+				return -1;
+
+			request->tipo = get(buffer, &pos, 1);
+			request->valor = get(buffer, &pos, 4);
+
+			// descricao is validated as in the json api, it goes into the extrato json as is
+			size_t descricao_len = pos < total ? buffer[pos] : 0;
+			if(!get_string(buffer, &pos, total, request->descricao, 10) || !validDescricao(request->descricao, descricao_len))
+				return -1;
+
+			return total;
+
+		default:
+			return -1;
+	}
+}
+
+// ------------------------------------------------------------ Responses ----------------------------------------------------------
+
+size_t binario_encode_response(uint8_t *buffer, const binario_response_t *response){
+	size_t pos = 4;
+	put(buffer, &pos, response->id, 4);
+	put(buffer, &pos, response->op, 1);
+	put(buffer, &pos, response->status, 2);
+
+	if(response->status == 200){
+		put(buffer, &pos, response->saldo, 8);
+		put(buffer, &pos, response->limite, 8);
+
+		if(response->op == binario_op_extrato){
+			uint8_t count = response->count < BINARIO_MAX_TRANSACOES ? response->count : BINARIO_MAX_TRANSACOES;
+			put(buffer, &pos, count, 1);
+
+			for(uint8_t i = 0; i < count; i++){
+				const binario_transacao_t *t = &(response->transacoes[i]);
+				put(buffer, &pos, t->valor, 8);
+				put(buffer, &pos, t->tipo, 1);
+				put_string(buffer, &pos, t->descricao, 10);
+				put_string(buffer, &pos, t->realizada_em, 32);
+			}
+		}
+	}
+
+	size_t len = 0;
+	put(buffer, &len, pos - 4, 4);
+	return pos;
+}
+
+ssize_t binario_decode_response(const uint8_t *buffer, size_t len, binario_response_t *response){
+	size_t total = frame_len(buffer, len);
+	if(total > BINARIO_MAX_RESPONSE || (total != 0 && total < 11))
+		return -1;
+	if(total == 0 || len < total)
+		return 0;
+
+	size_t pos = 4;
+	response->id = get(buffer, &pos, 4);
+	response->op = get(buffer, &pos, 1);
+	response->status = get(buffer, &pos, 2);
+	response->count = 0;
+
+	if(response->status != 200)
+		return total;
+
+	if(pos + 16 > total)
+		return -1;
+
+	response->saldo = get(buffer, &pos, 8);
+	response->limite = get(buffer, &pos, 8);
+
+	if(response->op != binario_op_extrato)
+		return total;
+
+	if(pos + 1 > total)
+		return -1;
+
+	response->count = get(buffer, &pos, 1);
+	if(response->count > BINARIO_MAX_TRANSACOES)
+		return -1;
+
+	for(uint8_t i = 0; i < response->count; i++){
+		binario_transacao_t *t = &(response->transacoes[i]);
+		if(pos + 9 > total)
+			return -1;
+
+		t->valor = get(buffer, &pos, 8);
+		t->tipo = get(buffer, &pos, 1);
+		if(!get_string(buffer, &pos, total, t->descricao, 10) || !get_string(buffer, &pos, total, t->realizada_em, 32))
+			return -1;
+	}
+
+	return total;
+}
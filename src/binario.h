@@ -0,0 +1,79 @@
+#ifndef _BINARIO_HEADER_
+#define _BINARIO_HEADER_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Length prefixed frames, little endian. Every frame starts with u32 length (bytes after it) and u32 request id,
+// echoed back so responses can arrive out of order.
+//
+// request:  len, id, u8 op, u32 cliente
+//           op transacao: u8 tipo ('c' or 'd'), u32 valor, u8 descricao length (1..10), descricao
+// response: len, id, u8 op, u16 status
+//           status 200: i64 saldo, i64 limite
+//           op extrato, status 200: u8 count, count x (i64 valor, u8 tipo, u8 descricao length, descricao, u8 realizada_em length, realizada_em)
+
+#define BINARIO_HEAD 13									// len, id, op, cliente
+#define BINARIO_MAX_REQUEST 32							// bigger requests are invalid
+#define BINARIO_MAX_TRANSACOES 10
+#define BINARIO_MAX_RESPONSE (4 + 4 + 1 + 2 + 16 + 1 + BINARIO_MAX_TRANSACOES * (8 + 1 + 1 + 10 + 1 + 32))
+
+// ------------------------------------------------------------ Types --------------------------------------------------------------
+
+typedef enum{
+	binario_op_transacao = 1,
+	binario_op_extrato = 2
+}binario_op_t;
+
+typedef struct{
+	uint32_t id;
+	binario_op_t op;
+	int64_t cliente;
+	char tipo;
+	int64_t valor;
+	char descricao[11];
+}binario_request_t;
+
+typedef struct{
+	int64_t valor;
+	char tipo;
+	char descricao[11];
+	char realizada_em[33];
+}binario_transacao_t;
+
+typedef struct{
+	uint32_t id;
+	binario_op_t op;
+	uint16_t status;
+	int64_t saldo;
+	int64_t limite;
+	uint8_t count;
+	binario_transacao_t transacoes[BINARIO_MAX_TRANSACOES];
+}binario_response_t;
+
+// ------------------------------------------------------------ Functions ----------------------------------------------------------
+
+/**
+ * @brief write a request frame, returns its size (at most BINARIO_MAX_REQUEST)
+*/
+size_t binario_encode_request(uint8_t *buffer, const binario_request_t *request);
+
+/**
+ * @brief read the request frame at the start of buffer.
+ * Returns the frame size, 0 while incomplete and -1 when it is invalid (the connection can't be resynced)
+*/
+ssize_t binario_decode_request(const uint8_t *buffer, size_t len, binario_request_t *request);
+
+/**
+ * @brief write a response frame, returns its size (at most BINARIO_MAX_RESPONSE)
+*/
+size_t binario_encode_response(uint8_t *buffer, const binario_response_t *response);
+
+/**
+ * @brief read the response frame at the start of buffer. Same returns as binario_decode_request
+*/
+ssize_t binario_decode_response(const uint8_t *buffer, size_t len, binario_response_t *response);
+
+#endif
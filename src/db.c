@@ -2,9 +2,14 @@
 #include "db_priv.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 #include <libpq-fe.h>
 #include "string+.h"
+#include "hash.h"
+#include "trace.h"
 #include "db_postgres.h"
+#include "db_memory.h"
+#include "db_log.h"
 
 // ------------------------------------------------------------ Invalid database default
 
@@ -65,6 +70,10 @@ static const char *db_vendor_name_map(db_vendor_t vendor){
 		case db_vendor_postgres: 
 		case db_vendor_postgres15: 
 			return "Postgres 15";
+		case db_vendor_memory: 
+			return "Memory";
+		case db_vendor_log: 
+			return "Log";
 	}
 }
 
@@ -108,6 +117,12 @@ db_error_t db_connect_function_map(db_t *db){
 		case db_vendor_postgres:
 		case db_vendor_postgres15:
 			return db_connect_function_postgres(db);
+
+		case db_vendor_memory:
+			return db_connect_function_memory(db);
+
+		case db_vendor_log:
+			return db_connect_function_log(db);
 	}
 
 	return db_error_unknown;
@@ -124,6 +139,10 @@ db_state_t db_stat_function_map(db_t *db){
 		case db_vendor_postgres:
 		case db_vendor_postgres15:
 			return db_stat_function_postgres(db);
+
+		case db_vendor_memory:
+		case db_vendor_log:
+			return db_stat_function_memory(db);
 	}
 }
 
@@ -138,6 +157,8 @@ void db_destroy_function_map(db_t *db){
 	db->password;
 	db->role;
 	
+	db_cache_free(db);
+
 	// context free
 	switch(db->vendor){
 		default: return;
@@ -145,13 +166,62 @@ void db_destroy_function_map(db_t *db){
 		case db_vendor_postgres:
 		case db_vendor_postgres15:
 			db_destroy_function_postgres(db);
+		break;
+
+		case db_vendor_memory:
+			db_destroy_function_memory(db);
+		break;
+
+		case db_vendor_log:
+			db_destroy_function_log(db);
+		break;
 	}
 
+	free(db->statements);
 	free(db);
 }
 
 // exec query map
-static db_results_t *db_exec_function_map(const db_t *db, void *connection, char *query, size_t params_count, va_list params){
+static db_results_t *db_exec_function_map(const db_t *db, void *connection, char *query, bool prepared, size_t params_count, va_list params){
+	if(db == NULL) return db_result_new_nulldb();
+
+	switch(db->vendor){
+		default: 
+			return db_results_new(0, 0, db_error_invalid_db, "Vendor not yet implemented");
+			
+		case db_vendor_postgres:
+		case db_vendor_postgres15:
+			return db_exec_function_postgres(db, connection, query, prepared, params_count, params);
+
+		case db_vendor_memory:
+		case db_vendor_log:
+			return db_exec_function_memory(db, connection, query, prepared, params_count, params);
+	}
+}
+
+// stream query rows map
+static db_results_t *db_stream_function_map(const db_t *db, void *connection, char *query, size_t params_count, va_list params, db_row_cb cb, void *udata){
+	if(db == NULL) return db_result_new_nulldb();
+
+	switch(db->vendor){
+		default: 
+			return db_results_new(0, 0, db_error_invalid_db, "Vendor not yet implemented");
+			
+		case db_vendor_postgres:
+		case db_vendor_postgres15:
+			return db_stream_function_postgres(db, connection, query, params_count, params, cb, udata);
+
+		case db_vendor_memory:
+			return db_stream_function_memory(db, connection, query, params_count, params, cb, udata);
+
+		// the store keeps only the last transactions of each client, a partial history would pass for the whole
+		case db_vendor_log:
+			return db_results_new(0, 0, db_error_unsupported, "The log vendor keeps only the last transactions, no full history to stream\n");
+	}
+}
+
+// copy out map
+static db_results_t *db_copy_out_function_map(const db_t *db, void *connection, char *query, db_copy_cb cb, void *udata){
 	if(db == NULL) return db_result_new_nulldb();
 
 	switch(db->vendor){
@@ -160,7 +230,46 @@ static db_results_t *db_exec_function_map(const db_t *db, void *connection, char
 			
 		case db_vendor_postgres:
 		case db_vendor_postgres15:
-			return db_exec_function_postgres(db, connection, query, params_count, params);
+			return db_copy_out_function_postgres(db, connection, query, cb, udata);
+
+		case db_vendor_memory:
+			return db_copy_out_function_memory(db, connection, query, cb, udata);
+
+		// same as db_stream, the log vendor has no full ledger to export
+		case db_vendor_log:
+			return db_results_new(0, 0, db_error_unsupported, "The log vendor keeps only the last transactions, no full ledger to export\n");
+	}
+}
+
+// prepare statement map
+static db_error_t db_prepare_function_map(db_t *db, db_statement_t *statement){
+	switch(db->vendor){
+		default: 
+			return db_error_invalid_db;
+			
+		case db_vendor_postgres:
+		case db_vendor_postgres15:
+			return db_prepare_function_postgres(db, statement);
+
+		case db_vendor_memory:
+		case db_vendor_log:
+			return db_error_ok;
+	}
+}
+
+// result context size map
+static size_t db_results_size_map(const db_t *db, db_results_t *results){
+	switch(db->vendor){
+		default: 
+			return 0;
+			
+		case db_vendor_postgres:
+		case db_vendor_postgres15:
+			return db_result_size_postgres(results);
+
+		case db_vendor_memory:
+		case db_vendor_log:
+			return db_result_size_memory(results);
 	}
 }
 
@@ -181,9 +290,9 @@ static char *db_default_port_map(db_vendor_t vendor){
 // create a new db object
 db_t *db_create(db_vendor_t type, size_t num_connections, char *host, char *port, char *database, char *user, char *password, char *role, db_error_t *code){
 	if(
-		(host == NULL) ||
-		(database == NULL) ||
-		(user == NULL) ||
+		(type != db_vendor_memory && type != db_vendor_log && host == NULL) ||
+		(type != db_vendor_memory && database == NULL) ||
+		(type != db_vendor_memory && type != db_vendor_log && user == NULL) ||
 		(num_connections < 1)
 	){
 		if(code != NULL) *code = db_error_invalid_db;
@@ -202,6 +311,7 @@ db_t *db_create(db_vendor_t type, size_t num_connections, char *host, char *port
 	}
 
 	// set
+	db->vendor     	= type;
 	db->host     	= host;
 	db->port     	= port != NULL ? port : db_default_port_map(type);
 	db->database 	= database;
@@ -214,6 +324,12 @@ db_t *db_create(db_vendor_t type, size_t num_connections, char *host, char *port
 	return db;
 }
 
+// inject latency on every query
+void db_set_latency(db_t *db, uint64_t usec){
+	if(db == NULL) return;
+	db->latency_us = usec;
+}
+
 // connect to database
 db_error_t db_connect(db_t *db){
 	return db_connect_function_map(db);
@@ -339,6 +455,11 @@ static void *db_request_conn(db_t *db){
 		case db_vendor_postgres:
 			return db_request_conn_postgres(db);
 			break;
+
+		case db_vendor_memory:
+		case db_vendor_log:
+			return db_request_conn_memory(db);
+			break;
 	}
 }
 
@@ -353,14 +474,73 @@ static void db_return_conn(db_t *db, void *conn){
 		case db_vendor_postgres:
 			db_return_conn_postgres(db, conn);
 			break;
+
+		case db_vendor_memory:
+		case db_vendor_log:
+			db_return_conn_memory(db, conn);
+			break;
 	}
 }
 
-// exec query
-db_results_t *db_exec(db_t *db, char *query, size_t params_count, ...){
-	va_list params;
-	va_start(params, params_count);
-	
+// deadline of the request the calling thread is serving, monotonic us. 0 for none
+static __thread uint64_t db_deadline_us = 0;
+
+// when the calling thread got its connection, start of the observed query time
+static __thread uint64_t db_acquired_us = 0;
+
+static uint64_t db_now_us(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+// set the calling thread's deadline
+void db_deadline(uint64_t timeout_us){
+	db_deadline_us = timeout_us > 0 ? db_now_us() + timeout_us : 0;
+}
+
+// !trivial
+uint64_t db_deadline_get(void){
+	return db_deadline_us;
+}
+
+// !trivial
+void db_deadline_at(uint64_t deadline_us){
+	db_deadline_us = deadline_us;
+}
+
+// ms left as a poll() timeout, rounded up so a wait never ends just before the deadline
+static int db_deadline_wait_ms(void){
+	if(db_deadline_us == 0)
+		return -1;
+
+	uint64_t now = db_now_us();
+	return now < db_deadline_us ? (int)((db_deadline_us - now + 999) / 1000) : 0;
+}
+
+// error result when the deadline passed
+static db_results_t *db_results_timeout(void){
+	return db_results_new(0, 0, db_error_timeout, "Request deadline exceeded, query cancelled\n");
+}
+
+// report work to the observer
+static void db_notify_observer(db_t *db, db_event_t event, const char *statement, uint64_t start_us){
+	if(db->observer != NULL)
+		db->observer(event, statement, db_now_us() - start_us, db->observer_udata);
+}
+
+// observe the db work
+void db_observe(db_t *db, db_observer_cb cb, void *udata){
+	if(db == NULL) return;
+	db->observer_udata = udata;
+	db->observer = cb;
+}
+
+// take a connection from the pool, retrying, and wait the simulated round trip. NULL when the pool is exhausted
+static void *db_acquire_conn(db_t *db){
+	uint64_t start = db->observer != NULL ? db_now_us() : 0;
+	uint64_t trace = trace_start();
+
 	void *conn;
 	int retries = DB_CONN_POOL_RETRY;
 	while(retries){
@@ -372,15 +552,121 @@ db_results_t *db_exec(db_t *db, char *query, size_t params_count, ...){
 			break;
 	}
 
-	if(retries == 0 && conn == NULL){
-		va_end(params);
-		return db_results_new_fmt(0, 0, db_error_fatal, "Could not get connnection from connection pool. Connection available: [%lu]. Connection count: [%lu]", db->context.available_connection, db->context.connections_count);
+	if(db->observer != NULL){
+		db_notify_observer(db, db_event_acquire, NULL, start);
+		db_acquired_us = db_now_us();
+	}
+	trace_span("acquire", trace);
+
+	if(retries == 0 && conn == NULL)
+		return NULL;
+
+	// simulated round trip, cut short by the deadline like a cancelled query
+	if(db->latency_us > 0){
+		uint64_t usec = db->latency_us;
+		uint64_t now = db_now_us();
+		if(db_deadline_us > 0 && db_deadline_us < now + usec)
+			usec = db_deadline_us > now ? db_deadline_us - now : 0;
+
+		struct timespec latency = {.tv_sec = usec / 1000000, .tv_nsec = (usec % 1000000) * 1000};
+		nanosleep(&latency, NULL);
+	}
+
+	return conn;
+}
+
+// error result when the pool is exhausted
+static db_results_t *db_results_no_conn(db_t *db){
+	return db_results_new_fmt(0, 0, db_error_no_connection, "Could not get connnection from connection pool. Connection available: [%lu]. Connection count: [%lu]", db->context.available_connection, db->context.connections_count);
+}
+
+// exec query or prepared statement
+static db_results_t *db_exec_va(db_t *db, char *query, bool prepared, size_t params_count, va_list params){
+	// no time left for the query, don't take a connection
+	if(db_deadline_wait_ms() == 0)
+		return db_results_timeout();
+
+	// traced from before the pool, the acquire span nests inside
+	uint64_t trace = trace_start();
+	void *conn = db_acquire_conn(db);
+	if(conn == NULL)
+		return db_results_no_conn(db);
+
+	// the simulated round trip ran into the deadline
+	if(db_deadline_wait_ms() == 0){
+		db_return_conn(db, conn);
+		return db_results_timeout();
 	}
 
-	db_results_t *res = db_exec_function_map(db, conn, query, params_count, params);
+	db_results_t *res = db_exec_function_map(db, conn, query, prepared, params_count, params);
+
+	db_return_conn(db, conn);
+
+	// from the connection on, the simulated round trip included
+	if(db->observer != NULL)
+		db_notify_observer(db, db_event_query, query, db_acquired_us);
+	if(trace != 0)
+		trace_record("query", query, trace);
+
+	return res;
+}
+
+// exec query
+db_results_t *db_exec(db_t *db, char *query, size_t params_count, ...){
+	va_list params;
+	va_start(params, params_count);
+	db_results_t *res = db_exec_va(db, query, false, params_count, params);
+	va_end(params);
+	return res;
+}
+
+// stream query rows
+db_results_t *db_stream(db_t *db, db_row_cb cb, void *udata, char *query, size_t params_count, ...){
+	void *conn = db_acquire_conn(db);
+	if(conn == NULL)
+		return db_results_no_conn(db);
+
+	va_list params;
+	va_start(params, params_count);
+	db_results_t *res = db_stream_function_map(db, conn, query, params_count, params, cb, udata);
+	va_end(params);
+
+	db_return_conn(db, conn);
+	return res;
+}
+
+// copy out data
+db_results_t *db_copy_out(db_t *db, char *query, db_copy_cb cb, void *udata){
+	void *conn = db_acquire_conn(db);
+	if(conn == NULL)
+		return db_results_no_conn(db);
+
+	db_results_t *res = db_copy_out_function_map(db, conn, query, cb, udata);
 
 	db_return_conn(db, conn);
+	return res;
+}
+
+// prepare statement on every connection
+db_error_t db_prepare(db_t *db, char *name, char *query, size_t params_count){
+	if(db == NULL || name == NULL || query == NULL) return db_error_invalid_db;
+	if(db->state != db_state_connected) return db_error_connection_error;
 
+	db->statements = realloc(db->statements, sizeof(db_statement_t) * (db->statements_count + 1));
+	db_statement_t *statement = &(db->statements[db->statements_count]);
+	statement->name = name;
+	statement->query = query;
+	statement->params_count = params_count;
+	db->statements_count++;
+
+	return db_prepare_function_map(db, statement);
+}
+
+// exec prepared statement
+db_results_t *db_exec_prepared(db_t *db, char *name, size_t params_count, ...){
+	va_list params;
+	va_start(params, params_count);
+	db_results_t *res = db_exec_va(db, name, true, params_count, params);
 	va_end(params);
 	return res;
 }
@@ -389,6 +675,10 @@ db_results_t *db_exec(db_t *db, char *query, size_t params_count, ...){
 void db_results_destroy(const db_t *db, db_results_t *results){
 	if(results == NULL) return;
 
+	// shared by the cache, last reference frees
+	if(results->refs > 0 && __atomic_sub_fetch(&(results->refs), 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
 	if(results->entries_count > 0){
 		if(results->fields != NULL){
 			for(int64_t i = 0; i < results->entries_count; i++)						// for each entry
@@ -405,6 +695,11 @@ void db_results_destroy(const db_t *db, db_results_t *results){
 			db_result_destroy_context_postgres(results);
 		break;
 
+		case db_vendor_memory:
+		case db_vendor_log:
+			db_result_destroy_context_memory(results);
+		break;
+
 		default:
 			break;
 	}
@@ -412,6 +707,249 @@ void db_results_destroy(const db_t *db, db_results_t *results){
 	free(results);
 }
 
+// listen to channel on a dedicated connection
+int db_listen(db_t *db, const char *channel){
+	if(db == NULL || channel == NULL) return -1;
+
+	switch(db->vendor){
+		default:
+			return -1;
+
+		case db_vendor_postgres:
+		case db_vendor_postgres15:
+			return db_listen_function_postgres(db, channel);
+	}
+}
+
+// dispatch pending notifications
+size_t db_notifications(db_t *db, db_notify_cb cb, void *udata){
+	if(db == NULL || cb == NULL) return 0;
+
+	switch(db->vendor){
+		default:
+			return 0;
+
+		case db_vendor_postgres:
+		case db_vendor_postgres15:
+			return db_notifications_function_postgres(db, cb, udata);
+	}
+}
+
+// ------------------------------------------------------------- Result cache -----------------------------------------------------
+
+#define DB_CACHE_TAGS 1024
+
+// cached result
+typedef struct{
+	uint64_t hash;							// hash of key
+	char *key;								// query and params as text
+	size_t key_len;
+	size_t tag;								// slot in generations
+	uint64_t generation;					// tag generation read before the query ran
+	size_t bytes;
+	db_results_t *results;
+}db_cache_entry_t;
+
+struct db_cache_t{
+	pthread_mutex_t lock;
+	size_t capacity;
+	db_cache_entry_t *entries;
+	uint64_t generations[DB_CACHE_TAGS];	// bumped by db_cache_invalidate(). tags sharing a slot invalidate each other
+	db_cache_stats_t stats;
+};
+
+// memory held by results
+static size_t db_cache_results_size(const db_t *db, db_results_t *results){
+	return sizeof(db_results_t) + 
+		results->fields_count * sizeof(char*) + 
+		results->entries_count * (sizeof(db_field_t*) + results->fields_count * sizeof(db_field_t)) +
+		db_results_size_map(db, results);
+}
+
+// drop entry, call with the lock held
+static void db_cache_entry_clear(const db_t *db, db_cache_entry_t *entry){
+	if(entry->results == NULL) return;
+
+	db->cache->stats.entries--;
+	db->cache->stats.bytes -= entry->bytes;
+
+	db_results_destroy(db, entry->results);
+	free(entry->key);
+	memset(entry, 0, sizeof(db_cache_entry_t));
+}
+
+// write query and params into key. false when a param can't be part of a key
+static bool db_cache_key(string *key, const char *query, bool prepared, size_t params_count, va_list params){
+	string_cat_raw(key, prepared ? "p|" : "q|", 0);
+	string_cat_raw(key, query, 0);
+
+	for(size_t i = 0; i < params_count; i++){
+		db_field_t param = va_arg(params, db_field_t);
+
+		switch(param.type){
+			case db_type_null:
+				string_cat_raw(key, "|n", 0);
+				break;
+			case db_type_int:
+				string_write(key, "|i%ld", 32, param.value.as_int);
+				break;
+			case db_type_bool:
+				string_write(key, "|b%d", 8, param.value.as_bool);
+				break;
+			case db_type_float:
+				string_write(key, "|f%.17g", 32, param.value.as_float);
+				break;
+			case db_type_string:
+				string_write(key, "|s%zu:%.*s", param.count + 32, param.count, (int)param.count, param.value.as_string);
+				break;
+			default:
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// enable result cache
+void db_cache_enable(db_t *db, size_t capacity){
+	if(db == NULL || capacity == 0 || db->cache != NULL) return;
+
+	db_cache_t *cache = calloc(1, sizeof(db_cache_t));
+	pthread_mutex_init(&(cache->lock), NULL);
+	cache->capacity = capacity;
+	cache->entries = calloc(capacity, sizeof(db_cache_entry_t));
+
+	db->cache = cache;
+}
+
+// free result cache. results still referenced by callers are freed by their last db_results_destroy()
+static void db_cache_free(db_t *db){
+	if(db->cache == NULL) return;
+
+	for(size_t i = 0; i < db->cache->capacity; i++)
+		db_cache_entry_clear(db, &(db->cache->entries[i]));
+
+	pthread_mutex_destroy(&(db->cache->lock));
+	free(db->cache->entries);
+	free(db->cache);
+	db->cache = NULL;
+}
+
+// exec query or prepared statement through the result cache
+static db_results_t *db_exec_cached_va(db_t *db, const char *tag, char *query, bool prepared, size_t params_count, va_list params){
+	va_list key_params;
+
+	if(db == NULL || db->cache == NULL || tag == NULL)
+		return db_exec_va(db, query, prepared, params_count, params);
+
+	db_cache_t *cache = db->cache;
+	string *key = string_new_sized(strlen(query) + 64);
+
+	va_copy(key_params, params);
+	bool cacheable = db_cache_key(key, query, prepared, params_count, key_params);
+	va_end(key_params);
+
+	if(!cacheable){
+		string_destroy(key);
+		return db_exec_va(db, query, prepared, params_count, params);
+	}
+
+	uint64_t hash = djb2_hash((uint8_t*)key->raw, key->len);
+	size_t slot = djb2_hash_string((const unsigned char*)tag) % DB_CACHE_TAGS;
+	db_cache_entry_t *entry = &(cache->entries[hash % cache->capacity]);
+
+	// hit
+	pthread_mutex_lock(&(cache->lock));
+	uint64_t generation = cache->generations[slot];
+
+	if(
+		entry->results != NULL && entry->hash == hash && entry->key_len == key->len && 
+		memcmp(entry->key, key->raw, key->len) == 0 && 
+		entry->tag == slot && entry->generation == generation
+	){
+		db_results_t *res = entry->results;
+		__atomic_add_fetch(&(res->refs), 1, __ATOMIC_ACQ_REL);
+		cache->stats.hits++;
+		pthread_mutex_unlock(&(cache->lock));
+
+		string_destroy(key);
+		return res;
+	}
+
+	cache->stats.misses++;
+	pthread_mutex_unlock(&(cache->lock));
+
+	// miss. a write committed while the query runs bumps the generation, so this result is stored already stale
+	db_results_t *res = db_exec_va(db, query, prepared, params_count, params);
+
+	if(res->code != db_error_ok){
+		string_destroy(key);
+		return res;
+	}
+
+	size_t key_len = key->len;
+	size_t bytes = db_cache_results_size(db, res) + key_len;
+	res->refs = 2;															// cache and caller
+
+	pthread_mutex_lock(&(cache->lock));
+	db_cache_entry_clear(db, entry);
+
+	entry->hash = hash;
+	entry->key = string_unwrap(key);
+	entry->key_len = key_len;
+	entry->tag = slot;
+	entry->generation = generation;
+	entry->bytes = bytes;
+	entry->results = res;
+
+	cache->stats.entries++;
+	cache->stats.bytes += bytes;
+	pthread_mutex_unlock(&(cache->lock));
+
+	return res;
+}
+
+// exec query through the result cache
+db_results_t *db_exec_cached(db_t *db, const char *tag, char *query, size_t params_count, ...){
+	va_list params;
+	va_start(params, params_count);
+	db_results_t *res = db_exec_cached_va(db, tag, query, false, params_count, params);
+	va_end(params);
+	return res;
+}
+
+// exec prepared statement through the result cache
+db_results_t *db_exec_prepared_cached(db_t *db, const char *tag, char *name, size_t params_count, ...){
+	va_list params;
+	va_start(params, params_count);
+	db_results_t *res = db_exec_cached_va(db, tag, name, true, params_count, params);
+	va_end(params);
+	return res;
+}
+
+// invalidate results with tag
+void db_cache_invalidate(db_t *db, const char *tag){
+	if(db == NULL || db->cache == NULL || tag == NULL) return;
+
+	size_t slot = djb2_hash_string((const unsigned char*)tag) % DB_CACHE_TAGS;
+
+	pthread_mutex_lock(&(db->cache->lock));
+	db->cache->generations[slot]++;
+	db->cache->stats.invalidations++;
+	pthread_mutex_unlock(&(db->cache->lock));
+}
+
+// read cache counters
+db_cache_stats_t db_cache_stats(db_t *db){
+	if(db == NULL || db->cache == NULL) return (db_cache_stats_t){0};
+
+	pthread_mutex_lock(&(db->cache->lock));
+	db_cache_stats_t stats = db->cache->stats;
+	pthread_mutex_unlock(&(db->cache->lock));
+
+	return stats;
+}
+
 // close db connection
 void db_destroy(db_t *db){
 	db_destroy_function_map(db);
@@ -16,6 +16,8 @@
 typedef enum{
 	db_vendor_postgres,
 	db_vendor_postgres15,
+	db_vendor_memory,						/**< in process mock that understands the app queries, for benchmarking */
+	db_vendor_log,							/**< memory store persisted to an append only log, database is the data directory */
 	// db_vendor_mysql,
 	// db_vendor_firebird,
 	// db_vendor_cassandra,
@@ -72,6 +74,9 @@ typedef enum{
 	db_error_connection_error,
 	db_error_unknown,
 	db_error_invalid_db,
+	db_error_no_connection,					/**< the pool had no free connection */
+	db_error_timeout,						/**< the calling thread's deadline passed, the query was cancelled. See db_deadline() */
+	db_error_unsupported,					/**< the vendor can't serve the call, e.g. full history on the log vendor */
 	db_error_max
 }db_error_t;
 
@@ -87,6 +92,7 @@ typedef struct{
 	char msg[DB_MSG_LEN];
 
 	void *ctx;
+	uint32_t refs;							/**< references to a result shared by the cache, 0 when owned by the caller alone */
 }db_results_t;
 
 // current state of the db object
@@ -98,6 +104,34 @@ typedef enum{
 	db_state_failed_connection
 }db_state_t;
 
+// prepared statement registered with db_prepare()
+typedef struct{
+	char *name;
+	char *query;
+	size_t params_count;
+}db_statement_t;
+
+// result cache, see db_cache_enable()
+typedef struct db_cache_t db_cache_t;
+
+// result cache counters
+typedef struct{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t invalidations;
+	size_t entries;							/**< results held */
+	size_t bytes;							/**< memory held by the results */
+}db_cache_stats_t;
+
+// db work reported to an observer, see db_observe()
+typedef enum{
+	db_event_acquire,						/**< wait for a pool connection, statement is NULL */
+	db_event_query							/**< a db_exec, statement is the prepared name or the query text */
+}db_event_t;
+
+// called on the thread that did the work, keep it cheap
+typedef void (*db_observer_cb)(db_event_t event, const char *statement, uint64_t usec, void *udata);
+
 // db struct
 typedef struct{
 	db_vendor_t vendor;						/**< db type */
@@ -115,9 +149,27 @@ typedef struct{
 		size_t connections_count;
 		void *connections;
 		size_t available_connection;
+		void *listener;						/**< dedicated connection for db_listen(), NULL until used */
 	}context;
+
+	db_statement_t *statements;				/**< prepared statements, see db_prepare() */
+	size_t statements_count;
+
+	uint64_t latency_us;					/**< latency injected on every query while holding a connection, see db_set_latency() */
+	db_cache_t *cache;						/**< NULL unless db_cache_enable() was called */
+	db_observer_cb observer;				/**< NULL unless db_observe() was called */
+	void *observer_udata;
 }db_t;
 
+// callback for notifications received on a listened channel
+typedef void (*db_notify_cb)(const char *channel, const char *payload, void *udata);
+
+// callback for the raw data of db_copy_out(), one row at a time as sent by the db. Return false to stop the copy
+typedef bool (*db_copy_cb)(const char *data, size_t len, void *udata);
+
+// callback for the rows of db_stream(). row holds a single entry and is freed after the call. Return false to stop the query
+typedef bool (*db_row_cb)(db_results_t *row, void *udata);
+
 // ------------------------------------------------------------ Functions ----------------------------------------------------------
 
 /**
@@ -145,6 +197,34 @@ db_error_t db_connect(db_t *db);
 */
 db_state_t db_stat(db_t *db);
 
+/**
+ * @brief inject latency on every query, simulating a network round trip. 0 disables
+ * @param usec: latency in microseconds
+*/
+void db_set_latency(db_t *db, uint64_t usec);
+
+/**
+ * @brief report connection waits and query times to cb, e.g. for metrics. Call before the db is used by other threads
+*/
+void db_observe(db_t *db, db_observer_cb cb, void *udata);
+
+/**
+ * @brief deadline for the db calls of the calling thread, timeout_us from now. 0 clears it.
+ * A db_exec still running at the deadline is cancelled (PQcancel) and returns db_error_timeout, the connection goes back to the pool clean.
+ * Streams and copies are not bound by it
+*/
+void db_deadline(uint64_t timeout_us);
+
+/**
+ * @brief the calling thread's deadline as a monotonic instant in us, 0 for none. Carries a request's deadline to the thread that resumes it
+*/
+uint64_t db_deadline_get(void);
+
+/**
+ * @brief set the calling thread's deadline to an instant from db_deadline_get(). 0 clears it
+*/
+void db_deadline_at(uint64_t deadline_us);
+
 /**
  * @brief close db connections and frees memory
 */
@@ -186,6 +266,32 @@ db_field_t db_param_string_array(char **value, size_t count);
 // exec a query. return is always NOT NULL, no need to check
 db_results_t *db_exec(db_t *db, char *query, size_t params_count, ...);
 
+/**
+ * @brief exec a query and hand its rows to cb one at a time as they arrive, so memory doesn't grow with the result (postgres single row mode).
+ * The pooled connection is held until the last row, keep cb short or bounded
+ * @param cb: called for every row, in order
+ * @return status of the query, without entries. Always NOT NULL
+*/
+db_results_t *db_stream(db_t *db, db_row_cb cb, void *udata, char *query, size_t params_count, ...);
+
+/**
+ * @brief run a "copy (...) to stdout" statement and relay the data to cb untouched, without parsing rows (postgres PQgetCopyData).
+ * Copy takes no params, build the statement from trusted values only. The pooled connection is held until the end
+ * @return status of the copy, without entries. Always NOT NULL
+*/
+db_results_t *db_copy_out(db_t *db, char *query, db_copy_cb cb, void *udata);
+
+/**
+ * @brief prepare a named statement on every connection of the pool. Call after db_stat() returns db_state_connected and before serving
+ * @param name: statement name, used on db_exec_prepared()
+ * @param query: query text with $1..$n placeholders
+ * @param params_count: number of params of the query
+*/
+db_error_t db_prepare(db_t *db, char *name, char *query, size_t params_count);
+
+// exec a statement created with db_prepare(). return is always NOT NULL, no need to check
+db_results_t *db_exec_prepared(db_t *db, char *name, size_t params_count, ...);
+
 // read field value from the results of a query. NULL if null | non existent | invalid. Use beforehand the calls db_results_isvalid() | db_results_isnull() | db_results_isvalid_and_notnull() to check if the value is what you expect
 db_field_t db_read_field(db_results_t *results, uint32_t entry, uint32_t field);
 
@@ -198,4 +304,41 @@ void db_results_destroy(const db_t *db, db_results_t *results);
 // print results from a query
 void db_print_results(db_results_t *results);
 
+/**
+ * @brief listen to a notification channel on a dedicated connection, outside of the pool
+ * @param channel: channel name
+ * @return socket file descriptor of the dedicated connection, to be watched by an event loop, or -1 on error
+*/
+int db_listen(db_t *db, const char *channel);
+
+/**
+ * @brief consume input on the dedicated connection and call cb for every notification received. Non blocking
+ * @return amount of notifications dispatched
+*/
+size_t db_notifications(db_t *db, db_notify_cb cb, void *udata);
+
+/**
+ * @brief enable the result cache used by db_exec_cached(). Call before serving
+ * @param capacity: number of results held, direct mapped by the hash of query and params. 0 keeps it disabled
+*/
+void db_cache_enable(db_t *db, size_t capacity);
+
+/**
+ * @brief exec a query, serving it from the result cache while tag is not invalidated. Only successful results are cached
+ * @param tag: what the result depends on, e.g. "cliente:1". Writes to it must call db_cache_invalidate()
+ * @return shared, read only result. Free it with db_results_destroy() as usual. Always NOT NULL
+*/
+db_results_t *db_exec_cached(db_t *db, const char *tag, char *query, size_t params_count, ...);
+
+// exec a statement created with db_prepare() through the result cache, see db_exec_cached()
+db_results_t *db_exec_prepared_cached(db_t *db, const char *tag, char *name, size_t params_count, ...);
+
+/**
+ * @brief drop every cached result with tag. Call after the write commits
+*/
+void db_cache_invalidate(db_t *db, const char *tag);
+
+// read result cache counters
+db_cache_stats_t db_cache_stats(db_t *db);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,330 @@
+#include "db.h"
+#include "db_priv.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+// ------------------------------------------------------------ Log ----------------------------------------------------------------
+
+// Embedded storage: the memory store made durable by an append only log.
+// Every write appends a checksummed record to the current segment, segments rotate at DB_LOG_SEGMENT_SIZE and
+// every DB_LOG_SNAPSHOT_EVERY records the saldos and last transactions are written to a snapshot, after which the
+// segments it covers are deleted. Recovery loads the snapshot and replays the log tail, truncating a torn last record.
+// The data directory is the db database param. Builds on db_memory.h, included before this file
+
+#define DB_LOG_SEGMENT_SIZE (16 * 1024 * 1024)
+#define DB_LOG_SNAPSHOT_EVERY 8192
+#define DB_LOG_SNAPSHOT "snapshot"
+
+// log record, one per write
+typedef struct{
+	uint64_t checksum;					// djb2 of the bytes after this field
+	int64_t cliente;
+	int64_t saldo;						// saldo after the write
+	db_memory_transa_t transa;			// id 0 when only the saldo changed
+}db_log_record_t;
+
+// snapshot file
+typedef struct{
+	uint64_t checksum;					// djb2 of the bytes after this field
+	uint64_t segment;					// log position already applied
+	uint64_t offset;
+	int64_t transa_seq;
+
+	struct{
+		int64_t saldo;
+		uint64_t transacoes_count;
+		db_memory_transa_t transacoes[DB_MEMORY_EXTRATO];
+	}clientes[DB_MEMORY_CLIENTES];
+}db_log_snapshot_t;
+
+// writer state, kept in the store udata
+typedef struct{
+	const char *dir;
+	int fd;								// current segment
+	uint64_t segment;
+	uint64_t offset;
+	uint64_t since_snapshot;
+}db_log_t;
+
+#define db_log_checksum(ptr) djb2_hash((const uint8_t*)(ptr) + sizeof(uint64_t), sizeof(*(ptr)) - sizeof(uint64_t))
+
+// segment file path
+static void db_log_segment_path(char *path, const char *dir, uint64_t segment){
+	snprintf(path, PATH_MAX, "%s/%020lu.log", dir, segment);
+}
+
+// open current segment for appending
+static bool db_log_open(db_log_t *log){
+	char path[PATH_MAX];
+	db_log_segment_path(path, log->dir, log->segment);
+
+	log->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if(log->fd < 0){
+		printf("Fatal error. (Log): could not open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	log->offset = lseek(log->fd, 0, SEEK_END);
+	return true;
+}
+
+// write snapshot, replacing the previous one, and drop the segments it covers. call with the lock held
+static bool db_log_snapshot(db_memory_t *mem, db_log_t *log){
+	db_log_snapshot_t *snap = calloc(1, sizeof(db_log_snapshot_t));
+	snap->segment = log->segment;
+	snap->offset = log->offset;
+	snap->transa_seq = mem->transa_seq;
+
+	for(int i = 0; i < DB_MEMORY_CLIENTES; i++){
+		db_memory_cliente_t *c = &(mem->clientes[i]);
+		size_t count = c->transacoes_count < DB_MEMORY_EXTRATO ? c->transacoes_count : DB_MEMORY_EXTRATO;
+
+		snap->clientes[i].saldo = c->saldo;
+		snap->clientes[i].transacoes_count = count;
+		memcpy(snap->clientes[i].transacoes, c->transacoes + c->transacoes_count - count, sizeof(db_memory_transa_t) * count);
+	}
+
+	snap->checksum = db_log_checksum(snap);
+
+	char tmp[PATH_MAX], path[PATH_MAX];
+	snprintf(tmp, PATH_MAX, "%s/" DB_LOG_SNAPSHOT ".tmp", log->dir);
+	snprintf(path, PATH_MAX, "%s/" DB_LOG_SNAPSHOT, log->dir);
+
+	bool ok = false;
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd >= 0){
+		ok = write(fd, snap, sizeof(db_log_snapshot_t)) == sizeof(db_log_snapshot_t) && fsync(fd) == 0;
+		close(fd);
+	}
+
+	free(snap);
+
+	if(!ok || rename(tmp, path) != 0){
+		printf("Fatal error. (Log): could not write snapshot: %s\n", strerror(errno));
+		return false;
+	}
+
+	log->since_snapshot = 0;
+
+	// segments before the current one are fully covered now
+	for(uint64_t segment = log->segment; segment-- > 0;){
+		db_log_segment_path(path, log->dir, segment);
+		if(unlink(path) != 0)
+			break;
+	}
+
+	return true;
+}
+
+// persist a write. store hook, called with the lock held
+static void db_log_on_write(db_memory_t *mem, int64_t cliente, const db_memory_transa_t *transa){
+	db_log_t *log = mem->udata;
+
+	db_log_record_t record;
+	memset(&record, 0, sizeof(db_log_record_t));
+	record.cliente = cliente;
+	record.saldo = mem->clientes[cliente].saldo;
+	if(transa != NULL)
+		memcpy(&(record.transa), transa, sizeof(db_memory_transa_t));
+
+	record.checksum = db_log_checksum(&record);
+
+	if(write(log->fd, &record, sizeof(db_log_record_t)) != sizeof(db_log_record_t)){
+		printf("Fatal error. (Log): could not append to segment %lu: %s\n", log->segment, strerror(errno));
+		return;
+	}
+
+	log->offset += sizeof(db_log_record_t);
+	log->since_snapshot++;
+
+	// rotate
+	if(log->offset >= DB_LOG_SEGMENT_SIZE){
+		fdatasync(log->fd);
+		close(log->fd);
+		log->segment++;
+		if(!db_log_open(log))
+			return;
+	}
+
+	if(log->since_snapshot >= DB_LOG_SNAPSHOT_EVERY)
+		db_log_snapshot(mem, log);
+}
+
+// apply a record to the store
+static void db_log_apply(db_memory_t *mem, const db_log_record_t *record){
+	if(record->cliente < 1 || record->cliente >= DB_MEMORY_CLIENTES)
+		return;
+
+	mem->clientes[record->cliente].saldo = record->saldo;
+	if(record->transa.id != 0)
+		db_memory_push(mem, record->cliente, &(record->transa));
+}
+
+// load snapshot into the store, returns false when there is none or it is damaged
+static bool db_log_load_snapshot(db_memory_t *mem, db_log_t *log){
+	char path[PATH_MAX];
+	snprintf(path, PATH_MAX, "%s/" DB_LOG_SNAPSHOT, log->dir);
+
+	FILE *file = fopen(path, "rb");
+	if(file == NULL)
+		return false;
+
+	db_log_snapshot_t *snap = malloc(sizeof(db_log_snapshot_t));
+	bool ok = fread(snap, sizeof(db_log_snapshot_t), 1, file) == 1 && snap->checksum == db_log_checksum(snap);
+	fclose(file);
+
+	if(ok){
+		for(int i = 0; i < DB_MEMORY_CLIENTES; i++){
+			mem->clientes[i].saldo = snap->clientes[i].saldo;
+			for(uint64_t j = 0; j < snap->clientes[i].transacoes_count && j < DB_MEMORY_EXTRATO; j++)
+				db_memory_push(mem, i, &(snap->clientes[i].transacoes[j]));
+		}
+
+		mem->transa_seq = snap->transa_seq;
+		log->segment = snap->segment;
+		log->offset = snap->offset;
+	}
+	else
+		printf("Fatal error. (Log): damaged snapshot %s, replaying the whole log\n", path);
+
+	free(snap);
+	return ok;
+}
+
+// rebuild the store from the snapshot plus the log tail
+static bool db_log_recover(db_memory_t *mem, db_log_t *log){
+	DIR *dir = opendir(log->dir);
+	if(dir == NULL){
+		printf("Fatal error. (Log): could not open %s: %s\n", log->dir, strerror(errno));
+		return false;
+	}
+
+	// existing segments range
+	uint64_t first = UINT64_MAX, last = 0;
+	struct dirent *entry;
+	while((entry = readdir(dir)) != NULL){
+		uint64_t segment;
+		char ext[4];
+		if(sscanf(entry->d_name, "%20lu.%3s", &segment, ext) == 2 && strcmp(ext, "log") == 0){
+			if(segment < first) first = segment;
+			if(segment > last) last = segment;
+		}
+	}
+
+	closedir(dir);
+
+	if(!db_log_load_snapshot(mem, log)){
+		log->segment = first == UINT64_MAX ? 0 : first;
+		log->offset = 0;
+	}
+
+	if(last < log->segment)
+		last = log->segment;
+
+	// replay
+	uint64_t found = last;
+	size_t replayed = 0;
+	for(uint64_t segment = log->segment; segment <= last; segment++){
+		char path[PATH_MAX];
+		db_log_segment_path(path, log->dir, segment);
+
+		FILE *file = fopen(path, "r+b");
+		if(file == NULL)
+			continue;
+
+		long position = segment == log->segment ? (long)log->offset : 0;
+		fseek(file, position, SEEK_SET);
+
+		db_log_record_t record;
+		size_t read;
+		while((read = fread(&record, 1, sizeof(db_log_record_t), file)) > 0){
+			// torn or corrupted write, nothing after it can be trusted
+			if(read != sizeof(db_log_record_t) || record.checksum != db_log_checksum(&record)){
+				printf("Log: truncating %s at %ld\n", path, position);
+				fflush(file);
+				if(ftruncate(fileno(file), position) != 0)
+					printf("Fatal error. (Log): could not truncate %s: %s\n", path, strerror(errno));
+
+				// later segments hold records after the tear, the next appends would land before them
+				for(uint64_t later = segment + 1; later <= found; later++){
+					char later_path[PATH_MAX];
+					db_log_segment_path(later_path, log->dir, later);
+					if(unlink(later_path) == 0)
+						printf("Log: removed %s\n", later_path);
+					else if(errno != ENOENT)
+						printf("Fatal error. (Log): could not remove %s: %s\n", later_path, strerror(errno));
+				}
+
+				last = segment;
+				break;
+			}
+
+			db_log_apply(mem, &record);
+			position += sizeof(db_log_record_t);
+			replayed++;
+		}
+
+		fclose(file);
+	}
+
+	printf("Log: recovered %zu records from %s\n", replayed, log->dir);
+
+	log->segment = last;
+	log->since_snapshot = replayed;
+	return db_log_open(log);
+}
+
+// connection function. opens or creates the data directory and recovers the store
+static db_error_t db_connect_function_log(db_t *db){
+	if(mkdir(db->database, 0755) != 0 && errno != EEXIST){
+		printf("Fatal error. (Log): could not create %s: %s\n", db->database, strerror(errno));
+		db->state = db_state_failed_connection;
+		return db_error_connection_error;
+	}
+
+	db_log_t *log = calloc(1, sizeof(db_log_t));
+	log->dir = db->database;
+	log->fd = -1;
+
+	db_memory_t *mem = db_memory_new(DB_MEMORY_EXTRATO);
+	mem->udata = log;
+
+	if(!db_log_recover(mem, log)){
+		db_memory_free(mem);
+		free(log);
+		db->state = db_state_failed_connection;
+		return db_error_connection_error;
+	}
+
+	mem->on_write = db_log_on_write;
+
+	db->context.connections = mem;
+	db->context.available_connection = 0;
+	db->state = db_state_connected;
+	return db_error_ok;
+}
+
+// close db, leaving a fresh snapshot so the next start replays nothing
+static void db_destroy_function_log(db_t *db){
+	db_memory_t *mem = db->context.connections;
+	if(mem == NULL) return;
+
+	db_log_t *log = mem->udata;
+
+	pthread_mutex_lock(&(mem->lock));
+	db_log_snapshot(mem, log);
+	fdatasync(log->fd);
+	close(log->fd);
+	pthread_mutex_unlock(&(mem->lock));
+
+	free(log);
+	db_memory_free(mem);
+}
@@ -0,0 +1,545 @@
+#include "db.h"
+#include "db_priv.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+// ------------------------------------------------------------ Memory -------------------------------------------------------------
+
+// Mock database that understands only the queries issued by the app (see models/ and init.sql).
+// Used to profile the web tier without any external service
+
+#define DB_MEMORY_CLIENTES 6
+#define DB_MEMORY_EXTRATO 10
+#define DB_MEMORY_DESCRICAO 11
+#define DB_MEMORY_TIMESTAMP 27
+
+// transaction record
+typedef struct{
+	int64_t id;
+	int64_t valor;
+	bool tipo;
+	char descricao[DB_MEMORY_DESCRICAO];
+	char realizada_em[DB_MEMORY_TIMESTAMP];
+}db_memory_transa_t;
+
+// clientes row plus its transactions, oldest first
+typedef struct{
+	int64_t limite;
+	int64_t saldo;
+	int64_t taxa;							// rate limit columns, 0 as in init.sql
+	int64_t rajada;
+	db_memory_transa_t *transacoes;
+	size_t transacoes_count;
+	size_t transacoes_allocated;
+}db_memory_cliente_t;
+
+typedef struct db_memory_t db_memory_t;
+
+// called with the lock held after every write. transa is NULL when only the saldo changed
+typedef void (*db_memory_on_write)(db_memory_t *mem, int64_t cliente, const db_memory_transa_t *transa);
+
+// whole database
+struct db_memory_t{
+	pthread_mutex_t lock;
+	int64_t transa_seq;
+	db_memory_cliente_t clientes[DB_MEMORY_CLIENTES];
+	size_t transacoes_max;					// transactions kept per cliente, 0 keeps all
+	db_memory_on_write on_write;			// persistence hook, may be NULL
+	void *udata;
+};
+
+// queries known by the mock
+typedef enum{
+	db_memory_op_unknown = 0,
+	db_memory_op_clientes,
+	db_memory_op_transar,
+	db_memory_op_transar_publicar,
+	db_memory_op_saldar,
+	db_memory_op_extrato,
+	db_memory_op_transar_atomico,
+	db_memory_op_extrato_saldo,
+	db_memory_op_transar_lote,
+	db_memory_op_transar_lote_atomico,
+	db_memory_op_historico,
+	db_memory_op_copy
+}db_memory_op_t;
+
+// query text pattern to op, first match wins
+static const struct{
+	const char *pattern;
+	db_memory_op_t op;
+}db_memory_ops[] = {
+	{"copy (",								db_memory_op_copy},
+	{"from transacoes where cliente",		db_memory_op_historico},
+	{"transar_lote_atomico(",				db_memory_op_transar_lote_atomico},
+	{"transar_lote",						db_memory_op_transar_lote},
+	{"transar_publicar(",					db_memory_op_transar_publicar},
+	{"call transar(",						db_memory_op_transar},
+	{"call saldar(",						db_memory_op_saldar},
+	{"from extrato(",						db_memory_op_extrato},
+	{"update clientes set saldo = saldo +",	db_memory_op_transar_atomico},
+	{"left join extrato(",					db_memory_op_extrato_saldo},
+	{"from clientes",						db_memory_op_clientes},
+};
+
+// map query text to op
+static db_memory_op_t db_memory_op_map(const char *query){
+	for(size_t i = 0; i < sizeof(db_memory_ops) / sizeof(db_memory_ops[0]); i++){
+		if(strstr(query, db_memory_ops[i].pattern) != NULL)
+			return db_memory_ops[i].op;
+	}
+
+	return db_memory_op_unknown;
+}
+
+// new store, seeded with the same clients as init.sql
+static db_memory_t *db_memory_new(size_t transacoes_max){
+	db_memory_t *mem = calloc(1, sizeof(db_memory_t));
+	pthread_mutex_init(&(mem->lock), NULL);
+	mem->transacoes_max = transacoes_max;
+
+	const int64_t limites[DB_MEMORY_CLIENTES] = {0, 100000, 80000, 1000000, 10000000, 500000};
+	for(int i = 1; i < DB_MEMORY_CLIENTES; i++)
+		mem->clientes[i].limite = limites[i];
+
+	return mem;
+}
+
+// free store
+static void db_memory_free(db_memory_t *mem){
+	for(int i = 0; i < DB_MEMORY_CLIENTES; i++)
+		free(mem->clientes[i].transacoes);
+
+	pthread_mutex_destroy(&(mem->lock));
+	free(mem);
+}
+
+// connection function
+static db_error_t db_connect_function_memory(db_t *db){
+	db_memory_t *mem = db_memory_new(0);
+
+	db->context.connections = mem;
+	db->context.available_connection = 0;
+	db->state = db_state_connected;
+	return db_error_ok;
+}
+
+// stat connection
+static db_state_t db_stat_function_memory(db_t *db){
+	return db->context.connections != NULL ? db->state : db_state_invalid_db;
+}
+
+// take a slot of the simulated pool
+static inline void *db_request_conn_memory(db_t *db){
+	if(db->state != db_state_connected) return NULL;
+
+	// checked under the lock, or concurrent callers would all pass it and overflow the pool
+	pthread_mutex_lock(&(db->context.connections_lock));
+	bool full = db->context.available_connection >= db->context.connections_count;
+	if(!full)
+		db->context.available_connection++;
+	pthread_mutex_unlock(&(db->context.connections_lock));
+
+	return full ? NULL : db->context.connections;
+}
+
+// return slot of the simulated pool
+static inline void db_return_conn_memory(db_t *db, void *conn){
+	pthread_mutex_lock(&(db->context.connections_lock));
+	if(db->context.available_connection > 0)
+		db->context.available_connection--;
+	pthread_mutex_unlock(&(db->context.connections_lock));
+}
+
+// close db
+static void db_destroy_function_memory(db_t *db){
+	db_memory_t *mem = db->context.connections;
+	if(mem == NULL) return;
+
+	db_memory_free(mem);
+}
+
+// postgres like now()
+static void db_memory_now(char *dest){
+	struct timespec ts;
+	struct tm tm;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	localtime_r(&(ts.tv_sec), &tm);
+
+	size_t len = strftime(dest, DB_MEMORY_TIMESTAMP, "%F %T", &tm);
+	snprintf(dest + len, DB_MEMORY_TIMESTAMP - len, ".%06ld", ts.tv_nsec / 1000);
+}
+
+// push transaction record to cliente, dropping the oldest one past transacoes_max. call with the lock held
+static void db_memory_push(db_memory_t *mem, int64_t id, const db_memory_transa_t *transa){
+	db_memory_cliente_t *c = &(mem->clientes[id]);
+
+	if(mem->transacoes_max && c->transacoes_count == mem->transacoes_max){
+		memmove(c->transacoes, c->transacoes + 1, sizeof(db_memory_transa_t) * (c->transacoes_count - 1));
+		c->transacoes_count--;
+	}
+
+	if(c->transacoes_count == c->transacoes_allocated){
+		c->transacoes_allocated = c->transacoes_allocated ? c->transacoes_allocated * 2 : 64;
+		c->transacoes = realloc(c->transacoes, sizeof(db_memory_transa_t) * c->transacoes_allocated);
+	}
+
+	c->transacoes[c->transacoes_count] = *transa;
+	c->transacoes_count++;
+
+	if(transa->id > mem->transa_seq)
+		mem->transa_seq = transa->id;
+}
+
+// append new transaction to cliente, call with the lock held
+static void db_memory_append(db_memory_t *mem, int64_t id, bool tipo, int64_t valor, const char *descricao){
+	db_memory_transa_t t = {0};
+	t.id = mem->transa_seq + 1;
+	t.valor = valor;
+	t.tipo = tipo;
+	snprintf(t.descricao, DB_MEMORY_DESCRICAO, "%s", descricao);
+	db_memory_now(t.realizada_em);
+
+	db_memory_push(mem, id, &t);
+
+	if(mem->on_write != NULL)
+		mem->on_write(mem, id, &t);
+}
+
+// allocate result table. Strings of the entries live in ctx, freed with the result
+static db_results_t *db_memory_results(int64_t entries, int64_t fields, const char **names){
+	db_results_t *results = db_results_new(entries, fields, db_error_ok, "Query executed successfully. (Memory)\n");
+	if(entries == 0)
+		return results;
+
+	results->fields = malloc(sizeof(char*) * fields);
+	for(int64_t j = 0; j < fields; j++)
+		results->fields[j] = (char*)names[j];
+
+	results->entries = malloc(sizeof(db_field_t*) * entries);
+	for(int64_t i = 0; i < entries; i++)
+		results->entries[i] = calloc(fields, sizeof(db_field_t));
+
+	results->ctx = calloc(entries, DB_MEMORY_DESCRICAO + DB_MEMORY_TIMESTAMP);
+	return results;
+}
+
+// write the last transactions of cliente on results starting at row 0 and column col, call with the lock held
+static void db_memory_extrato(db_memory_cliente_t *c, db_results_t *results, int64_t rows, int64_t col){
+	char *strings = results->ctx;
+
+	for(int64_t i = 0; i < rows; i++){
+		db_memory_transa_t *t = &(c->transacoes[c->transacoes_count - 1 - i]);
+		char *desc = strings + i * (DB_MEMORY_DESCRICAO + DB_MEMORY_TIMESTAMP);
+		char *time = desc + DB_MEMORY_DESCRICAO;
+		memcpy(desc, t->descricao, DB_MEMORY_DESCRICAO);
+		memcpy(time, t->realizada_em, DB_MEMORY_TIMESTAMP);
+
+		results->entries[i][col]     = db_param_integer(t->valor);
+		results->entries[i][col + 1] = db_param_bool(t->tipo);
+		results->entries[i][col + 2] = db_param_string(desc, strlen(desc));
+		results->entries[i][col + 3] = db_param_string(time, strlen(time));
+	}
+}
+
+// exec query. When prepared is true, query is the name of a statement registered with db_prepare()
+static db_results_t *db_exec_function_memory(const db_t *db, void *connection, char *query, bool prepared, size_t params_count, va_list params){
+	db_memory_t *mem = connection;
+
+	if(prepared){
+		char *name = query;
+		query = NULL;
+		for(size_t i = 0; i < db->statements_count; i++){
+			if(strcmp(db->statements[i].name, name) == 0)
+				query = db->statements[i].query;
+		}
+
+		if(query == NULL)
+			return db_results_new_fmt(0, 0, db_error_fatal, "Fatal error. (Memory): prepared statement \"%s\" does not exist\n", name);
+	}
+
+	db_field_t args[8] = {0};
+	for(size_t i = 0; i < params_count && i < 8; i++)
+		args[i] = va_arg(params, db_field_t);
+
+	int64_t id = args[0].value.as_int;
+	db_memory_op_t op = db_memory_op_map(query);
+
+	if(op != db_memory_op_clientes && op != db_memory_op_unknown && (id < 1 || id >= DB_MEMORY_CLIENTES))
+		return db_results_new(0, 0, db_error_ok, "Query executed successfully. (Memory)\n");
+
+	db_results_t *results = NULL;
+	pthread_mutex_lock(&(mem->lock));
+
+	switch(op){
+		default:
+		case db_memory_op_unknown:
+			results = db_results_new_fmt(0, 0, db_error_fatal, "Fatal error. (Memory): query not supported by the mock: %s\n", query);
+		break;
+
+		case db_memory_op_clientes:
+		{
+			const char *names[] = {"id", "limite", "saldo", "taxa", "rajada"};
+			results = db_memory_results(DB_MEMORY_CLIENTES - 1, 5, names);
+			for(int64_t i = 1; i < DB_MEMORY_CLIENTES; i++){
+				results->entries[i - 1][0] = db_param_integer(i);
+				results->entries[i - 1][1] = db_param_integer(mem->clientes[i].limite);
+				results->entries[i - 1][2] = db_param_integer(mem->clientes[i].saldo);
+				results->entries[i - 1][3] = db_param_integer(mem->clientes[i].taxa);
+				results->entries[i - 1][4] = db_param_integer(mem->clientes[i].rajada);
+			}
+		}
+		break;
+
+		case db_memory_op_transar:
+		case db_memory_op_transar_publicar:
+			db_memory_append(mem, id, args[1].value.as_bool, args[2].value.as_int, args[3].value.as_string);
+			results = db_results_new(0, 0, db_error_ok, "Query executed successfully. (Memory)\n");
+		break;
+
+		case db_memory_op_transar_lote:
+			for(size_t i = 0; i < args[1].count; i++)
+				db_memory_append(mem, id, args[1].value.as_bool_array[i], args[2].value.as_int_array[i], args[3].value.as_string_array[i]);
+			results = db_results_new(0, 0, db_error_ok, "Query executed successfully. (Memory)\n");
+		break;
+
+		case db_memory_op_saldar:
+			mem->clientes[id].saldo = args[1].value.as_int;
+			if(mem->on_write != NULL)
+				mem->on_write(mem, id, NULL);
+			results = db_results_new(0, 0, db_error_ok, "Query executed successfully. (Memory)\n");
+		break;
+
+		case db_memory_op_extrato:
+		{
+			db_memory_cliente_t *c = &(mem->clientes[id]);
+			int64_t rows = c->transacoes_count < DB_MEMORY_EXTRATO ? c->transacoes_count : DB_MEMORY_EXTRATO;
+			const char *names[] = {"valor", "tipo", "descricao", "realizada_em"};
+			results = db_memory_results(rows, 4, names);
+			db_memory_extrato(c, results, rows, 0);
+		}
+		break;
+
+		case db_memory_op_transar_atomico:
+		{
+			db_memory_cliente_t *c = &(mem->clientes[id]);
+			int64_t valor = args[1].value.as_int;
+			bool credito = args[3].value.as_bool;
+			const char *names[] = {"saldo", "limite"};
+
+			if(!credito && c->saldo + valor <= -c->limite){
+				results = db_memory_results(0, 2, names);
+				break;
+			}
+
+			c->saldo += valor;
+			db_memory_append(mem, id, credito, valor > 0 ? valor : -valor, args[2].value.as_string);
+
+			results = db_memory_results(1, 2, names);
+			results->entries[0][0] = db_param_integer(c->saldo);
+			results->entries[0][1] = db_param_integer(c->limite);
+		}
+		break;
+
+		case db_memory_op_transar_lote_atomico:
+		{
+			db_memory_cliente_t *c = &(mem->clientes[id]);
+			const char *names[] = {"novo_saldo", "novo_limite"};
+			results = db_memory_results(args[1].count, 2, names);
+
+			// in order, refused items leave a null saldo
+			for(size_t i = 0; i < args[1].count; i++){
+				int64_t valor = args[1].value.as_int_array[i];
+				results->entries[i][1] = db_param_integer(c->limite);
+
+				// same rule as clientes_lote
+				if(valor < 0 && c->saldo + valor <= -c->limite){
+					results->entries[i][0] = db_param_null();
+					continue;
+				}
+
+				c->saldo += valor;
+				db_memory_append(mem, id, valor > 0, valor > 0 ? valor : -valor, args[2].value.as_string_array[i]);
+				results->entries[i][0] = db_param_integer(c->saldo);
+			}
+		}
+		break;
+
+		case db_memory_op_extrato_saldo:
+		{
+			db_memory_cliente_t *c = &(mem->clientes[id]);
+			int64_t rows = c->transacoes_count < DB_MEMORY_EXTRATO ? c->transacoes_count : DB_MEMORY_EXTRATO;
+			const char *names[] = {"saldo", "limite", "valor", "tipo", "descricao", "realizada_em"};
+
+			// left join, one row of nulls when there are no transactions
+			results = db_memory_results(rows > 0 ? rows : 1, 6, names);
+			db_memory_extrato(c, results, rows, 2);
+			for(int64_t i = 0; i < results->entries_count; i++){
+				results->entries[i][0] = db_param_integer(c->saldo);
+				results->entries[i][1] = db_param_integer(c->limite);
+			}
+		}
+		break;
+	}
+
+	pthread_mutex_unlock(&(mem->lock));
+	return results;
+}
+
+#define DB_MEMORY_STREAM_BATCH 64
+
+// stream rows, copied in batches so the lock isn't held while cb runs. Only the keyset history query is known:
+// id, valor, tipo, descricao, realizada_em of cliente $1 with id below $2, newest first, at most $3
+static db_results_t *db_stream_function_memory(const db_t *db, void *connection, char *query, size_t params_count, va_list params, db_row_cb cb, void *udata){
+	db_memory_t *mem = connection;
+
+	db_field_t args[3] = {0};
+	for(size_t i = 0; i < params_count && i < 3; i++)
+		args[i] = va_arg(params, db_field_t);
+
+	if(db_memory_op_map(query) != db_memory_op_historico || params_count != 3)
+		return db_results_new_fmt(0, 0, db_error_fatal, "Fatal error. (Memory): query not supported by the mock stream: %s\n", query);
+
+	int64_t id = args[0].value.as_int;
+	int64_t antes_de = args[1].value.as_int;
+	int64_t limite = args[2].value.as_int;
+	if(id < 1 || id >= DB_MEMORY_CLIENTES)
+		return db_results_new(0, 0, db_error_ok, "Query executed successfully. (Memory)\n");
+
+	const char *names[] = {"id", "valor", "tipo", "descricao", "realizada_em"};
+	db_memory_transa_t batch[DB_MEMORY_STREAM_BATCH];
+	bool more = true;
+
+	while(more && limite > 0){
+		size_t count = 0;
+
+		pthread_mutex_lock(&(mem->lock));
+		db_memory_cliente_t *c = &(mem->clientes[id]);
+
+		// ids grow with the array, the first one at or past the cursor bounds the batch
+		size_t lo = 0, hi = c->transacoes_count;
+		while(lo < hi){
+			size_t mid = (lo + hi) / 2;
+			if(c->transacoes[mid].id < antes_de)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		while(lo > 0 && count < DB_MEMORY_STREAM_BATCH && (int64_t)count < limite)
+			batch[count++] = c->transacoes[--lo];
+		more = lo > 0;
+		pthread_mutex_unlock(&(mem->lock));
+
+		for(size_t i = 0; i < count; i++){
+			db_results_t *row = db_memory_results(1, 5, names);
+			char *desc = row->ctx;
+			char *time = desc + DB_MEMORY_DESCRICAO;
+			memcpy(desc, batch[i].descricao, DB_MEMORY_DESCRICAO);
+			memcpy(time, batch[i].realizada_em, DB_MEMORY_TIMESTAMP);
+
+			row->entries[0][0] = db_param_integer(batch[i].id);
+			row->entries[0][1] = db_param_integer(batch[i].valor);
+			row->entries[0][2] = db_param_bool(batch[i].tipo);
+			row->entries[0][3] = db_param_string(desc, strlen(desc));
+			row->entries[0][4] = db_param_string(time, strlen(time));
+
+			bool next = cb(row, udata);
+			db_results_destroy(db, row);
+			if(!next)
+				return db_results_new(0, 0, db_error_ok, "Query executed successfully. (Memory)\n");
+		}
+
+		if(count > 0)
+			antes_de = batch[count - 1].id;
+		limite -= count;
+	}
+
+	return db_results_new(0, 0, db_error_ok, "Query executed successfully. (Memory)\n");
+}
+
+// copy out, one line per cb call as postgres sends it. Only the ledger export is known (see transa_exportar):
+// transactions of "cliente = N" oldest first, as csv (with header when asked) or as row_to_json lines
+static db_results_t *db_copy_out_function_memory(const db_t *db, void *connection, char *query, db_copy_cb cb, void *udata){
+	db_memory_t *mem = connection;
+
+	const char *where = strstr(query, "cliente = ");
+	if(db_memory_op_map(query) != db_memory_op_copy || where == NULL)
+		return db_results_new_fmt(0, 0, db_error_fatal, "Fatal error. (Memory): query not supported by the mock copy: %s\n", query);
+
+	int64_t id = strtoll(where + 10, NULL, 10);
+	bool json = strstr(query, "row_to_json") != NULL;
+	if(id < 1 || id >= DB_MEMORY_CLIENTES)
+		return db_results_new(0, 0, db_error_ok, "Query executed successfully. (Memory)\n");
+
+	char line[160];
+	const char header[] = "id,valor,tipo,descricao,realizada_em\n";
+	if(!json && strstr(query, "header") != NULL && !cb(header, sizeof(header) - 1, udata))
+		return db_results_new(0, 0, db_error_ok, "Query executed successfully. (Memory)\n");
+
+	db_memory_transa_t batch[DB_MEMORY_STREAM_BATCH];
+	int64_t depois_de = 0;
+	bool more = true;
+
+	while(more){
+		size_t count = 0;
+
+		pthread_mutex_lock(&(mem->lock));
+		db_memory_cliente_t *c = &(mem->clientes[id]);
+
+		// first id past the cursor
+		size_t lo = 0, hi = c->transacoes_count;
+		while(lo < hi){
+			size_t mid = (lo + hi) / 2;
+			if(c->transacoes[mid].id <= depois_de)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		while(lo < c->transacoes_count && count < DB_MEMORY_STREAM_BATCH)
+			batch[count++] = c->transacoes[lo++];
+		more = lo < c->transacoes_count;
+		pthread_mutex_unlock(&(mem->lock));
+
+		for(size_t i = 0; i < count; i++){
+			db_memory_transa_t *t = &(batch[i]);
+			int len;
+
+			if(json){
+				// row_to_json writes timestamps in iso format
+				char time[DB_MEMORY_TIMESTAMP];
+				memcpy(time, t->realizada_em, DB_MEMORY_TIMESTAMP);
+				time[10] = 'T';
+				len = snprintf(line, sizeof(line), "{\"id\":%ld,\"valor\":%ld,\"tipo\":\"%c\",\"descricao\":\"%s\",\"realizada_em\":\"%s\"}\n",
+					t->id, t->valor, t->tipo ? 'c' : 'd', t->descricao, time);
+			}
+			else{
+				// csv quotes fields with separators or quotes
+				bool quote = strpbrk(t->descricao, ",\"") != NULL;
+				len = snprintf(line, sizeof(line), "%ld,%ld,%c,%s%s%s,%s\n",
+					t->id, t->valor, t->tipo ? 'c' : 'd', quote ? "\"" : "", t->descricao, quote ? "\"" : "", t->realizada_em);
+			}
+
+			if(!cb(line, len, udata))
+				return db_results_new(0, 0, db_error_ok, "Query executed successfully. (Memory)\n");
+		}
+
+		if(count > 0)
+			depois_de = batch[count - 1].id;
+	}
+
+	return db_results_new(0, 0, db_error_ok, "Query executed successfully. (Memory)\n");
+}
+
+// free result strings
+static void db_result_destroy_context_memory(db_results_t *results){
+	free(results->ctx);
+}
+
+// memory held by the result strings
+static size_t db_result_size_memory(db_results_t *results){
+	return results->ctx != NULL ? results->entries_count * (DB_MEMORY_DESCRICAO + DB_MEMORY_TIMESTAMP) : 0;
+}
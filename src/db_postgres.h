@@ -5,6 +5,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <libpq-fe.h>
+#include <poll.h>
 
 // ------------------------------------------------------------ Postgres -----------------------------------------------------------
 
@@ -168,6 +169,77 @@ static void db_destroy_function_postgres(db_t *db){
 	}
 
 	free(db->context.connections);
+
+	if(db->context.listener != NULL)
+		PQfinish(db->context.listener);
+}
+
+// listen to channel on the dedicated connection, created on first call
+static int db_listen_function_postgres(db_t *db, const char *channel){
+	PGconn *conn = db->context.listener;
+
+	if(conn == NULL){
+		const char *keys[] = {
+			"host",
+			"port",
+			"dbname",
+			"user",
+			"password",
+			NULL
+		};
+
+		char *values[] = {
+			db->host,
+			db->port,
+			db->database,
+			db->user,
+			db->password,
+			NULL
+		};
+
+		conn = PQconnectdbParams((const char *const *)keys, (const char *const *)values, 0);
+
+		if(PQstatus(conn) == CONNECTION_BAD){
+			PQfinish(conn);
+			return -1;
+		}
+
+		db->context.listener = conn;
+	}
+
+	char *identifier = PQescapeIdentifier(conn, channel, strlen(channel));
+	if(identifier == NULL)
+		return -1;
+
+	string *query = string_new();
+	string_write(query, "listen %s", strlen(identifier) + 8, identifier);
+	PQfreemem(identifier);
+
+	PGresult *res = PQexec(conn, query->raw);
+	bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+	PQclear(res);
+	string_destroy(query);
+
+	return ok ? PQsocket(conn) : -1;
+}
+
+// read pending notifications from the dedicated connection
+static size_t db_notifications_function_postgres(db_t *db, db_notify_cb cb, void *udata){
+	PGconn *conn = db->context.listener;
+	if(conn == NULL) return 0;
+
+	if(!PQconsumeInput(conn))
+		return 0;
+
+	size_t count = 0;
+	PGnotify *notify;
+	while((notify = PQnotifies(conn)) != NULL){
+		cb(notify->relname, notify->extra, udata);
+		PQfreemem(notify);
+		count++;
+	}
+
+	return count;
 }
 
 // postgres oid from pg_types table
@@ -699,7 +771,7 @@ static void db_process_entries_postgres(db_results_t *results){
 				switch(entry.type){
 					case db_type_int_array:
 						entry.size = sizeof(int*);
-						entry.value.as_int_array = malloc(sizeof(int) * entry.count);
+						entry.value.as_int_array = malloc(sizeof(int64_t) * entry.count);
 					break;
 					case db_type_bool_array:
 						entry.size = sizeof(bool*);
@@ -707,7 +779,7 @@ static void db_process_entries_postgres(db_results_t *results){
 					break;
 					case db_type_float_array:
 						entry.size = sizeof(float*);
-						entry.value.as_float_array = malloc(sizeof(float) * entry.count);
+						entry.value.as_float_array = malloc(sizeof(double) * entry.count);
 					break;
 					case db_type_string_array:
 						entry.size = sizeof(char**);
@@ -759,97 +831,113 @@ static void db_process_entries_postgres(db_results_t *results){
 	}
 }
 
-static db_results_t *db_exec_function_postgres(const db_t *db, void *connection, char *query, size_t params_count, va_list params){
-	PGconn *conn = (PGconn*)connection;
-	db_results_t *results = db_results_new(0, 0, db_error_ok, NULL);
-
-	if(params_count == 0){															// no params
-		results->ctx = PQexec(conn, query);
-	}
-	else{																			// with params
-		char *query_params[params_count];
-		string *values[params_count];
+// prepare statement on all connections of the pool
+static db_error_t db_prepare_function_postgres(db_t *db, db_statement_t *statement){
+	PGconn **connections = db->context.connections;
 
-		// process params 
-		for(size_t i = 0; i < params_count; i++){									// for each param
-			db_field_t param = va_arg(params, db_field_t);
-			values[i] = string_new();
+	for(size_t i = 0; i < db->context.connections_count; i++){
+		PGresult *res = PQprepare(connections[i], statement->name, statement->query, statement->params_count, NULL);
+		db_error_t code = db_error_map_postgres(PQresultStatus(res));
 
-			if(param.type > db_type_arrays){										// for array type
-				string_cat_raw(values[i], "{", 0);
-				
-				for(size_t j = 0; j < param.count; j++){
+		if(code != db_error_ok)
+			printf("Could not prepare statement '%s': %s", statement->name, PQresultErrorMessage(res));
 
-					if(j != 0)
-						string_cat_raw(values[i], ",", 0);
+		PQclear(res);
 
-					switch(param.type){
-						case db_type_int_array:									// integer array
-							string_write(values[i], "%d", 25, param.value.as_int_array[j]);
-						break;
+		if(code != db_error_ok)
+			return code;
+	}
 
-						case db_type_bool_array:   									// bool array
-							string_write(values[i], "%s", 6, param.value.as_bool_array[j] ? "true" : "false");
-						break;
+	return db_error_ok;
+}
 
-						case db_type_float_array:  									// float array
-							string_write(values[i], "%f", 50, param.value.as_float_array[j]);
-						break;
+// write params as postgres text values, free them with string_destroy
+static void db_params_postgres(size_t params_count, va_list params, string **values, char **query_params){
+	// process params 
+	for(size_t i = 0; i < params_count; i++){									// for each param
+		db_field_t param = va_arg(params, db_field_t);
+		values[i] = string_new();
 
-						case db_type_string_array: 									// string array
-							string_write(values[i], "%s", strlen(param.value.as_string_array[j]) + 1, param.value.as_string_array[j]);
-						break;
+		if(param.type > db_type_arrays){										// for array type
+			string_cat_raw(values[i], "{", 0);
+			
+			for(size_t j = 0; j < param.count; j++){
 
-						// TODO add blob array type param
-						// case db_type_blob_array:   									// blob array
-						// break;
+				if(j != 0)
+					string_cat_raw(values[i], ",", 0);
 
-						default:
-							break;
-					}
-				}
-				string_cat_raw(values[i], "}", 0);
-			}
-			else{																	// for simple type
 				switch(param.type){
-					case db_type_int:												// integer
-						string_write(values[i], "%d", 25, param.value.as_int);
+					case db_type_int_array:									// integer array
+						string_write(values[i], "%ld", 25, param.value.as_int_array[j]);
 					break;
 
-					case db_type_bool:   											// bool
-						string_write(values[i], "%s", 6, param.value.as_bool ? "true" : "false");
+					case db_type_bool_array:   									// bool array
+						string_write(values[i], "%s", 6, param.value.as_bool_array[j] ? "true" : "false");
 					break;
 
-					case db_type_float:  											// float
-						string_write(values[i], "%f", 50, param.value.as_float);
+					case db_type_float_array:  									// float array
+						string_write(values[i], "%f", 50, param.value.as_float_array[j]);
 					break;
 
-					case db_type_string: 											// string
-						string_write(values[i], "%s", strlen(param.value.as_string) + 1, param.value.as_string);
+					case db_type_string_array: 									// string array, quoted so commas, braces and blanks survive
+					{
+						const char *elem = param.value.as_string_array[j];
+						string_cat_raw(values[i], "\"", 0);
+						for(const char *c = elem; *c != '\0'; c++){
+							if(*c == '"' || *c == '\\')
+								string_cat_raw(values[i], "\\", 0);
+							string_cat_raw(values[i], c, 1);
+						}
+						string_cat_raw(values[i], "\"", 0);
+					}
 					break;
 
-					// TODO add blob type param
-					case db_type_blob:												// blob
-					break;
+					// TODO add blob array type param
+					// case db_type_blob_array:   									// blob array
+					// break;
 
 					default:
-					case db_type_invalid:
-					case db_type_null:   											// null
-						string_write(values[i], "%s", 5, "null");
-					break;
+						break;
 				}
 			}
-
-			query_params[i] = values[i]->raw;
+			string_cat_raw(values[i], "}", 0);
+		}
+		else{																	// for simple type
+			switch(param.type){
+				case db_type_int:												// integer
+					string_write(values[i], "%ld", 25, param.value.as_int);
+				break;
+
+				case db_type_bool:   											// bool
+					string_write(values[i], "%s", 6, param.value.as_bool ? "true" : "false");
+				break;
+
+				case db_type_float:  											// float
+					string_write(values[i], "%f", 50, param.value.as_float);
+				break;
+
+				case db_type_string: 											// string
+					string_write(values[i], "%s", strlen(param.value.as_string) + 1, param.value.as_string);
+				break;
+
+				// TODO add blob type param
+				case db_type_blob:												// blob
+				break;
+
+				default:
+				case db_type_invalid:
+				case db_type_null:   											// null
+					string_write(values[i], "%s", 5, "null");
+				break;
+			}
 		}
 
-		// exec query 
-		results->ctx = PQexecParams(conn, query, params_count, NULL, (const char *const *)query_params, NULL, NULL, 0);
-
-		for(size_t i = 0; i < params_count; i++)									// free values
-			string_destroy(values[i]);
+		query_params[i] = values[i]->raw;
 	}
-	
+}
+
+// map the status of the PGresult in results->ctx to code and message
+static void db_results_status_postgres(const db_t *db, db_results_t *results){
 	// handle special error cases that the error map cant handle
 	if(results->ctx == NULL){
 		db_results_set_message(results, "Query response was null", db->vendor, PQresultErrorMessage(results->ctx));
@@ -884,6 +972,97 @@ static db_results_t *db_exec_function_postgres(const db_t *db, void *connection,
 			db_results_set_message(results, "Query executed successfully", db->vendor, msg);
 		}
 	}
+}
+
+// exec without blocking past the calling thread's deadline. The query is cancelled when it runs out, and the connection drained.
+// Returns the last result like PQexec, NULL with results->code set to db_error_timeout when the cancel won
+static PGresult *db_exec_deadline_postgres(const db_t *db, PGconn *conn, char *query, bool prepared, size_t params_count, const char *const *query_params, db_results_t *results){
+	int sent;
+	if(prepared)
+		sent = PQsendQueryPrepared(conn, query, params_count, query_params, NULL, NULL, 0);
+	else if(params_count == 0)
+		sent = PQsendQuery(conn, query);
+	else
+		sent = PQsendQueryParams(conn, query, params_count, NULL, query_params, NULL, NULL, 0);
+
+	if(!sent)
+		return NULL;
+
+	bool expired = false;
+	while(!expired && PQisBusy(conn)){
+		struct pollfd pfd = {.fd = PQsocket(conn), .events = POLLIN};
+		int wait = db_deadline_wait_ms();
+		int ready = wait == 0 ? 0 : poll(&pfd, 1, wait);
+
+		if(ready == 0)
+			expired = true;
+		else if(ready > 0 && !PQconsumeInput(conn))
+			break;
+	}
+
+	if(expired){
+		char msg[256];
+		PGcancel *cancel = PQgetCancel(conn);
+		PQcancel(cancel, msg, sizeof(msg));
+		PQfreeCancel(cancel);
+	}
+
+	// the query may still finish before the cancel lands, then its result stands
+	PGresult *last = NULL, *res;
+	while((res = PQgetResult(conn)) != NULL){
+		PQclear(last);
+		last = res;
+	}
+
+	ExecStatusType status = last != NULL ? PQresultStatus(last) : PGRES_FATAL_ERROR;
+	if(expired && status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK){
+		PQclear(last);
+		results->code = db_error_timeout;
+		db_results_set_message(results, "Request deadline exceeded", db->vendor, "query cancelled");
+		return NULL;
+	}
+
+	return last;
+}
+
+// when prepared is true, query holds the statement name
+static db_results_t *db_exec_function_postgres(const db_t *db, void *connection, char *query, bool prepared, size_t params_count, va_list params){
+	PGconn *conn = (PGconn*)connection;
+	db_results_t *results = db_results_new(0, 0, db_error_ok, NULL);
+
+	// no deadline, plain blocking calls
+	bool deadline = db_deadline_wait_ms() >= 0;
+
+	if(deadline && params_count == 0){
+		results->ctx = db_exec_deadline_postgres(db, conn, query, prepared, 0, NULL, results);
+	}
+	else if(params_count == 0 && prepared){											// no params, prepared
+		results->ctx = PQexecPrepared(conn, query, 0, NULL, NULL, NULL, 0);
+	}
+	else if(params_count == 0){														// no params
+		results->ctx = PQexec(conn, query);
+	}
+	else{																			// with params
+		char *query_params[params_count];
+		string *values[params_count];
+		db_params_postgres(params_count, params, values, query_params);
+
+		// exec query 
+		if(deadline)
+			results->ctx = db_exec_deadline_postgres(db, conn, query, prepared, params_count, (const char *const *)query_params, results);
+		else if(prepared)
+			results->ctx = PQexecPrepared(conn, query, params_count, (const char *const *)query_params, NULL, NULL, 0);
+		else
+			results->ctx = PQexecParams(conn, query, params_count, NULL, (const char *const *)query_params, NULL, NULL, 0);
+
+		for(size_t i = 0; i < params_count; i++)									// free values
+			string_destroy(values[i]);
+	}
+
+	if(results->code == db_error_timeout)
+		return results;
+	
+	db_results_status_postgres(db, results);
 
 	if(results->code == db_error_ok)
 		db_process_entries_postgres(results);
@@ -891,6 +1070,127 @@ static db_results_t *db_exec_function_postgres(const db_t *db, void *connection,
 	return results;
 }
 
+// rows one at a time in single row mode, the connection is busy until the last one. Returns the query status without entries
+static db_results_t *db_stream_function_postgres(const db_t *db, void *connection, char *query, size_t params_count, va_list params, db_row_cb cb, void *udata){
+	PGconn *conn = (PGconn*)connection;
+	db_results_t *results = db_results_new(0, 0, db_error_ok, NULL);
+
+	char *query_params[params_count + 1];
+	string *values[params_count + 1];
+	db_params_postgres(params_count, params, values, query_params);
+
+	int sent = PQsendQueryParams(conn, query, params_count, NULL, (const char *const *)query_params, NULL, NULL, 0);
+
+	for(size_t i = 0; i < params_count; i++)										// free values
+		string_destroy(values[i]);
+
+	if(!sent || !PQsetSingleRowMode(conn)){
+		results->code = db_error_fatal;
+		db_results_set_message(results, "Could not send query", db->vendor, PQerrorMessage(conn));
+
+		// drain whatever was sent, the connection goes back to the pool
+		PGresult *res;
+		while((res = PQgetResult(conn)) != NULL)
+			PQclear(res);
+
+		return results;
+	}
+
+	bool stop = false;
+	PGresult *res;
+	while((res = PQgetResult(conn)) != NULL){
+		if(PQresultStatus(res) == PGRES_SINGLE_TUPLE){
+			if(stop){
+				PQclear(res);
+				continue;
+			}
+
+			db_results_t *row = db_results_new(0, 0, db_error_ok, NULL);
+			row->ctx = res;
+			db_process_entries_postgres(row);
+			stop = !cb(row, udata);
+			db_results_destroy(db, row);
+
+			// the rest of the rows are not wanted
+			if(stop){
+				char msg[256];
+				PGcancel *cancel = PQgetCancel(conn);
+				PQcancel(cancel, msg, sizeof(msg));
+				PQfreeCancel(cancel);
+			}
+			continue;
+		}
+
+		// the final status, a cancel error when stopped early
+		if(results->ctx == NULL && !stop){
+			results->ctx = res;
+			db_results_status_postgres(db, results);
+		}
+		else
+			PQclear(res);
+	}
+
+	return results;
+}
+
+// relay copy data as libpq hands it, one row per buffer. Returns the copy status without entries
+static db_results_t *db_copy_out_function_postgres(const db_t *db, void *connection, char *query, db_copy_cb cb, void *udata){
+	PGconn *conn = (PGconn*)connection;
+	db_results_t *results = db_results_new(0, 0, db_error_ok, NULL);
+
+	PGresult *res = PQexec(conn, query);
+	if(PQresultStatus(res) != PGRES_COPY_OUT){
+		results->ctx = res;
+		db_results_status_postgres(db, results);
+		if(results->code == db_error_ok){
+			results->code = db_error_fatal;
+			db_results_set_message(results, "Not a copy to stdout", db->vendor, "");
+		}
+		return results;
+	}
+	PQclear(res);
+
+	bool stop = false;
+	char *buffer;
+	int len;
+	while((len = PQgetCopyData(conn, &buffer, 0)) > 0){
+		if(!stop){
+			stop = !cb(buffer, len, udata);
+
+			// the rest of the data is not wanted
+			if(stop){
+				char msg[256];
+				PGcancel *cancel = PQgetCancel(conn);
+				PQcancel(cancel, msg, sizeof(msg));
+				PQfreeCancel(cancel);
+			}
+		}
+		PQfreemem(buffer);
+	}
+
+	// the final status, a cancel error when stopped early
+	while((res = PQgetResult(conn)) != NULL){
+		if(results->ctx == NULL && !stop){
+			results->ctx = res;
+			db_results_status_postgres(db, results);
+		}
+		else
+			PQclear(res);
+	}
+
+	if(len == -2 && results->code == db_error_ok){
+		results->code = db_error_fatal;
+		db_results_set_message(results, "Copy failed", db->vendor, PQerrorMessage(conn));
+	}
+
+	return results;
+}
+
 static void db_result_destroy_context_postgres(db_results_t *results){
 	PQclear(results->ctx);
 }
+
+// memory held by the PGresult
+static size_t db_result_size_postgres(db_results_t *results){
+	return results->ctx != NULL ? PQresultMemorySize(results->ctx) : 0;
+}
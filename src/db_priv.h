@@ -17,8 +17,26 @@ db_error_t db_connect_function_map(db_t *db);
 // close db map
 void db_destroy_function_map(db_t *db);
 
-// exec query map
-static db_results_t *db_exec_function_map(const db_t *db, void *connection, char *query, size_t params_count, va_list params);
+// exec query map. When prepared is true, query is the statement name
+static db_results_t *db_exec_function_map(const db_t *db, void *connection, char *query, bool prepared, size_t params_count, va_list params);
+
+// stream query rows map
+static db_results_t *db_stream_function_map(const db_t *db, void *connection, char *query, size_t params_count, va_list params, db_row_cb cb, void *udata);
+
+// copy out map
+static db_results_t *db_copy_out_function_map(const db_t *db, void *connection, char *query, db_copy_cb cb, void *udata);
+
+// prepare statement map
+static db_error_t db_prepare_function_map(db_t *db, db_statement_t *statement);
+
+// memory held by a result's vendor context map
+static size_t db_results_size_map(const db_t *db, db_results_t *results);
+
+// free result cache
+static void db_cache_free(db_t *db);
+
+// ms left before the calling thread's deadline, as a poll() timeout: -1 without one, 0 once it passed
+static int db_deadline_wait_ms(void);
 
 // ------------------------------------------------------------ Error handlng ------------------------------------------------------
 
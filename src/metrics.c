@@ -0,0 +1,128 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// ------------------------------------------------------------ Types --------------------------------------------------------------
+
+// one thread's histograms, only that thread writes them
+typedef struct metrics_block_t{
+	struct metrics_block_t *next;
+	metrics_histogram_t histograms[];
+}metrics_block_t;
+
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;		// taken once per thread, to join the list
+static metrics_block_t *metrics_blocks = NULL;
+static size_t metrics_histograms = 0;
+static __thread metrics_block_t *metrics_local = NULL;
+
+// le bounds of the prometheus buckets, in microseconds. Each is a bucket edge, 5, 6, 7 or 8 << n, the nearest to the usual
+// 100us, 250us ... 10s: a bound inside a bucket would count it whole under the next one
+static const uint64_t metrics_bounds[] = {
+	96, 256, 512, 1024, 2560, 5120, 10240, 24576, 49152, 98304, 262144, 524288, 1048576, 2621440, 5242880, 10485760
+};
+
+// ------------------------------------------------------------ Helpers ------------------------------------------------------------
+
+// the calling thread's block, created on its first record
+static metrics_block_t *metrics_block(void){
+	if(metrics_local != NULL)
+		return metrics_local;
+
+	metrics_block_t *block = calloc(1, sizeof(metrics_block_t) + sizeof(metrics_histogram_t) * metrics_histograms);
+
+	pthread_mutex_lock(&metrics_lock);
+	block->next = metrics_blocks;
+	__atomic_store_n(&metrics_blocks, block, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&metrics_lock);
+
+	metrics_local = block;
+	return block;
+}
+
+// single writer: a plain add, published so a scrape never reads a torn value
+static inline void metrics_inc(uint64_t *value, uint64_t n){
+	__atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+// values below METRICS_SUB get a bucket each, then METRICS_SUB buckets per power of two
+static size_t metrics_bucket(uint64_t usec){
+	if(usec < METRICS_SUB)
+		return usec;
+
+	int exp = 63 - __builtin_clzll(usec);
+	size_t bucket = (size_t)(exp - METRICS_SUB_BITS + 1) * METRICS_SUB + ((usec >> (exp - METRICS_SUB_BITS)) & (METRICS_SUB - 1));
+	return bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1;
+}
+
+// smallest value above the bucket
+static uint64_t metrics_bucket_end(size_t bucket){
+	if(bucket < METRICS_SUB)
+		return bucket + 1;
+
+	int exp = bucket / METRICS_SUB + METRICS_SUB_BITS - 1;
+	return (uint64_t)(METRICS_SUB + bucket % METRICS_SUB + 1) << (exp - METRICS_SUB_BITS);
+}
+
+// ------------------------------------------------------------ Functions ----------------------------------------------------------
+
+void metrics_init(size_t histograms){
+	metrics_histograms = histograms;
+}
+
+void metrics_destroy(void){
+	pthread_mutex_lock(&metrics_lock);
+	metrics_block_t *block = metrics_blocks;
+	metrics_blocks = NULL;
+	pthread_mutex_unlock(&metrics_lock);
+
+	while(block != NULL){
+		metrics_block_t *next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+void metrics_observe(size_t histogram, uint64_t usec){
+	if(histogram >= metrics_histograms)
+		return;
+
+	metrics_histogram_t *h = &(metrics_block()->histograms[histogram]);
+	metrics_inc(&(h->counts[metrics_bucket(usec)]), 1);
+	metrics_inc(&(h->sum_us), usec);
+}
+
+void metrics_histogram_read(size_t histogram, metrics_histogram_t *out){
+	*out = (metrics_histogram_t){0};
+	if(histogram >= metrics_histograms)
+		return;
+
+	for(metrics_block_t *block = __atomic_load_n(&metrics_blocks, __ATOMIC_ACQUIRE); block != NULL; block = block->next){
+		metrics_histogram_t *h = &(block->histograms[histogram]);
+		for(size_t i = 0; i < METRICS_BUCKETS; i++)
+			out->counts[i] += __atomic_load_n(&(h->counts[i]), __ATOMIC_RELAXED);
+		out->sum_us += __atomic_load_n(&(h->sum_us), __ATOMIC_RELAXED);
+	}
+
+	// the count comes from the buckets, so the +Inf line always matches them
+	for(size_t i = 0; i < METRICS_BUCKETS; i++)
+		out->count += out->counts[i];
+}
+
+void metrics_write_histogram(string *out, const char *name, const char *labels, const metrics_histogram_t *histogram){
+	const char *sep = *labels ? "," : "";
+
+	// the bounds are bucket edges, so every bucket is wholly below or above each of them
+	uint64_t total = 0;
+	size_t bucket = 0;
+	for(size_t b = 0; b < sizeof(metrics_bounds) / sizeof(metrics_bounds[0]); b++){
+		while(bucket < METRICS_BUCKETS && metrics_bucket_end(bucket) <= metrics_bounds[b])
+			total += histogram->counts[bucket++];
+
+		string_write(out, "%s_bucket{%s%sle=\"%g\"} %lu\n", 256, name, labels, sep, metrics_bounds[b] / 1e6, total);
+	}
+
+	string_write(out, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", 256, name, labels, sep, histogram->count);
+	string_write(out, "%s_sum%s%s%s %.6f\n", 256, name, *labels ? "{" : "", labels, *labels ? "}" : "", histogram->sum_us / 1e6);
+	string_write(out, "%s_count%s%s%s %lu\n", 256, name, *labels ? "{" : "", labels, *labels ? "}" : "", histogram->count);
+}
@@ -0,0 +1,50 @@
+#ifndef _METRICS_HEADER_
+#define _METRICS_HEADER_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "string+.h"
+
+#define METRICS_SUB_BITS 2					// 4 buckets per power of two, values within 25%
+#define METRICS_SUB (1 << METRICS_SUB_BITS)
+#define METRICS_BUCKETS (33 * METRICS_SUB)	// microseconds up to 2^34, about 4.7 hours
+
+// ------------------------------------------------------------ Types --------------------------------------------------------------
+
+// latency histogram in microseconds, log linear buckets as in HDR histograms
+typedef struct{
+	uint64_t counts[METRICS_BUCKETS];
+	uint64_t count;
+	uint64_t sum_us;
+}metrics_histogram_t;
+
+// ------------------------------------------------------------ Functions ----------------------------------------------------------
+
+/**
+ * @brief size the registry: histograms are addressed by index, from 0. Call once before any thread records
+*/
+void metrics_init(size_t histograms);
+
+/**
+ * @brief free every thread's block. Call after the threads stopped
+*/
+void metrics_destroy(void);
+
+/**
+ * @brief record a latency on the calling thread's block. No locks or atomic read-modify-writes, each thread writes only its own block
+*/
+void metrics_observe(size_t histogram, uint64_t usec);
+
+/**
+ * @brief sum a histogram over every thread into out
+*/
+void metrics_histogram_read(size_t histogram, metrics_histogram_t *out);
+
+/**
+ * @brief write a histogram in the prometheus text format, in seconds, with le bounds on bucket edges. labels is the inside of the braces, may be empty.
+ * The HELP and TYPE lines are left to the caller
+*/
+void metrics_write_histogram(string *out, const char *name, const char *labels, const metrics_histogram_t *histogram);
+
+#endif
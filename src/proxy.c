@@ -0,0 +1,847 @@
+#include "proxy.h"
+#include "hash.h"
+#include "../facil.io/fio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#define PROXY_READ 16384
+#define PROXY_ADDRESS_LEN 256
+
+#define PROXY_RESPONSE(status) "HTTP/1.1 " status "\r\ncontent-length:0\r\n\r\n"
+#define PROXY_RESPONSE_CLOSE(status) "HTTP/1.1 " status "\r\nconnection:close\r\ncontent-length:0\r\n\r\n"
+
+// ------------------------------------------------------------ Types --------------------------------------------------------------
+
+// growable byte buffer
+typedef struct{
+	char *data;
+	size_t len;
+	size_t capa;
+}proxy_buffer_t;
+
+// request waiting for, or being written to, an upstream connection
+typedef struct proxy_pending_t{
+	struct proxy_pending_t *next;
+	proxy_on_response on_response;
+	void *udata;
+	size_t len;
+	char request[];
+}proxy_pending_t;
+
+typedef struct proxy_backend_t proxy_backend_t;
+
+// pooled keep-alive connection to a backend, one request in flight at a time
+typedef struct{
+	fio_protocol_s protocol;
+	proxy_backend_t *backend;
+	intptr_t uuid;
+	proxy_on_response on_response;			// NULL while idle
+	void *udata;
+	bool until_close;						// response without length, ends with the connection
+	proxy_buffer_t in;
+}proxy_upstream_t;
+
+struct proxy_backend_t{
+	char address[PROXY_ADDRESS_LEN];
+	char port[16];							// empty for unix sockets
+	pthread_mutex_t lock;
+	volatile bool healthy;
+	size_t total;							// open and connecting
+	size_t max;
+	proxy_upstream_t **idle;
+	size_t idle_count;
+	proxy_pending_t *queue;
+	proxy_pending_t **queue_tail;
+};
+
+// point on the hash ring
+typedef struct{
+	uint64_t hash;
+	int backend;
+}proxy_point_t;
+
+struct proxy_t{
+	proxy_backend_t backends[PROXY_MAX_BACKENDS];
+	size_t count;
+	proxy_point_t ring[PROXY_MAX_BACKENDS * PROXY_VNODES];
+	size_t ring_len;
+	bool failover;							// keys of a backend that is down go to the next one
+};
+
+typedef struct proxy_client_t proxy_client_t;
+
+// response position of a pipelined request
+typedef struct proxy_slot_t{
+	struct proxy_slot_t *next;
+	proxy_client_t *client;
+	char *response;							// NULL until the backend answers
+	size_t len;
+	bool close;								// close the client after this response
+}proxy_slot_t;
+
+// load balancer client connection
+struct proxy_client_t{
+	fio_protocol_s protocol;
+	proxy_t *proxy;
+	intptr_t uuid;
+	proxy_buffer_t in;						// unparsed request bytes, only touched by on_data
+	pthread_mutex_t lock;					// guards everything below
+	proxy_slot_t *head;
+	proxy_slot_t **tail;
+	size_t in_flight;
+	size_t refs;							// the connection plus one per slot
+	bool closed;
+	bool suspended;
+};
+
+// ------------------------------------------------------------ Buffer -------------------------------------------------------------
+
+// make room for size more bytes, returns the write position
+static char *proxy_buffer_reserve(proxy_buffer_t *buffer, size_t size){
+	if(buffer->capa - buffer->len < size){
+		size_t capa = buffer->capa ? buffer->capa : PROXY_READ;
+		while(capa - buffer->len < size)
+			capa *= 2;
+
+		buffer->data = realloc(buffer->data, capa);
+		buffer->capa = capa;
+	}
+
+	return buffer->data + buffer->len;
+}
+
+// drop the first len bytes
+static void proxy_buffer_consume(proxy_buffer_t *buffer, size_t len){
+	buffer->len -= len;
+	if(buffer->len)
+		memmove(buffer->data, buffer->data + len, buffer->len);
+}
+
+// read everything available from a socket, up to limit buffered bytes. false when the connection is gone
+static bool proxy_buffer_read(proxy_buffer_t *buffer, intptr_t uuid, size_t limit){
+	while(buffer->len < limit){
+		char *dest = proxy_buffer_reserve(buffer, PROXY_READ);
+		ssize_t read = fio_read(uuid, dest, PROXY_READ);
+		if(read < 0)
+			return false;
+		if(read == 0)
+			break;
+
+		buffer->len += read;
+	}
+
+	return true;
+}
+
+// ------------------------------------------------------------ HTTP framing -------------------------------------------------------
+
+// length of the head, blank line included. 0 while incomplete
+static size_t proxy_head_len(const char *data, size_t len){
+	for(size_t i = 3; i < len; i++){
+		if(data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r')
+			return i + 1;
+	}
+
+	return 0;
+}
+
+// find a header value in a head, NULL when missing
+static const char *proxy_header(const char *head, size_t len, const char *name, size_t *value_len){
+	size_t name_len = strlen(name);
+	const char *end = head + len;
+	const char *line = memchr(head, '\n', len);
+
+	while(line != NULL && ++line < end){
+		const char *eol = memchr(line, '\n', end - line);
+		if(eol == NULL)
+			break;
+
+		if((size_t)(eol - line) > name_len && line[name_len] == ':' && strncasecmp(line, name, name_len) == 0){
+			const char *value = line + name_len + 1;
+			while(value < eol && (*value == ' ' || *value == '\t'))
+				value++;
+
+			const char *value_end = eol;
+			while(value_end > value && (value_end[-1] == '\r' || value_end[-1] == ' '))
+				value_end--;
+
+			*value_len = value_end - value;
+			return value;
+		}
+
+		line = eol;
+	}
+
+	return NULL;
+}
+
+// header value starts with token, case insensitive
+static bool proxy_header_is(const char *head, size_t len, const char *name, const char *token){
+	size_t value_len;
+	const char *value = proxy_header(head, len, name, &value_len);
+	size_t token_len = strlen(token);
+	return value != NULL && value_len >= token_len && strncasecmp(value, token, token_len) == 0;
+}
+
+// frame a request: total length, 0 while incomplete, -1 when it can't be proxied.
+// The route key is the first number of the path ("/clientes/1/extrato"), 0 without one
+static ssize_t proxy_request_len(const char *data, size_t len, int64_t *key, bool *close){
+	size_t head = proxy_head_len(data, len < PROXY_MAX_REQUEST ? len : PROXY_MAX_REQUEST);
+	if(head == 0)
+		return len < PROXY_MAX_REQUEST ? 0 : -1;
+
+	// request line: method path version
+	const char *path = memchr(data, ' ', head);
+	const char *eol = memchr(data, '\r', head);
+	if(path == NULL || eol == NULL || path > eol)
+		return -1;
+
+	*key = 0;
+	for(const char *c = path + 1; c < eol && *c != ' ' && *c != '?'; c++){
+		if(*c >= '0' && *c <= '9'){
+			while(c < eol && *c >= '0' && *c <= '9')
+				*key = *key * 10 + (*c++ - '0');
+			break;
+		}
+	}
+
+	// http/1.0 closes unless asked not to
+	bool http10 = eol - data >= 8 && memcmp(eol - 8, "HTTP/1.0", 8) == 0;
+	*close = http10 ? !proxy_header_is(data, head, "connection", "keep-alive") : proxy_header_is(data, head, "connection", "close");
+
+	if(proxy_header(data, head, "transfer-encoding", &(size_t){0}) != NULL)
+		return -1;
+
+	size_t value_len;
+	const char *value = proxy_header(data, head, "content-length", &value_len);
+	size_t body = value != NULL ? strtoull(value, NULL, 10) : 0;
+	if(head + body > PROXY_MAX_REQUEST)
+		return -1;
+
+	return head + body <= len ? (ssize_t)(head + body) : 0;
+}
+
+// end of a chunked body starting at data, 0 while incomplete. Trailers are not expected
+static size_t proxy_chunked_len(const char *data, size_t len){
+	size_t pos = 0;
+	for(;;){
+		const char *eol = memchr(data + pos, '\n', len - pos);
+		if(eol == NULL)
+			return 0;
+
+		size_t size = strtoull(data + pos, NULL, 16);
+		pos = (eol - data) + 1;
+
+		if(size == 0)
+			return pos + 2 <= len ? pos + 2 : 0;
+
+		pos += size + 2;
+		if(pos >= len)
+			return 0;
+	}
+}
+
+// frame a response: total length, 0 while incomplete or when it ends with the connection (until_close)
+static size_t proxy_response_len(const char *data, size_t len, bool *until_close){
+	*until_close = false;
+
+	size_t head = proxy_head_len(data, len);
+	if(head == 0 || head < 12)
+		return 0;
+
+	// no body for 1xx, 204 and 304
+	int status = atoi(data + 9);
+	if(status < 200 || status == 204 || status == 304)
+		return head;
+
+	size_t value_len;
+	const char *value = proxy_header(data, head, "content-length", &value_len);
+	if(value != NULL){
+		size_t total = head + strtoull(value, NULL, 10);
+		return total <= len ? total : 0;
+	}
+
+	if(proxy_header_is(data, head, "transfer-encoding", "chunked")){
+		size_t body = proxy_chunked_len(data + head, len - head);
+		return body ? head + body : 0;
+	}
+
+	*until_close = true;
+	return 0;
+}
+
+// ------------------------------------------------------------ Upstream -----------------------------------------------------------
+
+static void proxy_upstream_on_data(intptr_t uuid, fio_protocol_s *protocol);
+static void proxy_upstream_on_close(intptr_t uuid, fio_protocol_s *protocol);
+static void proxy_backend_connect(proxy_backend_t *backend);
+
+// write a request, the pending entry is released by the socket layer
+static void proxy_upstream_send(proxy_upstream_t *up, proxy_pending_t *pending){
+	up->on_response = pending->on_response;
+	up->udata = pending->udata;
+	fio_write2(up->uuid, .data.buffer = pending, .offset = offsetof(proxy_pending_t, request), .length = pending->len, .after.dealloc = free);
+}
+
+// connection is free: take the next queued request or go back to the pool
+static void proxy_upstream_release(proxy_upstream_t *up){
+	proxy_backend_t *backend = up->backend;
+
+	pthread_mutex_lock(&(backend->lock));
+	proxy_pending_t *pending = backend->queue;
+	if(pending != NULL){
+		backend->queue = pending->next;
+		if(backend->queue == NULL)
+			backend->queue_tail = &(backend->queue);
+	}
+	else
+		backend->idle[backend->idle_count++] = up;
+	pthread_mutex_unlock(&(backend->lock));
+
+	if(pending != NULL)
+		proxy_upstream_send(up, pending);
+}
+
+// hand a complete response to its requester
+static void proxy_upstream_respond(proxy_upstream_t *up, size_t len){
+	char *response;
+	if(len == up->in.len){
+		proxy_buffer_reserve(&(up->in), 1)[0] = '\0';
+		response = up->in.data;
+		up->in = (proxy_buffer_t){0};
+	}
+	else{
+		response = malloc(len + 1);
+		memcpy(response, up->in.data, len);
+		response[len] = '\0';
+		proxy_buffer_consume(&(up->in), len);
+	}
+
+	proxy_on_response on_response = up->on_response;
+	void *udata = up->udata;
+	up->on_response = NULL;
+	up->until_close = false;
+
+	// the backend is about to close this one, don't reuse it
+	size_t head = proxy_head_len(response, len);
+	bool reuse = !proxy_header_is(response, head, "connection", "close");
+
+	on_response(response, len, udata);
+
+	if(reuse)
+		proxy_upstream_release(up);
+	else
+		fio_close(up->uuid);
+}
+
+static void proxy_upstream_on_data(intptr_t uuid, fio_protocol_s *protocol){
+	proxy_upstream_t *up = (proxy_upstream_t*)protocol;
+	if(!proxy_buffer_read(&(up->in), uuid, SIZE_MAX))
+		return;
+
+	// nothing was asked
+	if(up->on_response == NULL){
+		up->in.len = 0;
+		return;
+	}
+
+	size_t len = proxy_response_len(up->in.data, up->in.len, &(up->until_close));
+	if(len > 0)
+		proxy_upstream_respond(up, len);
+}
+
+// idle pooled connections stay open
+static void proxy_upstream_ping(intptr_t uuid, fio_protocol_s *protocol){
+	fio_touch(uuid);
+}
+
+static void proxy_upstream_on_close(intptr_t uuid, fio_protocol_s *protocol){
+	proxy_upstream_t *up = (proxy_upstream_t*)protocol;
+	proxy_backend_t *backend = up->backend;
+
+	// response delimited by the end of the connection
+	if(up->on_response != NULL && up->until_close && up->in.len > 0){
+		proxy_on_response on_response = up->on_response;
+		up->on_response = NULL;
+		proxy_buffer_reserve(&(up->in), 1)[0] = '\0';
+		on_response(up->in.data, up->in.len, up->udata);
+		up->in = (proxy_buffer_t){0};
+	}
+
+	pthread_mutex_lock(&(backend->lock));
+	for(size_t i = 0; i < backend->idle_count; i++){
+		if(backend->idle[i] == up){
+			backend->idle[i] = backend->idle[--backend->idle_count];
+			break;
+		}
+	}
+
+	backend->total--;
+
+	// queued requests still need a connection
+	bool connect = backend->queue != NULL && backend->total < backend->max;
+	if(connect)
+		backend->total++;
+	pthread_mutex_unlock(&(backend->lock));
+
+	// in flight, the request may or may not have been applied
+	if(up->on_response != NULL)
+		up->on_response(NULL, 0, up->udata);
+
+	free(up->in.data);
+	free(up);
+
+	if(connect)
+		proxy_backend_connect(backend);
+}
+
+static void proxy_upstream_on_connect(intptr_t uuid, void *udata){
+	proxy_backend_t *backend = udata;
+
+	proxy_upstream_t *up = calloc(1, sizeof(proxy_upstream_t));
+	up->protocol.on_data = proxy_upstream_on_data;
+	up->protocol.on_close = proxy_upstream_on_close;
+	up->protocol.ping = proxy_upstream_ping;
+	up->backend = backend;
+	up->uuid = uuid;
+
+	fio_attach(uuid, &(up->protocol));
+
+	if(!backend->healthy)
+		printf("Proxy: backend [%s%s%s] is up\n", backend->address, *backend->port ? ":" : "", backend->port);
+	backend->healthy = true;
+
+	proxy_upstream_release(up);
+}
+
+// connection failed: the backend is down, fail what waits for it when no other connection can serve it
+static void proxy_upstream_on_fail(intptr_t uuid, void *udata){
+	proxy_backend_t *backend = udata;
+
+	pthread_mutex_lock(&(backend->lock));
+	backend->total--;
+
+	proxy_pending_t *orphans = NULL;
+	if(backend->total == 0){
+		orphans = backend->queue;
+		backend->queue = NULL;
+		backend->queue_tail = &(backend->queue);
+	}
+	pthread_mutex_unlock(&(backend->lock));
+
+	if(backend->healthy)
+		printf("Proxy: backend [%s%s%s] is down\n", backend->address, *backend->port ? ":" : "", backend->port);
+	backend->healthy = false;
+
+	while(orphans != NULL){
+		proxy_pending_t *next = orphans->next;
+		orphans->on_response(NULL, 0, orphans->udata);
+		free(orphans);
+		orphans = next;
+	}
+}
+
+// open a new pooled connection. The caller already counted it in total
+static void proxy_backend_connect(proxy_backend_t *backend){
+	fio_connect(
+		.address = backend->address,
+		.port = *backend->port ? backend->port : NULL,
+		.on_connect = proxy_upstream_on_connect,
+		.on_fail = proxy_upstream_on_fail,
+		.udata = backend,
+		.timeout = 2
+	);
+}
+
+// ------------------------------------------------------------ Backends -----------------------------------------------------------
+
+// spread keys and ring points over the whole range
+static uint64_t proxy_mix(uint64_t x){
+	x += 0x9e3779b97f4a7c15;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+	return x ^ (x >> 31);
+}
+
+static int proxy_point_compare(const void *a, const void *b){
+	uint64_t ha = ((const proxy_point_t*)a)->hash;
+	uint64_t hb = ((const proxy_point_t*)b)->hash;
+	return ha < hb ? -1 : ha > hb;
+}
+
+// probe backends without connections, a successful probe stays in the pool
+static void proxy_health(void *udata){
+	proxy_t *proxy = udata;
+
+	for(size_t i = 0; i < proxy->count; i++){
+		proxy_backend_t *backend = &(proxy->backends[i]);
+
+		pthread_mutex_lock(&(backend->lock));
+		bool connect = backend->total == 0;
+		if(connect)
+			backend->total++;
+		pthread_mutex_unlock(&(backend->lock));
+
+		if(connect)
+			proxy_backend_connect(backend);
+	}
+}
+
+// start health checks with the reactor, in every worker
+static void proxy_on_start(void *udata){
+	proxy_health(udata);
+	fio_run_every(PROXY_HEALTH_MS, 0, proxy_health, udata, NULL);
+}
+
+// !trivial
+size_t proxy_backends(proxy_t *proxy){
+	return proxy->count;
+}
+
+// split "host:port" or "unix:/path" (empty port)
+static bool proxy_parse(const char *entry, size_t len, char address[PROXY_ADDRESS_LEN], char port[16]){
+	if(len == 0 || len >= PROXY_ADDRESS_LEN)
+		return false;
+
+	if(len > 5 && strncmp(entry, "unix:", 5) == 0){
+		memcpy(address, entry + 5, len - 5);
+		address[len - 5] = '\0';
+		*port = '\0';
+		return true;
+	}
+
+	const char *colon = entry + len - 1;
+	while(colon > entry && *colon != ':')
+		colon--;
+
+	size_t port_len = len - (colon - entry) - 1;
+	if(*colon != ':' || port_len == 0 || port_len >= 16)
+		return false;
+
+	memcpy(address, entry, colon - entry);
+	address[colon - entry] = '\0';
+	memcpy(port, colon + 1, port_len);
+	port[port_len] = '\0';
+	return true;
+}
+
+proxy_t *proxy_new(const char *backends, size_t conns){
+	if(backends == NULL || conns == 0)
+		return NULL;
+
+	proxy_t *proxy = calloc(1, sizeof(proxy_t));
+
+	// "host:port,unix:/path"
+	const char *cursor = backends;
+	while(*cursor != '\0'){
+		const char *end = strchr(cursor, ',');
+		size_t len = end != NULL ? (size_t)(end - cursor) : strlen(cursor);
+
+		if(len > 0){
+			proxy_backend_t *backend = &(proxy->backends[proxy->count]);
+			if(proxy->count == PROXY_MAX_BACKENDS || !proxy_parse(cursor, len, backend->address, backend->port)){
+				proxy_destroy(proxy);
+				return NULL;
+			}
+
+			pthread_mutex_init(&(backend->lock), NULL);
+			backend->healthy = true;
+			backend->max = conns;
+			backend->idle = calloc(conns, sizeof(proxy_upstream_t*));
+			backend->queue_tail = &(backend->queue);
+
+			// ring points
+			char name[PROXY_ADDRESS_LEN + 32];
+			for(int v = 0; v < PROXY_VNODES; v++){
+				int n = snprintf(name, sizeof(name), "%s:%s#%d", backend->address, backend->port, v);
+				proxy->ring[proxy->ring_len++] = (proxy_point_t){
+					.hash = proxy_mix(djb2_hash((const uint8_t*)name, n)),
+					.backend = proxy->count
+				};
+			}
+
+			proxy->count++;
+		}
+
+		cursor += len;
+		if(*cursor == ',')
+			cursor++;
+	}
+
+	if(proxy->count == 0){
+		proxy_destroy(proxy);
+		return NULL;
+	}
+
+	qsort(proxy->ring, proxy->ring_len, sizeof(proxy_point_t), proxy_point_compare);
+	fio_state_callback_add(FIO_CALL_ON_START, proxy_on_start, proxy);
+	return proxy;
+}
+
+void proxy_destroy(proxy_t *proxy){
+	if(proxy == NULL)
+		return;
+
+	fio_state_callback_remove(FIO_CALL_ON_START, proxy_on_start, proxy);
+
+	for(size_t i = 0; i < proxy->count; i++){
+		proxy_backend_t *backend = &(proxy->backends[i]);
+		while(backend->queue != NULL){
+			proxy_pending_t *next = backend->queue->next;
+			free(backend->queue);
+			backend->queue = next;
+		}
+
+		free(backend->idle);
+		pthread_mutex_destroy(&(backend->lock));
+	}
+
+	free(proxy);
+}
+
+int proxy_find(proxy_t *proxy, const char *backend){
+	char address[PROXY_ADDRESS_LEN], port[16];
+	if(backend == NULL || !proxy_parse(backend, strlen(backend), address, port))
+		return -1;
+
+	for(size_t i = 0; i < proxy->count; i++){
+		if(strcmp(proxy->backends[i].address, address) == 0 && strcmp(proxy->backends[i].port, port) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+int proxy_route(proxy_t *proxy, int64_t key){
+	uint64_t hash = proxy_mix((uint64_t)key);
+
+	// first point at or after the key
+	size_t low = 0, high = proxy->ring_len;
+	while(low < high){
+		size_t mid = (low + high) / 2;
+		if(proxy->ring[mid].hash < hash)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	// the owner is the first point, up or not: another backend's cache was never current for its keys
+	int owner = proxy->ring[low % proxy->ring_len].backend;
+	if(!proxy->failover || proxy->backends[owner].healthy)
+		return owner;
+
+	// walk clockwise past the backends that are down
+	for(size_t i = 1; i < proxy->ring_len; i++){
+		int backend = proxy->ring[(low + i) % proxy->ring_len].backend;
+		if(proxy->backends[backend].healthy)
+			return backend;
+	}
+
+	return -1;
+}
+
+void proxy_set_failover(proxy_t *proxy, bool failover){
+	proxy->failover = failover;
+}
+
+bool proxy_healthy(proxy_t *proxy, int backend){
+	return proxy->backends[backend].healthy;
+}
+
+void proxy_forward(proxy_t *proxy, int backend_index, const char *request, size_t len, proxy_on_response on_response, void *udata){
+	proxy_backend_t *backend = &(proxy->backends[backend_index]);
+
+	proxy_pending_t *pending = malloc(sizeof(proxy_pending_t) + len);
+	pending->next = NULL;
+	pending->on_response = on_response;
+	pending->udata = udata;
+	pending->len = len;
+	memcpy(pending->request, request, len);
+
+	bool connect = false;
+	pthread_mutex_lock(&(backend->lock));
+	proxy_upstream_t *up = backend->idle_count > 0 ? backend->idle[--backend->idle_count] : NULL;
+	if(up == NULL){
+		*(backend->queue_tail) = pending;
+		backend->queue_tail = &(pending->next);
+
+		connect = backend->total < backend->max;
+		if(connect)
+			backend->total++;
+	}
+	pthread_mutex_unlock(&(backend->lock));
+
+	if(up != NULL)
+		proxy_upstream_send(up, pending);
+
+	if(connect)
+		proxy_backend_connect(backend);
+}
+
+// ------------------------------------------------------------ Load balancer ------------------------------------------------------
+
+// drop a reference, the last one frees the client
+static void proxy_client_release(proxy_client_t *client, size_t refs){
+	if(refs > 0)
+		return;
+
+	free(client->in.data);
+	pthread_mutex_destroy(&(client->lock));
+	free(client);
+}
+
+// a backend answered: write every response that is next in line
+static void proxy_client_on_response(char *response, size_t len, void *udata){
+	proxy_slot_t *slot = udata;
+	proxy_client_t *client = slot->client;
+
+	if(response == NULL){
+		static const char bad_gateway[] = PROXY_RESPONSE("502 Bad Gateway");
+		response = malloc(sizeof(bad_gateway) - 1);
+		len = sizeof(bad_gateway) - 1;
+		memcpy(response, bad_gateway, len);
+	}
+
+	pthread_mutex_lock(&(client->lock));
+	slot->response = response;
+	slot->len = len;
+
+	while(client->head != NULL && client->head->response != NULL){
+		proxy_slot_t *next = client->head;
+		client->head = next->next;
+		if(client->head == NULL)
+			client->tail = &(client->head);
+
+		if(!client->closed){
+			fio_write2(client->uuid, .data.buffer = next->response, .length = next->len, .after.dealloc = free);
+			if(next->close)
+				fio_close(client->uuid);
+		}
+		else
+			free(next->response);
+
+		client->in_flight--;
+		client->refs--;
+		free(next);
+	}
+
+	bool resume = client->suspended && !client->closed && client->in_flight < PROXY_PIPELINE;
+	if(resume)
+		client->suspended = false;
+
+	size_t refs = client->refs;
+	intptr_t uuid = client->uuid;
+	pthread_mutex_unlock(&(client->lock));
+
+	if(resume)
+		fio_force_event(uuid, FIO_EVENT_ON_DATA);
+
+	proxy_client_release(client, refs);
+}
+
+// queue a response slot for the next request. false when the pipeline is full
+static proxy_slot_t *proxy_client_slot(proxy_client_t *client, bool close){
+	proxy_slot_t *slot = calloc(1, sizeof(proxy_slot_t));
+	slot->client = client;
+	slot->close = close;
+
+	pthread_mutex_lock(&(client->lock));
+	*(client->tail) = slot;
+	client->tail = &(slot->next);
+	client->in_flight++;
+	client->refs++;
+	pthread_mutex_unlock(&(client->lock));
+
+	return slot;
+}
+
+// answer a slot without a backend
+static void proxy_client_reply(proxy_slot_t *slot, const char *response, size_t len){
+	char *copy = malloc(len);
+	memcpy(copy, response, len);
+	proxy_client_on_response(copy, len, slot);
+}
+
+static void proxy_client_on_data(intptr_t uuid, fio_protocol_s *protocol){
+	proxy_client_t *client = (proxy_client_t*)protocol;
+	if(!proxy_buffer_read(&(client->in), uuid, PROXY_MAX_REQUEST))
+		return;
+
+	while(client->in.len > 0){
+		// too many responses pending, read again once they drain
+		pthread_mutex_lock(&(client->lock));
+		bool full = client->in_flight >= PROXY_PIPELINE;
+		if(full){
+			client->suspended = true;
+			fio_suspend(uuid);
+		}
+		pthread_mutex_unlock(&(client->lock));
+		if(full)
+			return;
+
+		int64_t key;
+		bool close = false;
+		ssize_t len = proxy_request_len(client->in.data, client->in.len, &key, &close);
+		if(len == 0)
+			break;
+
+		if(len < 0){
+			static const char bad_request[] = PROXY_RESPONSE_CLOSE("400 Bad Request");
+			proxy_client_reply(proxy_client_slot(client, true), bad_request, sizeof(bad_request) - 1);
+			client->in.len = 0;
+			return;
+		}
+
+		proxy_slot_t *slot = proxy_client_slot(client, close);
+		// the owner is down and nobody else may serve its clients
+		int backend = proxy_route(client->proxy, key);
+		if(backend >= 0 && !proxy_healthy(client->proxy, backend)){
+			static const char unavailable[] = PROXY_RESPONSE("503 Service Unavailable");
+			proxy_client_reply(slot, unavailable, sizeof(unavailable) - 1);
+		}
+		else if(backend < 0)
+			proxy_client_on_response(NULL, 0, slot);
+		else
+			proxy_forward(client->proxy, backend, client->in.data, len, proxy_client_on_response, slot);
+
+		proxy_buffer_consume(&(client->in), len);
+
+		// nothing after a closing request is answered
+		if(close){
+			client->in.len = 0;
+			return;
+		}
+	}
+}
+
+static void proxy_client_on_close(intptr_t uuid, fio_protocol_s *protocol){
+	proxy_client_t *client = (proxy_client_t*)protocol;
+
+	pthread_mutex_lock(&(client->lock));
+	client->closed = true;
+	size_t refs = --client->refs;
+	pthread_mutex_unlock(&(client->lock));
+
+	proxy_client_release(client, refs);
+}
+
+static void proxy_on_open(intptr_t uuid, void *udata){
+	proxy_client_t *client = calloc(1, sizeof(proxy_client_t));
+	client->protocol.on_data = proxy_client_on_data;
+	client->protocol.on_close = proxy_client_on_close;
+	client->protocol.ping = proxy_upstream_ping;
+	client->proxy = udata;
+	client->uuid = uuid;
+	client->tail = &(client->head);
+	client->refs = 1;
+	pthread_mutex_init(&(client->lock), NULL);
+
+	fio_attach(uuid, &(client->protocol));
+}
+
+bool proxy_listen(proxy_t *proxy, const char *port){
+	return fio_listen(.port = port, .on_open = proxy_on_open, .udata = proxy) != -1;
+}
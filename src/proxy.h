@@ -0,0 +1,77 @@
+#ifndef _PROXY_HEADER_
+#define _PROXY_HEADER_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define PROXY_MAX_BACKENDS 16
+#define PROXY_VNODES 128					// ring points per backend
+#define PROXY_PIPELINE 64					// requests in flight per client connection before it stops being read
+#define PROXY_MAX_REQUEST (64 * 1024)		// head and body of a single request
+#define PROXY_HEALTH_MS 1000				// backends without connections are probed this often
+
+// ------------------------------------------------------------ Types --------------------------------------------------------------
+
+/**
+ * @brief backend set: consistent hash ring plus a keep-alive connection pool per backend
+*/
+typedef struct proxy_t proxy_t;
+
+/**
+ * @brief called once per forwarded request with the raw http response, nul terminated and owned by the callee (free it).
+ * response is NULL when the backend could not be reached or closed without answering
+*/
+typedef void (*proxy_on_response)(char *response, size_t len, void *udata);
+
+// ------------------------------------------------------------ Functions ----------------------------------------------------------
+
+/**
+ * @brief create the backend set from a comma separated list: "host:port,unix:/path/to.sock".
+ * conns is the pool limit per backend. Health checks start with the reactor. Returns NULL on an invalid list
+*/
+proxy_t *proxy_new(const char *backends, size_t conns);
+
+/**
+ * @brief free the backend set. Call after fio_start returns
+*/
+void proxy_destroy(proxy_t *proxy);
+
+/**
+ * @brief number of backends
+*/
+size_t proxy_backends(proxy_t *proxy);
+
+/**
+ * @brief index of a backend given as in the list ("host:port" or "unix:/path"), -1 when it isn't there
+*/
+int proxy_find(proxy_t *proxy, const char *backend);
+
+/**
+ * @brief backend that owns key on the ring, up or not. With failover the next healthy one clockwise, -1 when none is up
+*/
+int proxy_route(proxy_t *proxy, int64_t key);
+
+/**
+ * @brief let healthy backends take the keys of those that are down. Only when every backend reads the saldo from the db
+*/
+void proxy_set_failover(proxy_t *proxy, bool failover);
+
+/**
+ * @brief whether the last connect to the backend worked
+*/
+bool proxy_healthy(proxy_t *proxy, int backend);
+
+/**
+ * @brief send a complete raw http request to a backend over a pooled connection.
+ * on_response is called exactly once, possibly before this returns
+*/
+void proxy_forward(proxy_t *proxy, int backend, const char *request, size_t len, proxy_on_response on_response, void *udata);
+
+/**
+ * @brief load balancer mode: accept http clients on port and route each request by the client id in its path.
+ * Pipelined responses keep the request order. Call before fio_start
+*/
+bool proxy_listen(proxy_t *proxy, const char *port);
+
+#endif
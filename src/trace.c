@@ -0,0 +1,150 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// ------------------------------------------------------------ Types --------------------------------------------------------------
+
+// one thread's spans, only that thread writes them
+typedef struct trace_block_t{
+	struct trace_block_t *next;
+	uint32_t tid;
+	uint64_t requests;						// sampled so far, numbers them
+	uint64_t head;							// spans ever written, the next goes to head % TRACE_RING
+	trace_span_t spans[TRACE_RING];
+}trace_block_t;
+
+__thread uint64_t trace_current = 0;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;		// taken once per thread, to join the list
+static trace_block_t *trace_blocks = NULL;
+static uint32_t trace_threads = 0;
+static uint32_t trace_every = 0;
+static __thread uint32_t trace_countdown = 0;
+static __thread trace_block_t *trace_local = NULL;
+
+// ------------------------------------------------------------ Helpers ------------------------------------------------------------
+
+// the calling thread's ring, created on its first sampled request
+static trace_block_t *trace_block(void){
+	if(trace_local != NULL)
+		return trace_local;
+
+	trace_block_t *block = calloc(1, sizeof(trace_block_t));
+
+	pthread_mutex_lock(&trace_lock);
+	block->tid = ++trace_threads;
+	block->next = trace_blocks;
+	__atomic_store_n(&trace_blocks, block, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&trace_lock);
+
+	trace_local = block;
+	return block;
+}
+
+// json string contents: quotes, backslashes and control characters are dropped
+static void trace_escape(char *dest, const char *src, size_t size){
+	size_t len = 0;
+	for(; *src != '\0' && len < size - 1; src++){
+		if(*src != '"' && *src != '\\' && (unsigned char)*src >= ' ')
+			dest[len++] = *src;
+		else if(*src == '\n' || *src == '\t')
+			dest[len++] = ' ';
+	}
+	dest[len] = '\0';
+}
+
+// ------------------------------------------------------------ Functions ----------------------------------------------------------
+
+void trace_init(uint32_t every){
+	trace_every = every;
+}
+
+void trace_destroy(void){
+	pthread_mutex_lock(&trace_lock);
+	trace_block_t *block = trace_blocks;
+	trace_blocks = NULL;
+	pthread_mutex_unlock(&trace_lock);
+
+	while(block != NULL){
+		trace_block_t *next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+void trace_begin(void){
+	if(trace_every == 0)
+		return;
+
+	// a countdown instead of a random draw, the first request of each thread is sampled
+	if(trace_countdown > 1){
+		trace_countdown--;
+		return;
+	}
+	trace_countdown = trace_every;
+
+	trace_block_t *block = trace_block();
+	trace_current = ((uint64_t)block->tid << 40) | ++block->requests;
+}
+
+void trace_end(void){
+	trace_current = 0;
+}
+
+void trace_record(const char *name, const char *detail, uint64_t start_ns){
+	if(trace_current == 0)
+		return;
+
+	uint64_t now = trace_now_ns();
+	trace_block_t *block = trace_block();
+	trace_span_t *span = &(block->spans[block->head % TRACE_RING]);
+	span->name = name;
+	span->request = trace_current;
+	span->start_ns = start_ns;
+	span->duration_ns = now - start_ns;
+	span->detail[0] = '\0';
+	if(detail != NULL)
+		trace_escape(span->detail, detail, TRACE_DETAIL);
+
+	// published after the span, a dump only reads up to head
+	__atomic_store_n(&(block->head), block->head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_dump(string *out){
+	int pid = getpid();
+	trace_span_t *copy = malloc(sizeof(trace_span_t) * TRACE_RING);
+	bool first = true;
+
+	string_cat_raw(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0);
+	for(trace_block_t *block = __atomic_load_n(&trace_blocks, __ATOMIC_ACQUIRE); block != NULL; block = block->next){
+		string_write(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}", 128,
+			first ? "" : ",", pid, block->tid, block->tid);
+		first = false;
+
+		// copy the ring while its thread goes on, then drop what it overwrote meanwhile
+		uint64_t head = __atomic_load_n(&(block->head), __ATOMIC_ACQUIRE);
+		uint64_t base = head > TRACE_RING ? head - TRACE_RING : 0;
+		for(uint64_t i = base; i < head; i++)
+			copy[i - base] = block->spans[i % TRACE_RING];
+
+		uint64_t after = __atomic_load_n(&(block->head), __ATOMIC_ACQUIRE);
+		uint64_t from = after > TRACE_RING && after - TRACE_RING > base ? after - TRACE_RING : base;
+
+		for(uint64_t i = from; i < head; i++){
+			trace_span_t *span = &(copy[i - base]);
+			string_write(out, ",{\"name\":\"%s\",\"cat\":\"api\",\"ph\":\"X\",\"ts\":%lu.%03lu,\"dur\":%lu.%03lu,\"pid\":%d,\"tid\":%u,\"args\":{\"request\":\"%lx\"%s%s%s}}", 256 + TRACE_DETAIL,
+				span->name,
+				span->start_ns / 1000, span->start_ns % 1000,
+				span->duration_ns / 1000, span->duration_ns % 1000,
+				pid, block->tid, span->request,
+				span->detail[0] != '\0' ? ",\"detail\":\"" : "", span->detail, span->detail[0] != '\0' ? "\"" : ""
+			);
+		}
+	}
+	string_cat_raw(out, "]}", 0);
+
+	free(copy);
+}
@@ -0,0 +1,80 @@
+#ifndef _TRACE_HEADER_
+#define _TRACE_HEADER_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include "string+.h"
+
+#define TRACE_RING 4096						// spans kept per thread, the oldest are overwritten
+#define TRACE_DETAIL 48						// bytes of detail kept with a span
+
+// ------------------------------------------------------------ Types --------------------------------------------------------------
+
+// one timed phase of a sampled request
+typedef struct{
+	const char *name;						/**< string literal */
+	uint64_t request;						/**< id of the sampled request it belongs to */
+	uint64_t start_ns;						/**< monotonic */
+	uint64_t duration_ns;
+	char detail[TRACE_DETAIL];				/**< copied, may be empty */
+}trace_span_t;
+
+// id of the request the calling thread is tracing, 0 when it isn't sampled
+extern __thread uint64_t trace_current;
+
+// ------------------------------------------------------------ Functions ----------------------------------------------------------
+
+/**
+ * @brief trace 1 in every requests. 0 disables tracing. Call before any thread traces
+*/
+void trace_init(uint32_t every);
+
+/**
+ * @brief free every thread's ring. Call after the threads stopped
+*/
+void trace_destroy(void);
+
+/**
+ * @brief start a request on the calling thread, sampled or not. Unsampled requests cost a counter decrement
+*/
+void trace_begin(void);
+
+/**
+ * @brief end the calling thread's request
+*/
+void trace_end(void);
+
+static inline uint64_t trace_now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief start of a span: the time when the request is sampled, 0 otherwise. No clock read when it isn't
+*/
+static inline uint64_t trace_start(void){
+	return trace_current != 0 ? trace_now_ns() : 0;
+}
+
+/**
+ * @brief record a span from start to now on the calling thread's ring. detail may be NULL
+*/
+void trace_record(const char *name, const char *detail, uint64_t start_ns);
+
+/**
+ * @brief end of a span started with trace_start(), nothing when the request isn't sampled
+*/
+static inline void trace_span(const char *name, uint64_t start_ns){
+	if(start_ns != 0)
+		trace_record(name, NULL, start_ns);
+}
+
+/**
+ * @brief write every thread's ring as chrome trace event json, readable by chrome://tracing and perfetto. The rings are kept
+*/
+void trace_dump(string *out);
+
+#endif
@@ -8,7 +8,8 @@ char *parseIdAction(char *path, int64_t *idOut){
 	while(*cursor != '\0'){
 		if(isdigit(*cursor)){
 			*idOut = strtoll(cursor, &action, 10);
-			action++;
+			if(*action == '/')
+				action++;
 			break;
 		}
 
@@ -18,6 +19,19 @@ char *parseIdAction(char *path, int64_t *idOut){
 	return action;
 }
 
+// descricao as the api stores it: 1 to 10 bytes, none that would need escaping in the extrato json
+bool validDescricao(const char *descricao, size_t len){
+	if(len < 1 || len > 10)
+		return false;
+
+	for(size_t i = 0; i < len; i++){
+		unsigned char c = descricao[i];
+		if(c < ' ' || c == '"' || c == '\\' || c == 0x7f)
+			return false;
+	}
+
+	return true;
+}
 
 // {
 //     "valor": 1000,
@@ -66,9 +80,10 @@ bool parseTransa(char *transa, int64_t *valor_out, char *tipo_out, char **descri
 				
 				cursor++;
 				tmp = strchr(cursor, '"');
+				if(tmp == NULL) return false;
 				size_t len = (tmp - cursor);
 				
-				if(len < 1 || len > 10)
+				if(!validDescricao(cursor, len))
 					return false;
 					
 				memcpy(*descricao_out, cursor, len);
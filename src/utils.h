@@ -3,12 +3,16 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <stdlib.h>
 
 // parse id and action from path: "/jdhuiasda/32847239/action"
 char *parseIdAction(char *path, int64_t *idOut);
 
+// descricao of 1 to 10 bytes without quotes, backslashes or control bytes
+bool validDescricao(const char *descricao, size_t len);
+
 // parse json transaction
 bool parseTransa(char *transa, int64_t *valor_out, char *tipo_out, char **descricao_out);
 